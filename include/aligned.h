@@ -0,0 +1,90 @@
+//
+// Copyright (c) 2018 Enrico Kaden & University College London
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// * Redistributions of source code must retain the above copyright notice, this
+//   list of conditions and the following disclaimer.
+//
+// * Redistributions in binary form must reproduce the above copyright notice,
+//   this list of conditions and the following disclaimer in the documentation
+//   and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#ifndef _ALIGNED_H
+#define _ALIGNED_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+
+namespace smt {
+
+// Alignment of the darray storage, i.e. one cache line, which also suffices
+// for the widest vector registers (AVX-512).
+const std::size_t alignment = 64;
+
+// Allocates and default-initialises n objects of type T, like new T[n], but
+// with the first object aligned to smt::alignment. The address returned by
+// std::malloc is stored in front of the aligned block. As with new T[n], an
+// oversized n throws std::bad_array_new_length, and if a constructor throws,
+// the objects constructed so far are destroyed and the block is released.
+template <typename T>
+T* aligned_new(const std::size_t& n) {
+	static_assert(alignof(T) <= alignment, "alignof(T) <= alignment");
+	if(n > (SIZE_MAX-alignment-sizeof(void*))/sizeof(T)) {
+		throw std::bad_array_new_length();
+	}
+	void* const raw = std::malloc(n*sizeof(T)+alignment+sizeof(void*));
+	if(raw == nullptr) {
+		throw std::bad_alloc();
+	}
+	const std::uintptr_t addr = reinterpret_cast<std::uintptr_t>(raw)+sizeof(void*);
+	void* const aligned = reinterpret_cast<void*>((addr+alignment-1) & ~std::uintptr_t(alignment-1));
+	static_cast<void**>(aligned)[-1] = raw;
+
+	T* const data = static_cast<T*>(aligned);
+	std::size_t ii = 0;
+	try {
+		for(; ii < n; ++ii) {
+			::new(static_cast<void*>(data+ii)) T;
+		}
+	} catch(...) {
+		while(ii > 0) {
+			data[--ii].~T();
+		}
+		std::free(raw);
+		throw;
+	}
+
+	return data;
+}
+
+// Destroys and releases n objects obtained from smt::aligned_new.
+template <typename T>
+void aligned_delete(T* const data, const std::size_t& n) {
+	if(data != nullptr) {
+		for(std::size_t ii = 0; ii < n; ++ii) {
+			data[ii].~T();
+		}
+		std::free(static_cast<void**>(static_cast<void*>(data))[-1]);
+	}
+}
+
+} // smt
+
+#endif // _ALIGNED_H
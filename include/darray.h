@@ -33,20 +33,20 @@
 #include <ostream>
 #include <type_traits>
 
+#include "aligned.h"
 #include "debug.h"
 #include "indexable.h"
 #include "slicable.h"
 
 namespace smt {
 
-// TODO: unsigned int => std::size_t, signed int => std::ptrdiff_t
 // TODO: Switch from row-major to column-major order.
 
 template <typename T, unsigned int D>
 class darray {
 public:
 	typedef T value_type;
-	typedef unsigned int size_type;
+	typedef std::size_t size_type;
 
 	typedef T* iterator;
 	typedef const T* const_iterator;
@@ -55,20 +55,20 @@ public:
 	typedef const T& const_reference;
 
 	darray(): _rc(false), _data(0) {
-		for(unsigned int ii = 0; ii < D; ++ii) {
+		for(std::size_t ii = 0; ii < D; ++ii) {
 			_size[ii] = 0;
 		}
 	}
 
 	darray(const darray<T, 1>& rhs):
-			_rc(true), _data(new T[rhs.size(0)]) {
+			_rc(true), _data(smt::aligned_new<T>(rhs.size(0))) {
 		static_assert(D == 1, "D == 1");
 		_size[0] = rhs.size(0);
 		std::copy(rhs.begin(), rhs.end(), begin());
 	}
 
 	darray(const darray<T, 2>& rhs):
-			_rc(true), _data(new T[rhs.size(0)*rhs.size(1)]) {
+			_rc(true), _data(smt::aligned_new<T>(rhs.size(0)*rhs.size(1))) {
 		static_assert(D == 2, "D == 2");
 		_size[0] = rhs.size(0);
 		_size[1] = rhs.size(1);
@@ -76,7 +76,7 @@ public:
 	}
 
 	darray(const darray<T, 3>& rhs):
-			_rc(true), _data(new T[rhs.size(0)*rhs.size(1)*rhs.size(2)]) {
+			_rc(true), _data(smt::aligned_new<T>(rhs.size(0)*rhs.size(1)*rhs.size(2))) {
 		static_assert(D == 3, "D == 3");
 		_size[0] = rhs.size(0);
 		_size[1] = rhs.size(1);
@@ -85,7 +85,7 @@ public:
 	}
 
 	darray(const darray<T, 4>& rhs):
-			_rc(true), _data(new T[rhs.size(0)*rhs.size(1)*rhs.size(2)*rhs.size(3)]) {
+			_rc(true), _data(smt::aligned_new<T>(rhs.size(0)*rhs.size(1)*rhs.size(2)*rhs.size(3))) {
 		static_assert(D == 4, "D == 4");
 		_size[0] = rhs.size(0);
 		_size[1] = rhs.size(1);
@@ -94,8 +94,18 @@ public:
 		std::copy(rhs.begin(), rhs.end(), begin());
 	}
 
+	darray(darray<T, D>&& rhs):
+			_rc(rhs._rc), _data(rhs._data) {
+		for(std::size_t ii = 0; ii < D; ++ii) {
+			_size[ii] = rhs._size[ii];
+			rhs._size[ii] = 0;
+		}
+		rhs._rc = false;
+		rhs._data = nullptr;
+	}
+
 	explicit darray(const size_type& s0):
-			_rc(true), _data(new T[s0]) {
+			_rc(true), _data(smt::aligned_new<T>(s0)) {
 		static_assert(D == 1, "D == 1");
 		_size[0] = s0;
 	}
@@ -107,7 +117,7 @@ public:
 	}
 
 	explicit darray(const size_type& s0, const size_type& s1):
-			_rc(true), _data(new T[s0*s1]) {
+			_rc(true), _data(smt::aligned_new<T>(s0*s1)) {
 		static_assert(D == 2, "D == 2");
 		_size[0] = s0;
 		_size[1] = s1;
@@ -122,7 +132,7 @@ public:
 
 	explicit darray(const size_type& s0, const size_type& s1,
 			const size_type& s2):
-			_rc(true), _data(new T[s0*s1*s2]) {
+			_rc(true), _data(smt::aligned_new<T>(s0*s1*s2)) {
 		static_assert(D == 3, "D == 3");
 		_size[0] = s0;
 		_size[1] = s1;
@@ -140,7 +150,7 @@ public:
 
 	explicit darray(const size_type& s0, const size_type& s1,
 			const size_type& s2, const size_type& s3):
-			_rc(true), _data(new T[s0*s1*s2*s3]) {
+			_rc(true), _data(smt::aligned_new<T>(s0*s1*s2*s3)) {
 		static_assert(D == 4, "D == 4");
 		_size[0] = s0;
 		_size[1] = s1;
@@ -160,11 +170,11 @@ public:
 
 	~darray() {
 		if(_rc) {
-			delete [] _data;
+			smt::aligned_delete(_data, size());
 			_data = nullptr;
 		}
 		_rc = false;
-		for(unsigned int ii = 0; ii < D; ++ii) {
+		for(std::size_t ii = 0; ii < D; ++ii) {
 			_size[ii] = 0;
 		}
 	}
@@ -174,13 +184,45 @@ public:
 	}
 
 	darray<T, D>& operator=(const darray<T, D>& rhs) {
-		for(size_type ii = 0; ii < size(); ++ii) {
-			operator[](ii) = rhs[ii];
+		smt::assert(size() <= rhs.size());
+		std::copy(rhs.begin(), rhs.begin()+size(), begin());
+
+		return *this;
+	}
+
+	// A darray wrapping external memory keeps its storage and copies the
+	// elements, so that writes continue to reach the wrapped memory. Unlike an
+	// owning darray, it cannot take the size of rhs, which must hence match.
+	darray<T, D>& operator=(darray<T, D>&& rhs) {
+		if(this != &rhs) {
+			if(_rc || _data == nullptr) {
+				if(_rc) {
+					smt::aligned_delete(_data, size());
+				}
+				_rc = rhs._rc;
+				_data = rhs._data;
+				for(std::size_t ii = 0; ii < D; ++ii) {
+					_size[ii] = rhs._size[ii];
+					rhs._size[ii] = 0;
+				}
+				rhs._rc = false;
+				rhs._data = nullptr;
+			} else {
+				smt::assert(size() == rhs.size());
+				for(std::size_t ii = 0; ii < D; ++ii) {
+					smt::assert(_size[ii] == rhs._size[ii]);
+				}
+				std::copy(rhs.begin(), rhs.end(), begin());
+			}
 		}
 
 		return *this;
 	}
 
+	// The expression is evaluated once and then indexed without bounds checks,
+	// so that the loops vectorise. The storage is deliberately not restrict-
+	// qualified, since the expression may refer to *this, as in x = 2*x, and
+	// the compiler then checks for overlap at run time.
 	template <typename RHS>
 	darray<T, D>& operator=(const RHS& rhs) {
 		typedef typename std::conditional<
@@ -193,8 +235,12 @@ public:
 				>::type
 		>::type ExprT;
 
-		for(size_type ii = 0; ii < size(); ++ii) {
-			operator[](ii) = ExprT(rhs)[ii];
+		const ExprT e(rhs);
+		smt::assert(size() <= e.size());
+		T* const data = _data;
+		const std::size_t n = size();
+		for(std::size_t ii = 0; ii < n; ++ii) {
+			data[ii] = e[ii];
 		}
 
 		return *this;
@@ -212,8 +258,12 @@ public:
 				>::type
 		>::type ExprT;
 
-		for(size_type ii = 0; ii < size(); ++ii) {
-			operator[](ii) += ExprT(rhs)[ii];
+		const ExprT e(rhs);
+		smt::assert(size() <= e.size());
+		T* const data = _data;
+		const std::size_t n = size();
+		for(std::size_t ii = 0; ii < n; ++ii) {
+			data[ii] += e[ii];
 		}
 
 		return *this;
@@ -231,8 +281,12 @@ public:
 				>::type
 		>::type ExprT;
 
-		for(size_type ii = 0; ii < size(); ++ii) {
-			operator[](ii) -= ExprT(rhs)[ii];
+		const ExprT e(rhs);
+		smt::assert(size() <= e.size());
+		T* const data = _data;
+		const std::size_t n = size();
+		for(std::size_t ii = 0; ii < n; ++ii) {
+			data[ii] -= e[ii];
 		}
 
 		return *this;
@@ -250,7 +304,14 @@ public:
 				>::type
 		>::type ExprT;
 
-		for(size_type i = 0; i < size(); ++i) operator[](i) *= ExprT(rhs)[i];
+		const ExprT e(rhs);
+		smt::assert(size() <= e.size());
+		T* const data = _data;
+		const std::size_t n = size();
+		for(std::size_t ii = 0; ii < n; ++ii) {
+			data[ii] *= e[ii];
+		}
+
 		return *this;
 	}
 
@@ -266,8 +327,12 @@ public:
 				>::type
 		>::type ExprT;
 
-		for(size_type ii = 0; ii < size(); ++ii) {
-			operator[](ii) /= ExprT(rhs)[ii];
+		const ExprT e(rhs);
+		smt::assert(size() <= e.size());
+		T* const data = _data;
+		const std::size_t n = size();
+		for(std::size_t ii = 0; ii < n; ++ii) {
+			data[ii] /= e[ii];
 		}
 
 		return *this;
@@ -440,17 +505,17 @@ public:
 	void resize(const size_type& s0) {
 		static_assert(D == 1, "D == 1");
 		if(_rc) {
-			delete [] _data;
+			smt::aligned_delete(_data, size());
 		}
 		_rc = true;
 		_size[0] = s0;
-		_data = new T[s0];
+		_data = smt::aligned_new<T>(s0);
 	}
 
 	void resize(const size_type& s0, T *const data) {
 		static_assert(D == 1, "D == 1");
 		if(_rc) {
-			delete [] _data;
+			smt::aligned_delete(_data, size());
 		}
 		_rc = false;
 		_size[0] = s0;
@@ -460,18 +525,18 @@ public:
 	void resize(const size_type& s0, const size_type& s1) {
 		static_assert(D == 2, "D == 2");
 		if(_rc) {
-			delete [] _data;
+			smt::aligned_delete(_data, size());
 		}
 		_rc = true;
 		_size[0] = s0;
 		_size[1] = s1;
-		_data = new T[s0*s1];
+		_data = smt::aligned_new<T>(s0*s1);
 	}
 
 	void resize(const size_type& s0, const size_type& s1, T *const data) {
 		static_assert(D == 2, "D == 2");
 		if(_rc) {
-			delete [] _data;
+			smt::aligned_delete(_data, size());
 		}
 		_rc = false;
 		_size[0] = s0;
@@ -483,20 +548,20 @@ public:
 			const size_type& s2) {
 		static_assert(D == 3, "D == 3");
 		if(_rc) {
-			delete [] _data;
+			smt::aligned_delete(_data, size());
 		}
 		_rc = true;
 		_size[0] = s0;
 		_size[1] = s1;
 		_size[2] = s2;
-		_data = new T[s0*s1*s2];
+		_data = smt::aligned_new<T>(s0*s1*s2);
 	}
 
 	void resize(const size_type& s0, const size_type& s1,
 			const size_type& s2, T *const data) {
 		static_assert(D == 3, "D == 3");
 		if(_rc) {
-			delete [] _data;
+			smt::aligned_delete(_data, size());
 		}
 		_rc = false;
 		_size[0] = s0;
@@ -509,21 +574,21 @@ public:
 			const size_type& s2, const size_type& s3) {
 		static_assert(D == 4, "D == 4");
 		if(_rc) {
-			delete [] _data;
+			smt::aligned_delete(_data, size());
 		}
 		_rc = true;
 		_size[0] = s0;
 		_size[1] = s1;
 		_size[2] = s2;
 		_size[3] = s3;
-		_data = new T[s0*s1*s2*s3];
+		_data = smt::aligned_new<T>(s0*s1*s2*s3);
 	}
 
 	void resize(const size_type& s0, const size_type& s1,
 			const size_type& s2, const size_type& s3, T *const data) {
 		static_assert(D == 4, "D == 4");
 		if(_rc) {
-			delete [] _data;
+			smt::aligned_delete(_data, size());
 		}
 		_rc = false;
 		_size[0] = s0;
@@ -535,7 +600,7 @@ public:
 
 	size_type size() const {
 		size_type total_size = 1;
-		for(unsigned int ii = 0; ii < D; ++ii) {
+		for(std::size_t ii = 0; ii < D; ++ii) {
 			total_size *= _size[ii];
 		}
 		return total_size;
@@ -552,21 +617,229 @@ private:
 	T* _data;
 };
 
+// Non-owning view of a darray or of external memory. The constness of T
+// determines whether the viewed elements may be modified. A view has
+// reference semantics: copying a view refers to the same elements, whereas
+// assignment of another view of the same type is disabled, since it could
+// mean either to rebind or to copy the elements. The elements are copied with
+// assign(), or by assignment of an expression.
+template <typename T, unsigned int D>
+class darray_view {
+public:
+	typedef typename std::remove_const<T>::type value_type;
+	typedef std::size_t size_type;
+
+	typedef T* iterator;
+	typedef T* const_iterator;
+
+	typedef T& reference;
+	typedef T& const_reference;
+
+	darray_view(): _data(nullptr) {
+		for(std::size_t ii = 0; ii < D; ++ii) {
+			_size[ii] = 0;
+		}
+	}
+
+	darray_view(darray<value_type, D>& rhs): _data(rhs.begin()) {
+		for(std::size_t ii = 0; ii < D; ++ii) {
+			_size[ii] = rhs.size(ii);
+		}
+	}
+
+	darray_view(const darray<value_type, D>& rhs): _data(rhs.begin()) {
+		static_assert(std::is_const<T>::value, "std::is_const<T>::value");
+		for(std::size_t ii = 0; ii < D; ++ii) {
+			_size[ii] = rhs.size(ii);
+		}
+	}
+
+	darray_view(const darray_view<value_type, D>& rhs): _data(rhs.begin()) {
+		for(std::size_t ii = 0; ii < D; ++ii) {
+			_size[ii] = rhs.size(ii);
+		}
+	}
+
+	darray_view(const darray_view<const value_type, D>& rhs): _data(rhs.begin()) {
+		static_assert(std::is_const<T>::value, "std::is_const<T>::value");
+		for(std::size_t ii = 0; ii < D; ++ii) {
+			_size[ii] = rhs.size(ii);
+		}
+	}
+
+	explicit darray_view(const size_type& s0, T *const data):
+			_data(data) {
+		static_assert(D == 1, "D == 1");
+		_size[0] = s0;
+	}
+
+	explicit darray_view(const size_type& s0, const size_type& s1, T *const data):
+			_data(data) {
+		static_assert(D == 2, "D == 2");
+		_size[0] = s0;
+		_size[1] = s1;
+	}
+
+	explicit darray_view(const size_type& s0, const size_type& s1,
+			const size_type& s2, T *const data):
+			_data(data) {
+		static_assert(D == 3, "D == 3");
+		_size[0] = s0;
+		_size[1] = s1;
+		_size[2] = s2;
+	}
+
+	explicit darray_view(const size_type& s0, const size_type& s1,
+			const size_type& s2, const size_type& s3, T *const data):
+			_data(data) {
+		static_assert(D == 4, "D == 4");
+		_size[0] = s0;
+		_size[1] = s1;
+		_size[2] = s2;
+		_size[3] = s3;
+	}
+
+	~darray_view() {
+	}
+
+	explicit operator bool() const {
+		return size() != 0;
+	}
+
+	darray_view<T, D>& operator=(const darray_view<T, D>& rhs) = delete;
+
+	// Copies the elements of rhs into the viewed elements.
+	const darray_view<T, D>& assign(const darray_view<const value_type, D>& rhs) const {
+		smt::assert(size() <= rhs.size());
+		std::copy(rhs.begin(), rhs.begin()+size(), begin());
+
+		return *this;
+	}
+
+	template <typename RHS>
+	darray_view<T, D>& operator=(const RHS& rhs) {
+		typedef typename std::conditional<
+				smt::expr_traits<RHS>::conforms,
+				RHS,
+				typename std::conditional<
+						smt::indexable_traits<RHS>::conforms,
+						smt::constref<RHS>,
+						smt::scalar<RHS>
+				>::type
+		>::type ExprT;
+
+		const ExprT e(rhs);
+		smt::assert(size() <= e.size());
+		T* const data = _data;
+		const std::size_t n = size();
+		for(std::size_t ii = 0; ii < n; ++ii) {
+			data[ii] = e[ii];
+		}
+
+		return *this;
+	}
+
+	iterator begin() const {
+		return _data;
+	}
+
+	iterator end() const {
+		return _data+size();
+	}
+
+	reference front() const {
+		return _data[0];
+	}
+
+	reference back() const {
+		smt::assert(0 < size());
+		return _data[size()-1];
+	}
+
+	reference operator[](const size_type& ii) const {
+		smt::assert(0 <= ii && ii < size());
+		return _data[ii];
+	}
+
+	reference operator()(const size_type& i0) const {
+		static_assert(D == 1, "D == 1");
+		smt::assert(0 <= i0 && i0 < size(0));
+		return _data[i0];
+	}
+
+	reference operator()(const size_type& i0, const size_type& i1) const {
+		static_assert(D == 2, "D == 2");
+		smt::assert(0 <= i0 && i0 < size(0) && 0 <= i1 && i1 < size(1));
+		return _data[i0*size(1)+i1];
+	}
+
+	reference operator()(const size_type& i0, const size_type& i1,
+			const size_type& i2) const {
+		static_assert(D == 3, "D == 3");
+		smt::assert(0 <= i0 && i0 < size(0) && 0 <= i1 && i1 < size(1)
+				&& 0 <= i2 && i2 < size(2));
+		return _data[(i0*size(1)+i1)*size(2)+i2];
+	}
+
+	reference operator()(const size_type& i0, const size_type& i1,
+			const size_type& i2, const size_type& i3) const {
+		static_assert(D == 4, "D == 4");
+		smt::assert(0 <= i0 && i0 < size(0) && 0 <= i1 && i1 < size(1)
+				&& 0 <= i2 && i2 < size(2) && 0 <= i3 && i3 < size(3));
+		return _data[((i0*size(1)+i1)*size(2)+i2)*size(3)+i3];
+	}
+
+	size_type size() const {
+		size_type total_size = 1;
+		for(std::size_t ii = 0; ii < D; ++ii) {
+			total_size *= _size[ii];
+		}
+		return total_size;
+	}
+
+	size_type size(const size_type& ii) const {
+		smt::assert(0 <= ii && ii < D);
+		return _size[ii];
+	}
+
+private:
+	size_type _size[D];
+	T* _data;
+};
+
 template <typename T, unsigned int D>
 struct indexable_traits<darray<T, D>> {
 	static const bool conforms = true;
 
 	static typename darray<T, D>::value_type index(
-			const darray<T, D>& a, const unsigned int& ii) {
+			const darray<T, D>& a, const std::size_t& ii) {
 		return a[ii];
 	}
 
 	static typename darray<T, D>::value_type& index(
-			darray<T, D>& a, const unsigned int& ii) {
+			darray<T, D>& a, const std::size_t& ii) {
+		return a[ii];
+	}
+
+	static std::size_t size(const darray<T, D>& a) {
+		return a.size();
+	}
+};
+
+template <typename T, unsigned int D>
+struct indexable_traits<darray_view<T, D>> {
+	static const bool conforms = true;
+
+	static typename darray_view<T, D>::value_type index(
+			const darray_view<T, D>& a, const std::size_t& ii) {
 		return a[ii];
 	}
 
-	static unsigned int size(const darray<T, D>& a) {
+	static T& index(darray_view<T, D>& a, const std::size_t& ii) {
+		return a[ii];
+	}
+
+	static std::size_t size(const darray_view<T, D>& a) {
 		return a.size();
 	}
 };
@@ -575,8 +848,8 @@ template <typename T>
 darray<T, 1> gemv(const darray<T, 2>& A, const darray<T, 1>& x) {
 	darray<T, 1> y(A.size(0));
 	y = 0;
-	for(unsigned int ii = 0; ii < A.size(0); ++ii) {
-		for(unsigned int jj = 0; jj < A.size(1); ++jj) {
+	for(std::size_t ii = 0; ii < A.size(0); ++ii) {
+		for(std::size_t jj = 0; jj < A.size(1); ++jj) {
 			y(ii) += A(ii, jj)*x(jj);
 		}
 	}
@@ -587,7 +860,7 @@ darray<T, 1> gemv(const darray<T, 2>& A, const darray<T, 1>& x) {
 template <typename T>
 T dot(const darray<T, 1>& x, const darray<T, 1>& y) {
 	T ret = 0;
-	for(unsigned int ii = 0; ii < x.size(0); ++ii) {
+	for(std::size_t ii = 0; ii < x.size(0); ++ii) {
 		ret += x(ii)*y(ii);
 	}
 
@@ -40,10 +40,14 @@
 #include <sstream>
 #include <string>
 #include <tuple>
+#include <utility>
 
 #include "darray.h"
 #include "debug.h"
+#include "dispatch.h"
+#include "pow.h"
 #include "sarray.h"
+#include "svector.h"
 
 namespace smt {
 
@@ -82,6 +86,12 @@ public:
 		}
 	}
 
+	// Protocol of n measurements held in memory, i.e. the b-values and,
+	// unless bvecs is a null pointer, the gradient directions with three
+	// components per measurement. The caller checks the b-values.
+	diffenc(const float_t* bvals, const float_t* bvecs, const std::size_t& n):
+		diffenc(diffenc_buffer(bvals, bvecs, n)) {}
+
 	diffenc(const diffenc& rhs, const smt::sarray<float_t, 3, 3>& graddev):
 		diffenc(diffenc_graddev(rhs, graddev)) {}
 
@@ -95,11 +105,44 @@ public:
 		});
 	}
 
+	// Scale factors of the diffusion weighting factors due to the gradient
+	// deviation, as in diffenc(rhs, graddev), for a block of voxels in
+	// structure-of-arrays layout. graddev(ll, vv) holds the ll-th of the nine
+	// tensor components of voxel vv, ordered as in the NIfTI-1 volume, and
+	// scales(ii, vv) receives the factor of measurement ii, such that its
+	// adjusted b-value is bvalues(mapping(ii))*scales(ii, vv). The kernel is
+	// compiled for several instruction sets.
+	SMT_TARGET_CLONES void scales_graddev(const smt::darray_view<const float_t, 2>& graddev, const smt::darray_view<float_t, 2>& scales) const {
+		smt::assert(graddev.size(0) == 9 && scales.size(0) == mapping.size() && scales.size(1) == graddev.size(1));
+		const std::size_t n = graddev.size(1);
+		const float_t* __restrict const g00 = graddev.begin()+0*n;
+		const float_t* __restrict const g10 = graddev.begin()+1*n;
+		const float_t* __restrict const g20 = graddev.begin()+2*n;
+		const float_t* __restrict const g01 = graddev.begin()+3*n;
+		const float_t* __restrict const g11 = graddev.begin()+4*n;
+		const float_t* __restrict const g21 = graddev.begin()+5*n;
+		const float_t* __restrict const g02 = graddev.begin()+6*n;
+		const float_t* __restrict const g12 = graddev.begin()+7*n;
+		const float_t* __restrict const g22 = graddev.begin()+8*n;
+		for(std::size_t ii = 0; ii < mapping.size(); ++ii) {
+			const float_t u0 = gradients(mapping(ii))(0);
+			const float_t u1 = gradients(mapping(ii))(1);
+			const float_t u2 = gradients(mapping(ii))(2);
+			float_t* __restrict const data = scales.begin()+ii*n;
+			for(std::size_t vv = 0; vv < n; ++vv) {
+				const float_t tmp0 = u0+g00[vv]*u0+g01[vv]*u1+g02[vv]*u2;
+				const float_t tmp1 = u1+g10[vv]*u0+g11[vv]*u1+g12[vv]*u2;
+				const float_t tmp2 = u2+g20[vv]*u0+g21[vv]*u1+g22[vv]*u2;
+				data[vv] = tmp0*tmp0+tmp1*tmp1+tmp2*tmp2;
+			}
+		}
+	}
+
 private:
-	diffenc(const std::tuple<smt::darray<float_t, 1>, smt::darray<smt::sarray<float_t, 3>, 1>, smt::darray<std::size_t, 1>>& rhs):
-		bvalues(std::get<0>(rhs)),
-		gradients(std::get<1>(rhs)),
-		mapping(std::get<2>(rhs)) {}
+	diffenc(std::tuple<smt::darray<float_t, 1>, smt::darray<smt::sarray<float_t, 3>, 1>, smt::darray<std::size_t, 1>>&& rhs):
+		bvalues(std::move(std::get<0>(rhs))),
+		gradients(std::move(std::get<1>(rhs))),
+		mapping(std::move(std::get<2>(rhs))) {}
 
 	std::tuple<smt::darray<float_t, 1>, smt::darray<smt::sarray<float_t, 3>, 1>, smt::darray<std::size_t, 1>> diffenc_fsl(
 			const std::string& filename_bvals, const std::string& filename_bvecs) const {
@@ -123,7 +166,24 @@ private:
 		smt::darray<std::size_t, 1> mapping_(bvalues_.size(0));
 		std::iota(std::begin(mapping_), std::end(mapping_), 0);
 
-		return std::make_tuple(bvalues_, gradients_, mapping_);
+		return std::make_tuple(std::move(bvalues_), std::move(gradients_), std::move(mapping_));
+	}
+
+	std::tuple<smt::darray<float_t, 1>, smt::darray<smt::sarray<float_t, 3>, 1>, smt::darray<std::size_t, 1>> diffenc_buffer(
+			const float_t* bvals, const float_t* bvecs, const std::size_t& n) const {
+		smt::darray<float_t, 1> bvalues_(n);
+		smt::darray<smt::sarray<float_t, 3>, 1> gradients_(n);
+		for(std::size_t ii = 0; ii < n; ++ii) {
+			bvalues_(ii) = bvals[ii];
+			for(std::size_t jj = 0; jj < 3; ++jj) {
+				gradients_(ii)(jj) = (bvecs != nullptr)? bvecs[3*ii+jj] : float_t(0);
+			}
+		}
+		normalise_gradients(gradients_);
+		smt::darray<std::size_t, 1> mapping_(n);
+		std::iota(std::begin(mapping_), std::end(mapping_), 0);
+
+		return std::make_tuple(std::move(bvalues_), std::move(gradients_), std::move(mapping_));
 	}
 
 	std::tuple<smt::darray<float_t, 1>, smt::darray<smt::sarray<float_t, 3>, 1>, smt::darray<std::size_t, 1>> diffenc_mrtrix(
@@ -143,7 +203,7 @@ private:
 		smt::darray<std::size_t, 1> mapping_(bvalues_.size(0));
 		std::iota(std::begin(mapping_), std::end(mapping_), 0);
 
-		return std::make_tuple(bvalues_, gradients_, mapping_);
+		return std::make_tuple(std::move(bvalues_), std::move(gradients_), std::move(mapping_));
 	}
 
 	std::tuple<smt::darray<float_t, 1>, smt::darray<smt::sarray<float_t, 3>, 1>, smt::darray<std::size_t, 1>> diffenc_graddev(
@@ -163,7 +223,7 @@ private:
 		}
 		smt::darray<std::size_t, 1> mapping_(rhs.mapping);
 
-		return std::make_tuple(bvalues_, gradients_, mapping_);
+		return std::make_tuple(std::move(bvalues_), std::move(gradients_), std::move(mapping_));
 	}
 
 	std::deque<float_t> read_bvals_fsl(const std::string& filename) const {
@@ -262,6 +322,179 @@ private:
 	}
 };
 
+// Grouping of the measurements into shells of similar diffusion weighting.
+// Ordered by b-value, a measurement joins the preceding shell if the two
+// b-values differ by at most tol, whereas zero and nonzero b-values are never
+// grouped together. A shell is represented by the mean b-value of its member
+// measurements members(offsets(ss)), ..., members(offsets(ss+1)-1). The
+// count of a shell weights it in the least-squares objective, which is the
+// number of its members unless the shells hold spherical means.
+template <typename float_t>
+class shells {
+public:
+	const smt::darray<float_t, 1> bvalues;
+	const smt::darray<std::size_t, 1> counts;
+	const smt::darray<std::size_t, 1> offsets;
+	const smt::darray<std::size_t, 1> members;
+
+	shells() {}
+
+	shells(const smt::diffenc<float_t>& dw, const float_t& tol = 0):
+		shells(shells_cluster(dw, tol)) {}
+
+	// Spherical means as written by smtmean, i.e. one measurement per shell
+	// holding the mean of counts(ss) measurements, given as a table with the
+	// b-value (s/mm²) and the count of one shell per line.
+	explicit shells(const std::string& filename):
+		shells(shells_table(filename)) {}
+
+	explicit operator bool() const {
+		return (offsets)? true : false;
+	}
+
+	std::size_t size() const {
+		return bvalues.size();
+	}
+
+	bool any_zero_bvalue() const {
+		return std::any_of(std::begin(bvalues), std::end(bvalues), [&](const float_t& bvalue) {
+			return bvalue == float_t(0);
+		});
+	}
+
+	smt::svector<float_t> mean(const smt::darray_view<const float_t, 1>& y) const {
+		smt::svector<float_t> y_mean(size());
+		for(std::size_t ss = 0; ss < size(); ++ss) {
+			float_t tmp = 0;
+			for(std::size_t ii = offsets(ss); ii < offsets(ss+1); ++ii) {
+				tmp += y(members(ii));
+			}
+			y_mean(ss) = tmp/(offsets(ss+1)-offsets(ss));
+		}
+
+		return y_mean;
+	}
+
+	// Sum of squares of y about the shell means, which the per-shell
+	// reduction of a least-squares objective leaves as a constant.
+	float_t sumsq(const smt::darray_view<const float_t, 1>& y, const smt::darray_view<const float_t, 1>& y_mean, const bool& nonzero = false) const {
+		float_t ret = 0;
+		for(std::size_t ss = 0; ss < size(); ++ss) {
+			if(! nonzero || bvalues(ss) > float_t(0)) {
+				for(std::size_t ii = offsets(ss); ii < offsets(ss+1); ++ii) {
+					ret += smt::pow2(y(members(ii))-y_mean(ss));
+				}
+			}
+		}
+
+		return ret;
+	}
+
+	bool write(const std::string& filename) const {
+		std::ofstream fout(filename.c_str());
+		if(! fout.good()) {
+			smt::error("Unable to write ‘" + filename + "’.");
+			return false;
+		}
+		fout.precision(std::numeric_limits<float_t>::max_digits10);
+		for(std::size_t ss = 0; ss < size(); ++ss) {
+			fout << bvalues(ss) << " " << counts(ss) << std::endl;
+		}
+
+		return fout.good();
+	}
+
+private:
+	shells(std::tuple<smt::darray<float_t, 1>, smt::darray<std::size_t, 1>, smt::darray<std::size_t, 1>, smt::darray<std::size_t, 1>>&& rhs):
+		bvalues(std::move(std::get<0>(rhs))),
+		counts(std::move(std::get<1>(rhs))),
+		offsets(std::move(std::get<2>(rhs))),
+		members(std::move(std::get<3>(rhs))) {}
+
+	std::tuple<smt::darray<float_t, 1>, smt::darray<std::size_t, 1>, smt::darray<std::size_t, 1>, smt::darray<std::size_t, 1>> shells_cluster(
+			const smt::diffenc<float_t>& dw, const float_t& tol) const {
+		smt::darray<std::size_t, 1> members_(dw.mapping.size());
+		std::iota(std::begin(members_), std::end(members_), 0);
+		std::stable_sort(std::begin(members_), std::end(members_), [&](const std::size_t& ii, const std::size_t& jj) {
+			return dw.bvalues(dw.mapping(ii)) < dw.bvalues(dw.mapping(jj));
+		});
+
+		std::deque<std::size_t> buf_offsets;
+		for(std::size_t ii = 0; ii < members_.size(); ++ii) {
+			if(ii == 0) {
+				buf_offsets.push_back(ii);
+			} else {
+				const float_t bvalue_prev = dw.bvalues(dw.mapping(members_(ii-1)));
+				const float_t bvalue = dw.bvalues(dw.mapping(members_(ii)));
+				if(bvalue-bvalue_prev > tol || (bvalue_prev == float_t(0)) != (bvalue == float_t(0))) {
+					buf_offsets.push_back(ii);
+				}
+			}
+		}
+		buf_offsets.push_back(members_.size());
+
+		smt::darray<std::size_t, 1> offsets_(buf_offsets.size());
+		std::copy(std::begin(buf_offsets), std::end(buf_offsets), std::begin(offsets_));
+		smt::darray<float_t, 1> bvalues_(offsets_.size()-1);
+		smt::darray<std::size_t, 1> counts_(offsets_.size()-1);
+		for(std::size_t ss = 0; ss < bvalues_.size(); ++ss) {
+			// Mean relative to the first member, which is exact for identical
+			// b-values.
+			const float_t bvalue_first = dw.bvalues(dw.mapping(members_(offsets_(ss))));
+			float_t tmp = 0;
+			for(std::size_t ii = offsets_(ss); ii < offsets_(ss+1); ++ii) {
+				tmp += dw.bvalues(dw.mapping(members_(ii)))-bvalue_first;
+			}
+			counts_(ss) = offsets_(ss+1)-offsets_(ss);
+			bvalues_(ss) = bvalue_first+tmp/counts_(ss);
+		}
+
+		return std::make_tuple(std::move(bvalues_), std::move(counts_), std::move(offsets_), std::move(members_));
+	}
+
+	std::tuple<smt::darray<float_t, 1>, smt::darray<std::size_t, 1>, smt::darray<std::size_t, 1>, smt::darray<std::size_t, 1>> shells_table(
+			const std::string& filename) const {
+		std::ifstream fin(filename.c_str());
+		std::deque<std::tuple<float_t, std::size_t>> buf;
+		if(fin.good()) {
+			std::string str;
+			while(std::getline(fin, str)) {
+				std::istringstream sin(str);
+				float_t bvalue;
+				long long int count;
+				if(sin >> bvalue >> count) {
+					if(bvalue < float_t(0) || count < 1) {
+						smt::error("‘" + filename + "’ is malformed.");
+						std::exit(EXIT_FAILURE);
+					}
+					buf.push_back(std::make_tuple(bvalue, count));
+				}
+			}
+			fin.close();
+		} else {
+			smt::error("Unable to read ‘" + filename + "’.");
+			std::exit(EXIT_FAILURE);
+		}
+		if(buf.empty()) {
+			smt::error("‘" + filename + "’ is malformed.");
+			std::exit(EXIT_FAILURE);
+		}
+
+		smt::darray<float_t, 1> bvalues_(buf.size());
+		smt::darray<std::size_t, 1> counts_(buf.size());
+		smt::darray<std::size_t, 1> offsets_(buf.size()+1);
+		smt::darray<std::size_t, 1> members_(buf.size());
+		for(std::size_t ss = 0; ss < buf.size(); ++ss) {
+			std::tie(bvalues_(ss), counts_(ss)) = buf[ss];
+			offsets_(ss) = ss;
+			members_(ss) = ss;
+		}
+		offsets_(buf.size()) = buf.size();
+
+		return std::make_tuple(std::move(bvalues_), std::move(counts_), std::move(offsets_), std::move(members_));
+	}
+};
+
 } // smt
 
 #endif // _DIFFENC_H
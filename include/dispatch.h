@@ -0,0 +1,44 @@
+//
+// Copyright (c) 2018 Enrico Kaden & University College London
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// * Redistributions of source code must retain the above copyright notice, this
+//   list of conditions and the following disclaimer.
+//
+// * Redistributions in binary form must reproduce the above copyright notice,
+//   this list of conditions and the following disclaimer in the documentation
+//   and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#ifndef _DISPATCH_H
+#define _DISPATCH_H
+
+// Function multi-versioning of the numerical kernels. A function declared
+// with SMT_TARGET_CLONES is compiled for AVX-512, AVX2 and the baseline
+// instruction set, and the version matching the CPU is selected when the
+// program is loaded, such that a portable binary still uses the full SIMD
+// width on recent processors. The kernels called by such a function are
+// inlined into each of its versions. Multi-versioning requires GCC 6 or
+// later on x86-64 Linux, and is disabled by defining SMT_NO_TARGET_CLONES.
+
+#if defined(__x86_64__) && defined(__linux__) && defined(__GNUC__) && __GNUC__ >= 6 && ! defined(__clang__) && ! defined(__INTEL_COMPILER) && ! defined(SMT_NO_TARGET_CLONES)
+#define SMT_TARGET_CLONES __attribute__((target_clones("avx512f", "avx2", "default")))
+#else
+#define SMT_TARGET_CLONES
+#endif
+
+#endif // _DISPATCH_H
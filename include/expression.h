@@ -27,7 +27,11 @@
 #ifndef _EXPRESSION_H
 #define _EXPRESSION_H
 
+#include <algorithm>
 #include <cstddef>
+#include <limits>
+#include <type_traits>
+#include <utility>
 
 #include "operator.h"
 
@@ -38,8 +42,6 @@ namespace smt {
 // Generative Programming and Component Engineering, pp. 228–244, 2003.
 //
 
-// TODO: unsigned int => std::size_t
-
 template <typename I, typename E = void>
 struct expr_traits {
 	static const bool conforms = false;
@@ -52,10 +54,14 @@ public:
 
 	explicit expr(const ExprT& e): _e(e) {}
 
-	const value_type operator[](const unsigned int& ii) const {
+	const value_type operator[](const std::size_t& ii) const {
 		return _e[ii];
 	}
 
+	std::size_t size() const {
+		return _e.size();
+	}
+
 private:
 	ExprT _e;
 };
@@ -72,29 +78,59 @@ public:
 
 	explicit scalar(const T& s): _s(s) {}
 
-	const value_type operator[](const unsigned int& ii) const {
+	const value_type operator[](const std::size_t& ii) const {
 		return _s;
 	}
 
+	std::size_t size() const {
+		return std::numeric_limits<std::size_t>::max();
+	}
+
 private:
 	T _s;
 };
 
-template <typename ContainerT>
+template <typename ContainerT, typename E = void>
 class constref {
 public:
 	typedef typename ContainerT::value_type value_type;
 
 	explicit constref(const ContainerT& c): _c(c) {}
 
-	const value_type operator[](const unsigned int& ii) const {
+	const value_type operator[](const std::size_t& ii) const {
 		return _c[ii];
 	}
 
+	std::size_t size() const {
+		return _c.size();
+	}
+
 private:
 	const ContainerT& _c;
 };
 
+// Containers with contiguous storage are read through a plain pointer. The
+// bounds are checked once against size() by the assigning container.
+template <typename ContainerT>
+class constref<ContainerT, typename std::enable_if<std::is_pointer<decltype(std::declval<const ContainerT&>().begin())>::value>::type> {
+public:
+	typedef typename ContainerT::value_type value_type;
+
+	explicit constref(const ContainerT& c): _data(c.begin()), _size(c.size()) {}
+
+	const value_type operator[](const std::size_t& ii) const {
+		return _data[ii];
+	}
+
+	std::size_t size() const {
+		return _size;
+	}
+
+private:
+	const value_type* const _data;
+	const std::size_t _size;
+};
+
 template <typename A, typename Op>
 class expr_unary_op {
 public:
@@ -102,10 +138,14 @@ public:
 
 	explicit expr_unary_op(const A& a): _a(a) {}
 
-	const value_type operator[](const unsigned int& ii) const {
+	const value_type operator[](const std::size_t& ii) const {
 		return Op::apply(_a[ii]);
 	}
 
+	std::size_t size() const {
+		return _a.size();
+	}
+
 private:
 	A _a;
 };
@@ -121,10 +161,14 @@ public:
 
 	explicit expr_binary_op(const A& a, const B& b): _a(a), _b(b) {}
 
-	const value_type operator[](const unsigned int& ii) const {
+	const value_type operator[](const std::size_t& ii) const {
 		return Op::apply(_a[ii], _b[ii]);
 	}
 
+	std::size_t size() const {
+		return std::min(_a.size(), _b.size());
+	}
+
 private:
 	A _a;
 	B _b;
@@ -143,10 +187,14 @@ public:
 	explicit expr_trinary_op(const A& a, const B& b, const C& c):
 			_a(a), _b(b), _c(c) {}
 
-	const value_type operator[](const unsigned int& ii) const {
+	const value_type operator[](const std::size_t& ii) const {
 		return Op::apply(_a[ii], _b[ii], _c[ii]);
 	}
 
+	std::size_t size() const {
+		return std::min(std::min(_a.size(), _b.size()), _c.size());
+	}
+
 private:
 	A _a;
 	B _b;
@@ -27,17 +27,20 @@
 #ifndef _FITMCMICRO_H
 #define _FITMCMICRO_H
 
+#include <algorithm>
 #include <limits>
 
 #include "darray.h"
 #include "debug.h"
 #include "diffenc.h"
+#include "dispatch.h"
 #include "logit.h"
 #include "meansignal.h"
 #include "neldermead.h"
 #include "pow.h"
 #include "project.h"
 #include "sarray.h"
+#include "svector.h"
 
 namespace smt {
 
@@ -52,24 +55,86 @@ namespace smt {
 template <typename float_t>
 class McMicroFunction {
 public:
-	McMicroFunction(const smt::darray<float_t, 1>& y,
+	McMicroFunction(const smt::darray_view<const float_t, 1>& y,
 			const smt::diffenc<float_t>& dw,
+			const float_t& diffmax = 3.05e-3):
+				McMicroFunction(y, dw.bvalues, dw.mapping, diffmax) {
+	}
+
+	McMicroFunction(const smt::darray_view<const float_t, 1>& y,
+			const smt::darray_view<const float_t, 1>& bvalues,
+			const smt::darray_view<const std::size_t, 1>& mapping,
 			const float_t& diffmax = 3.05e-3):
 				_y(y),
-				_dw(dw),
+				_bvalues(bvalues),
+				_mapping(mapping),
+				_shells(nullptr),
+				_scales(),
+				_yshell(),
+				_sumsq(0),
 				_intramax(1),
 				_diffmax(diffmax),
-				_y0(mean(y, dw)) {
+				_y0(mean()) {
+	}
+
+	McMicroFunction(const smt::darray_view<const float_t, 1>& y,
+			const smt::shells<float_t>& shells,
+			const float_t& diffmax = 3.05e-3):
+				_y(y),
+				_bvalues(),
+				_mapping(),
+				_shells(&shells),
+				_scales(),
+				_yshell(shells.mean(y)),
+				_sumsq(shells.sumsq(y, _yshell, true)),
+				_intramax(1),
+				_diffmax(diffmax),
+				_y0(mean()) {
+	}
+
+	McMicroFunction(const smt::darray_view<const float_t, 1>& y,
+			const smt::shells<float_t>& shells,
+			const smt::darray_view<const float_t, 1>& scales,
+			const float_t& diffmax = 3.05e-3):
+				_y(y),
+				_bvalues(),
+				_mapping(),
+				_shells(&shells),
+				_scales(scales),
+				_yshell(shells.mean(y)),
+				_sumsq(0),
+				_intramax(1),
+				_diffmax(diffmax),
+				_y0(mean()) {
 	}
 
 	float_t operator()(const smt::sarray<float_t, 2>& x) const {
 		const float_t intra = smt::expit(x(0), _intramax);
 		const float_t diff = smt::expit(x(1), _diffmax);
 		float_t fval = 0;
-		for(std::size_t ii = 0; ii < _dw.mapping.size(); ++ii) {
-			const float_t bvalue = _dw.bvalues(_dw.mapping(ii));
-			if(bvalue > float_t(0)) {
-				fval += smt::pow2(_y(ii)-_y0*(intra*smt::meansignal(bvalue, diff, float_t(0))+(float_t(1)-intra)*smt::meansignal(bvalue, diff, tortuosity(intra)*diff)));
+		if(_shells && _scales.size() > 0) {
+			for(std::size_t ss = 0; ss < _shells->size(); ++ss) {
+				const float_t bvalue = _shells->bvalues(ss);
+				if(bvalue > float_t(0)) {
+					for(std::size_t ii = _shells->offsets(ss); ii < _shells->offsets(ss+1); ++ii) {
+						fval += smt::pow2(_y(_shells->members(ii))-_y0*(intra*smt::meansignal(bvalue*_scales(_shells->members(ii)), diff, float_t(0))+(float_t(1)-intra)*smt::meansignal(bvalue*_scales(_shells->members(ii)), diff, tortuosity(intra)*diff)));
+					}
+				}
+			}
+		} else if(_shells) {
+			fval = _sumsq;
+			for(std::size_t ss = 0; ss < _shells->size(); ++ss) {
+				const float_t bvalue = _shells->bvalues(ss);
+				if(bvalue > float_t(0)) {
+					fval += _shells->counts(ss)*smt::pow2(_yshell(ss)-_y0*(intra*smt::meansignal(bvalue, diff, float_t(0))+(float_t(1)-intra)*smt::meansignal(bvalue, diff, tortuosity(intra)*diff)));
+				}
+			}
+		} else {
+			for(std::size_t ii = 0; ii < _mapping.size(); ++ii) {
+				const float_t bvalue = _bvalues(_mapping(ii));
+				if(bvalue > float_t(0)) {
+					fval += smt::pow2(_y(ii)-_y0*(intra*smt::meansignal(bvalue, diff, float_t(0))+(float_t(1)-intra)*smt::meansignal(bvalue, diff, tortuosity(intra)*diff)));
+				}
 			}
 		}
 
@@ -92,6 +157,18 @@ public:
 		return x0;
 	}
 
+	// Initial values from the estimates x of a related fit, e.g. at a coarser
+	// resolution, which are kept off the bounds, where the objective function
+	// is flat in the transformed parameters.
+	smt::sarray<float_t, 2> warmstart(const smt::sarray<float_t, 3>& x) const {
+		const float_t margin = 0.01;
+		smt::sarray<float_t, 2> x0;
+		x0(0) = smt::logit(smt::project(x(0), margin*_intramax, (float_t(1)-margin)*_intramax), _intramax);
+		x0(1) = smt::logit(smt::project(x(1), margin*_diffmax, (float_t(1)-margin)*_diffmax), _diffmax);
+
+		return x0;
+	}
+
 	smt::sarray<float_t, 2> trans(const smt::sarray<float_t, 2>& x) const {
 		smt::sarray<float_t, 2> y;
 		y(0) = smt::expit(x(0), _intramax);
@@ -113,8 +190,13 @@ public:
 	}
 
 private:
-	const smt::darray<float_t, 1> _y;
-	const smt::diffenc<float_t> _dw;
+	const smt::darray_view<const float_t, 1> _y;
+	const smt::darray_view<const float_t, 1> _bvalues;
+	const smt::darray_view<const std::size_t, 1> _mapping;
+	const smt::shells<float_t>* const _shells;
+	const smt::darray_view<const float_t, 1> _scales;
+	const smt::svector<float_t> _yshell;
+	const float_t _sumsq;
 	const float_t _intramax;
 	const float_t _diffmax;
 	const float_t _y0;
@@ -123,13 +205,22 @@ private:
 		return float_t(1)-smt::project(intra, float_t(0), _intramax);
 	}
 
-	float_t mean(const smt::darray<float_t, 1>& y, const smt::diffenc<float_t>& dw) const {
+	float_t mean() const {
 		float_t y0 = 0;
 		std::size_t n = 0;
-		for(std::size_t ii = 0; ii < dw.mapping.size(); ++ii) {
-			if(dw.bvalues(dw.mapping(ii)) == float_t(0)) {
-				y0 += y(ii);
-				++n;
+		if(_shells) {
+			for(std::size_t ss = 0; ss < _shells->size(); ++ss) {
+				if(_shells->bvalues(ss) == float_t(0)) {
+					y0 += _shells->counts(ss)*_yshell(ss);
+					n += _shells->counts(ss);
+				}
+			}
+		} else {
+			for(std::size_t ii = 0; ii < _mapping.size(); ++ii) {
+				if(_bvalues(_mapping(ii)) == float_t(0)) {
+					y0 += _y(ii);
+					++n;
+				}
 			}
 		}
 		smt::assert(n > 0);
@@ -142,11 +233,52 @@ private:
 template <typename float_t>
 class McMicro0Function {
 public:
-	McMicro0Function(const smt::darray<float_t, 1>& y,
+	McMicro0Function(const smt::darray_view<const float_t, 1>& y,
 			const smt::diffenc<float_t>& dw,
+			const float_t& diffmax = 3.05e-3):
+				McMicro0Function(y, dw.bvalues, dw.mapping, diffmax) {
+	}
+
+	McMicro0Function(const smt::darray_view<const float_t, 1>& y,
+			const smt::darray_view<const float_t, 1>& bvalues,
+			const smt::darray_view<const std::size_t, 1>& mapping,
+			const float_t& diffmax = 3.05e-3):
+				_y(y),
+				_bvalues(bvalues),
+				_mapping(mapping),
+				_shells(nullptr),
+				_scales(),
+				_yshell(),
+				_sumsq(0),
+				_intramax(1),
+				_diffmax(diffmax) {
+	}
+
+	McMicro0Function(const smt::darray_view<const float_t, 1>& y,
+			const smt::shells<float_t>& shells,
+			const float_t& diffmax = 3.05e-3):
+				_y(y),
+				_bvalues(),
+				_mapping(),
+				_shells(&shells),
+				_scales(),
+				_yshell(shells.mean(y)),
+				_sumsq(shells.sumsq(y, _yshell, false)),
+				_intramax(1),
+				_diffmax(diffmax) {
+	}
+
+	McMicro0Function(const smt::darray_view<const float_t, 1>& y,
+			const smt::shells<float_t>& shells,
+			const smt::darray_view<const float_t, 1>& scales,
 			const float_t& diffmax = 3.05e-3):
 				_y(y),
-				_dw(dw),
+				_bvalues(),
+				_mapping(),
+				_shells(&shells),
+				_scales(scales),
+				_yshell(shells.mean(y)),
+				_sumsq(0),
 				_intramax(1),
 				_diffmax(diffmax) {
 	}
@@ -156,9 +288,24 @@ public:
 		const float_t diff = smt::expit(x(1), _diffmax);
 		const float_t e0 = std::exp(x(2));
 		float_t fval = 0;
-		for(std::size_t ii = 0; ii < _dw.mapping.size(); ++ii) {
-			const float_t bvalue = _dw.bvalues(_dw.mapping(ii));
-			fval += smt::pow2(_y(ii)-e0*(intra*smt::meansignal(bvalue, diff, float_t(0))+(float_t(1)-intra)*smt::meansignal(bvalue, diff, tortuosity(intra)*diff)));
+		if(_shells && _scales.size() > 0) {
+			for(std::size_t ss = 0; ss < _shells->size(); ++ss) {
+				const float_t bvalue = _shells->bvalues(ss);
+				for(std::size_t ii = _shells->offsets(ss); ii < _shells->offsets(ss+1); ++ii) {
+					fval += smt::pow2(_y(_shells->members(ii))-e0*(intra*smt::meansignal(bvalue*_scales(_shells->members(ii)), diff, float_t(0))+(float_t(1)-intra)*smt::meansignal(bvalue*_scales(_shells->members(ii)), diff, tortuosity(intra)*diff)));
+				}
+			}
+		} else if(_shells) {
+			fval = _sumsq;
+			for(std::size_t ss = 0; ss < _shells->size(); ++ss) {
+				const float_t bvalue = _shells->bvalues(ss);
+				fval += _shells->counts(ss)*smt::pow2(_yshell(ss)-e0*(intra*smt::meansignal(bvalue, diff, float_t(0))+(float_t(1)-intra)*smt::meansignal(bvalue, diff, tortuosity(intra)*diff)));
+			}
+		} else {
+			for(std::size_t ii = 0; ii < _mapping.size(); ++ii) {
+				const float_t bvalue = _bvalues(_mapping(ii));
+				fval += smt::pow2(_y(ii)-e0*(intra*smt::meansignal(bvalue, diff, float_t(0))+(float_t(1)-intra)*smt::meansignal(bvalue, diff, tortuosity(intra)*diff)));
+			}
 		}
 
 		return fval;
@@ -182,6 +329,19 @@ public:
 		return x0;
 	}
 
+	// Initial values from the estimates x of a related fit, e.g. at a coarser
+	// resolution, which are kept off the bounds, where the objective function
+	// is flat in the transformed parameters.
+	smt::sarray<float_t, 3> warmstart(const smt::sarray<float_t, 3>& x) const {
+		const float_t margin = 0.01;
+		smt::sarray<float_t, 3> x0;
+		x0(0) = smt::logit(smt::project(x(0), margin*_intramax, (float_t(1)-margin)*_intramax), _intramax);
+		x0(1) = smt::logit(smt::project(x(1), margin*_diffmax, (float_t(1)-margin)*_diffmax), _diffmax);
+		x0(2) = (x(2) > float_t(0))? std::log(x(2)) : std::log(maxsignal());
+
+		return x0;
+	}
+
 	smt::sarray<float_t, 3> trans(const smt::sarray<float_t, 3>& x) const {
 		smt::sarray<float_t, 3> y;
 		y(0) = smt::expit(x(0), _intramax);
@@ -195,8 +355,13 @@ public:
 	}
 
 private:
-	const smt::darray<float_t, 1> _y;
-	const smt::diffenc<float_t> _dw;
+	const smt::darray_view<const float_t, 1> _y;
+	const smt::darray_view<const float_t, 1> _bvalues;
+	const smt::darray_view<const std::size_t, 1> _mapping;
+	const smt::shells<float_t>* const _shells;
+	const smt::darray_view<const float_t, 1> _scales;
+	const smt::svector<float_t> _yshell;
+	const float_t _sumsq;
 	const float_t _intramax;
 	const float_t _diffmax;
 
@@ -214,28 +379,32 @@ private:
 	}
 };
 
-template <typename float_t>
-smt::sarray<float_t, 3> fitmcmicro(const smt::darray<float_t, 1>& y,
-		const smt::diffenc<float_t>& dw,
-		const float_t& diffmax = 3.05e-3,
-		const bool& b0 = false,
-		const float_t& opt_rel = 1000*std::numeric_limits<float_t>::epsilon(),
-		const float_t& opt_abs = 10*std::numeric_limits<float_t>::epsilon()) {
+// Fit with the b0 signal taken from the zero b-value measurements or, if b0
+// is set, estimated by the model, constructing the objective function from
+// args. The solver starts from the estimates x0 if given, and from the default
+// initial values otherwise. The objective function and the solver are compiled
+// for several instruction sets.
+template <typename float_t, typename... Args>
+SMT_TARGET_CLONES smt::sarray<float_t, 3> fitmcmicro_solve(const bool& b0,
+		const float_t& opt_rel,
+		const float_t& opt_abs,
+		const smt::sarray<float_t, 3>* const x0,
+		const Args&... args) {
 
 	// TODO: Random initialisation?
 
-	if(! b0 && dw.any_zero_bvalue()) {
-		McMicroFunction<float_t> f(y, dw, diffmax);
+	if(! b0) {
+		McMicroFunction<float_t> f(args...);
 		smt::sNelderMead<float_t, 2, McMicroFunction<float_t>> ssolver(f);
-		ssolver.init(f.init());
+		ssolver.init(x0? f.warmstart(*x0) : f.init());
 		ssolver.solve(opt_rel, opt_abs);
 		const smt::sarray<float_t, 3> x = f.trans0(ssolver());
 
 		return x;
 	} else {
-		McMicro0Function<float_t> f(y, dw, diffmax);
+		McMicro0Function<float_t> f(args...);
 		smt::sNelderMead<float_t, 3, McMicro0Function<float_t>> ssolver(f);
-		ssolver.init(f.init());
+		ssolver.init(x0? f.warmstart(*x0) : f.init());
 		ssolver.solve(opt_rel, opt_abs);
 		const smt::sarray<float_t, 3> x = f.trans(ssolver());
 
@@ -243,6 +412,77 @@ smt::sarray<float_t, 3> fitmcmicro(const smt::darray<float_t, 1>& y,
 	}
 }
 
+template <typename float_t>
+smt::sarray<float_t, 3> fitmcmicro(const smt::darray_view<const float_t, 1>& y,
+		const smt::darray_view<const float_t, 1>& bvalues,
+		const smt::darray_view<const std::size_t, 1>& mapping,
+		const float_t& diffmax = 3.05e-3,
+		const bool& b0 = false,
+		const float_t& opt_rel = 1000*std::numeric_limits<float_t>::epsilon(),
+		const float_t& opt_abs = 10*std::numeric_limits<float_t>::epsilon()) {
+	const bool any_zero_bvalue = std::any_of(std::begin(mapping), std::end(mapping), [&](const std::size_t& idx) {
+		return bvalues(idx) == float_t(0);
+	});
+
+	return fitmcmicro_solve<float_t>(b0 || ! any_zero_bvalue, opt_rel, opt_abs, nullptr, y, bvalues, mapping, diffmax);
+}
+
+template <typename float_t>
+smt::sarray<float_t, 3> fitmcmicro(const smt::darray_view<const float_t, 1>& y,
+		const smt::shells<float_t>& shells,
+		const float_t& diffmax = 3.05e-3,
+		const bool& b0 = false,
+		const float_t& opt_rel = 1000*std::numeric_limits<float_t>::epsilon(),
+		const float_t& opt_abs = 10*std::numeric_limits<float_t>::epsilon()) {
+	return fitmcmicro_solve<float_t>(b0 || ! shells.any_zero_bvalue(), opt_rel, opt_abs, nullptr, y, shells, diffmax);
+}
+
+template <typename float_t>
+smt::sarray<float_t, 3> fitmcmicro(const smt::darray_view<const float_t, 1>& y,
+		const smt::shells<float_t>& shells,
+		const smt::darray_view<const float_t, 1>& scales,
+		const float_t& diffmax = 3.05e-3,
+		const bool& b0 = false,
+		const float_t& opt_rel = 1000*std::numeric_limits<float_t>::epsilon(),
+		const float_t& opt_abs = 10*std::numeric_limits<float_t>::epsilon()) {
+	return fitmcmicro_solve<float_t>(b0 || ! shells.any_zero_bvalue(), opt_rel, opt_abs, nullptr, y, shells, scales, diffmax);
+}
+
+template <typename float_t>
+smt::sarray<float_t, 3> fitmcmicro(const smt::darray<float_t, 1>& y,
+		const smt::diffenc<float_t>& dw,
+		const float_t& diffmax = 3.05e-3,
+		const bool& b0 = false,
+		const float_t& opt_rel = 1000*std::numeric_limits<float_t>::epsilon(),
+		const float_t& opt_abs = 10*std::numeric_limits<float_t>::epsilon()) {
+	return fitmcmicro<float_t>(y, dw.bvalues, dw.mapping, diffmax, b0, opt_rel, opt_abs);
+}
+
+// Fit with the solver started from the estimates x0 instead of the default
+// initial values, e.g. from a fit at a coarser resolution.
+template <typename float_t>
+smt::sarray<float_t, 3> fitmcmicro(const smt::sarray<float_t, 3>& x0,
+		const smt::darray_view<const float_t, 1>& y,
+		const smt::shells<float_t>& shells,
+		const float_t& diffmax = 3.05e-3,
+		const bool& b0 = false,
+		const float_t& opt_rel = 1000*std::numeric_limits<float_t>::epsilon(),
+		const float_t& opt_abs = 10*std::numeric_limits<float_t>::epsilon()) {
+	return fitmcmicro_solve<float_t>(b0 || ! shells.any_zero_bvalue(), opt_rel, opt_abs, &x0, y, shells, diffmax);
+}
+
+template <typename float_t>
+smt::sarray<float_t, 3> fitmcmicro(const smt::sarray<float_t, 3>& x0,
+		const smt::darray_view<const float_t, 1>& y,
+		const smt::shells<float_t>& shells,
+		const smt::darray_view<const float_t, 1>& scales,
+		const float_t& diffmax = 3.05e-3,
+		const bool& b0 = false,
+		const float_t& opt_rel = 1000*std::numeric_limits<float_t>::epsilon(),
+		const float_t& opt_abs = 10*std::numeric_limits<float_t>::epsilon()) {
+	return fitmcmicro_solve<float_t>(b0 || ! shells.any_zero_bvalue(), opt_rel, opt_abs, &x0, y, shells, scales, diffmax);
+}
+
 } // smt
 
 #endif // _FITMCMICRO_H
@@ -37,7 +37,7 @@
 namespace smt {
 
 template <typename float_t>
-smt::sarray<float_t, 2> gaussianfit(const smt::darray<float_t, 1>& y) {
+smt::sarray<float_t, 2> gaussianfit(const smt::darray_view<const float_t, 1>& y) {
 
 	// TODO: Unbiased estimation of standard deviation?
 
@@ -61,6 +61,11 @@ smt::sarray<float_t, 2> gaussianfit(const smt::darray<float_t, 1>& y) {
 	return {y_mean, y_std};
 }
 
+template <typename float_t>
+smt::sarray<float_t, 2> gaussianfit(const smt::darray<float_t, 1>& y) {
+	return gaussianfit<float_t>(smt::darray_view<const float_t, 1>(y));
+}
+
 } // smt
 
 #endif // _GAUSSIANFIT_H
@@ -0,0 +1,81 @@
+//
+// Copyright (c) 2018 Enrico Kaden & University College London
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// * Redistributions of source code must retain the above copyright notice, this
+//   list of conditions and the following disclaimer.
+//
+// * Redistributions in binary form must reproduce the above copyright notice,
+//   this list of conditions and the following disclaimer in the documentation
+//   and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#ifndef _HASH_H
+#define _HASH_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+namespace smt {
+
+// 64-bit non-cryptographic hash of n bytes (MurmurHash64A by Austin Appleby,
+// public domain), reading the data eight bytes at a time. Hashes are chained
+// by passing the previous hash as the seed.
+inline std::uint64_t hash64(const void* data, const std::size_t& n, const std::uint64_t& seed = 0) {
+	const std::uint64_t m = 0xc6a4a7935bd1e995ULL;
+	const int r = 47;
+
+	std::uint64_t h = seed^(n*m);
+
+	const unsigned char* p = static_cast<const unsigned char*>(data);
+	const unsigned char* const end = p+(n/8)*8;
+	for(; p != end; p += 8) {
+		std::uint64_t k;
+		std::memcpy(&k, p, 8);
+
+		k *= m;
+		k ^= k >> r;
+		k *= m;
+
+		h ^= k;
+		h *= m;
+	}
+
+	std::uint64_t k = 0;
+	switch(n & 7) {
+		case 7: k ^= std::uint64_t(p[6]) << 48; // fall through
+		case 6: k ^= std::uint64_t(p[5]) << 40; // fall through
+		case 5: k ^= std::uint64_t(p[4]) << 32; // fall through
+		case 4: k ^= std::uint64_t(p[3]) << 24; // fall through
+		case 3: k ^= std::uint64_t(p[2]) << 16; // fall through
+		case 2: k ^= std::uint64_t(p[1]) << 8; // fall through
+		case 1: k ^= std::uint64_t(p[0]);
+			h ^= k;
+			h *= m;
+	}
+
+	h ^= h >> r;
+	h *= m;
+	h ^= h >> r;
+
+	return h;
+}
+
+} // smt
+
+#endif // _HASH_H
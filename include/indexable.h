@@ -41,8 +41,6 @@ namespace smt {
 // Generative Programming and Component Engineering, pp. 228–244, 2003.
 //
 
-// TODO: unsigned int => std::size_t
-
 template <typename I, typename E = void>
 struct indexable_traits {
 	static const bool conforms = false;
@@ -52,15 +50,15 @@ template <typename I>
 struct indexable {
 	static_assert(indexable_traits<I>::conforms, "indexable_traits<I>::conforms");
 
-	static typename I::value_type index(const I& idx, const unsigned int& ii) {
+	static typename I::value_type index(const I& idx, const std::size_t& ii) {
 		return indexable_traits<I>::index(idx, ii);
 	}
 
-	static typename I::value_type& index(I& idx, const unsigned int& ii) {
+	static typename I::value_type& index(I& idx, const std::size_t& ii) {
 		return indexable_traits<I>::index(idx, ii);
 	}
 
-	static unsigned int size(const I& idx) {
+	static std::size_t size(const I& idx) {
 		return indexable_traits<I>::size(idx);
 	}
 };
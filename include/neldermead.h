@@ -224,8 +224,18 @@ private:
 	}
 
 	void sort() {
-		std::stable_sort(_idx.begin(), _idx.end(),
-				[&](const std::size_t& ii, const std::size_t& jj) { return _fval(ii) <= _fval(jj); });
+		// Insertion sort, which does not request a temporary buffer unlike
+		// std::stable_sort, but orders the N+1 vertices in the same way.
+		for(std::size_t ii = 1; ii < N+1; ++ii) {
+			const float_t fval_tmp = _fval(_idx(ii));
+			const std::size_t idx_tmp = _idx(ii);
+			std::size_t jj = ii;
+			while(jj > 0 && fval_tmp <= _fval(_idx(jj-1))) {
+				_idx(jj) = _idx(jj-1);
+				--jj;
+			}
+			_idx(jj) = idx_tmp;
+		}
 	}
 
 	void sortN() {
@@ -50,6 +50,7 @@
 
 #include "darray.h"
 #include "debug.h"
+#include "profile.h"
 #include "sarray.h"
 
 namespace smt {
@@ -577,6 +578,37 @@ bool approximately_equal(const long double& a, const long double& b) {
 
 } // (anonymous)
 
+// Number of dimensions of an image, which is read from its header, such that
+// a tool can choose the dimension D of inifti.
+int ndims(const std::string& filename) {
+	const std::string hdrname = std::get<2>(smt::niftiname(filename));
+	nifti_1_header header;
+
+#ifdef ZLIB_FOUND
+	gzFile zin;
+	if((zin = gzopen(hdrname.c_str(), "rb")) == nullptr) {
+		smt::error("Unable to open ‘" + hdrname + "’.");
+		std::exit(EXIT_FAILURE);
+	}
+	const bool success = smt::gzfread(&header, sizeof(nifti_1_header), 1, zin) == 1;
+	gzclose(zin);
+#else
+	std::FILE* fin;
+	if((fin = std::fopen(hdrname.c_str(), "rb")) == nullptr) {
+		smt::error("Unable to open ‘" + hdrname + "’.");
+		std::exit(EXIT_FAILURE);
+	}
+	const bool success = std::fread(&header, sizeof(nifti_1_header), 1, fin) == 1;
+	std::fclose(fin);
+#endif // ZLIB_FOUND
+	if(! success) {
+		smt::error("Unable to read ‘" + hdrname + "’.");
+		std::exit(EXIT_FAILURE);
+	}
+
+	return header.dim[0];
+}
+
 template <typename T, unsigned int D>
 class inifti {
 	template <typename Tlike, unsigned int Dlike>
@@ -653,12 +685,18 @@ public:
 	smt::darray<T, 1> operator()(const std::size_t& i0, const std::size_t& i1, const std::size_t& i2, const smt::slice& slice) const {
 		static_assert(D == 4, "D == 4");
 		smt::darray<T, 1> ret(slice.size());
+		gather(i0, i1, i2, slice, ret);
+		return ret;
+	}
+
+	void gather(const std::size_t& i0, const std::size_t& i1, const std::size_t& i2, const smt::slice& slice, const smt::darray_view<T, 1>& out) const {
+		static_assert(D == 4, "D == 4");
+		smt::assert(out.size() == slice.size());
 		std::size_t i3 = slice.start();
-		for(std::size_t ii = 0; ii < ret.size(); ++ii) {
-			ret(ii) = operator()(i0, i1, i2, i3);
+		for(std::size_t ii = 0; ii < out.size(); ++ii) {
+			out(ii) = operator()(i0, i1, i2, i3);
 			i3 += slice.stride();
 		}
-		return ret;
 	}
 
 	std::size_t size() const {
@@ -751,6 +789,8 @@ private:
 			_separate_storage(std::get<1>(niftiname)),
 			_hdrname(std::get<2>(niftiname)),
 			_imgname(std::get<3>(niftiname)) {
+		smt::profile_stage stage_header("read header", _hdrname);
+
 #ifdef ZLIB_FOUND
 		if((_fd = (_hdrname == "-")? smt::fileno(stdin) : smt::fileno(std::fopen(_hdrname.c_str(), "rb"))) < 0 || (_zin = gzdopen(_fd, "rb")) == nullptr) {
 			smt::error("Unable to open ‘" + _hdrname + "’.");
@@ -798,6 +838,10 @@ private:
 			std::exit(EXIT_FAILURE);
 		}
 
+		stage_header.stop();
+		const smt::profile_stage stage_data("read data", _imgname);
+		smt::profiler().add_read(sizeof(nifti_1_header)+bytesize()*size());
+
 		if(_gzipped) {
 			if(_separate_storage) {
 #ifdef ZLIB_FOUND
@@ -1072,24 +1116,43 @@ public:
 	template <typename Tlike, unsigned int Dlike>
 	onifti(const std::string& filename,
 			const inifti<Tlike, Dlike>& like,
-			const unsigned int& s0,
-			const unsigned int& s1,
-			const unsigned int& s2):
-			onifti(smt::niftiname(filename), like, s0, s1, s2) {
+			const std::size_t& s0,
+			const std::size_t& s1,
+			const std::size_t& s2):
+			onifti(smt::niftiname(filename), like._header, s0, s1, s2) {
 	}
 
 	template <typename Tlike, unsigned int Dlike>
 	onifti(const std::string& filename,
 			const inifti<Tlike, Dlike>& like,
-			const unsigned int& s0,
-			const unsigned int& s1,
-			const unsigned int& s2,
-			const unsigned int& s3):
-			onifti(smt::niftiname(filename), like, s0, s1, s2, s3) {
+			const std::size_t& s0,
+			const std::size_t& s1,
+			const std::size_t& s2,
+			const std::size_t& s3):
+			onifti(smt::niftiname(filename), like._header, s0, s1, s2, s3) {
+	}
+
+	// Image volume in scanner coordinates with the given voxel size (mm),
+	// for data not derived from an input volume.
+	onifti(const std::string& filename,
+			const smt::sarray<float, 3>& pixsize,
+			const std::size_t& s0,
+			const std::size_t& s1,
+			const std::size_t& s2):
+			onifti(smt::niftiname(filename), scanner_header(pixsize, s0, s1, s2), s0, s1, s2) {
+	}
+
+	onifti(const std::string& filename,
+			const smt::sarray<float, 3>& pixsize,
+			const std::size_t& s0,
+			const std::size_t& s1,
+			const std::size_t& s2,
+			const std::size_t& s3):
+			onifti(smt::niftiname(filename), scanner_header(pixsize, s0, s1, s2), s0, s1, s2, s3) {
 	}
 
 	explicit operator bool() const {
-		return _data != nullptr;
+		return static_cast<bool>(_data);
 	}
 
 	T& operator[](const std::size_t& ii) {
@@ -1127,8 +1190,17 @@ public:
 		_header.cal_max = max;
 	}
 
+	// Description in the header, truncated to 79 characters.
+	void descrip(const std::string& s) {
+		std::fill(std::begin(_header.descrip), std::end(_header.descrip), '\0');
+		std::strncpy(_header.descrip, s.c_str(), sizeof(_header.descrip)-1);
+	}
+
 	~onifti() {
 		if(_data) {
+			const smt::profile_stage stage("write", _hdrname);
+			smt::profiler().add_written(sizeof(_header)+sizeof(_extender)+bytesize()*size());
+
 			if(_gzipped) {
 				if(_separate_storage) {
 #ifdef ZLIB_FOUND
@@ -1280,19 +1352,18 @@ private:
 	smt::darray<T, D> _data;
 	bool _mmapped;
 
-	template <typename Tlike, unsigned int Dlike>
 	onifti(const std::tuple<bool, bool, std::string, std::string>& niftiname,
-			const inifti<Tlike, Dlike>& like,
-			const unsigned int& s0,
-			const unsigned int& s1,
-			const unsigned int& s2):
+			const nifti_1_header& like,
+			const std::size_t& s0,
+			const std::size_t& s1,
+			const std::size_t& s2):
 			_gzipped(std::get<0>(niftiname)),
 			_separate_storage(std::get<1>(niftiname)),
 			_hdrname(std::get<2>(niftiname)),
 			_imgname(std::get<3>(niftiname)) {
 		static_assert(D == 3, "D == 3");
 
-		_header = default_header(like._header);
+		_header = default_header(like);
 		if(s0 > std::numeric_limits<signed short>::max() || s1 > std::numeric_limits<signed short>::max() || s2 > std::numeric_limits<signed short>::max()) {
 			smt::error("Data size not supported by NIfTI-1 format.");
 			std::exit(EXIT_FAILURE);
@@ -1341,20 +1412,19 @@ private:
 		}
 	}
 
-	template <typename Tlike, unsigned int Dlike>
 	onifti(const std::tuple<bool, bool, std::string, std::string>& niftiname,
-			const inifti<Tlike, Dlike>& like,
-			const unsigned int& s0,
-			const unsigned int& s1,
-			const unsigned int& s2,
-			const unsigned int& s3):
+			const nifti_1_header& like,
+			const std::size_t& s0,
+			const std::size_t& s1,
+			const std::size_t& s2,
+			const std::size_t& s3):
 			_gzipped(std::get<0>(niftiname)),
 			_separate_storage(std::get<1>(niftiname)),
 			_hdrname(std::get<2>(niftiname)),
 			_imgname(std::get<3>(niftiname)) {
 		static_assert(D == 4, "D == 4");
 
-		_header = default_header(like._header);
+		_header = default_header(like);
 		if(s0 > std::numeric_limits<signed short>::max() || s1 > std::numeric_limits<signed short>::max() || s2 > std::numeric_limits<signed short>::max() || s3 > std::numeric_limits<signed short>::max()) {
 			smt::error("Data size not supported by NIfTI-1 format.");
 			std::exit(EXIT_FAILURE);
@@ -1408,6 +1478,29 @@ private:
 		return nifti_bytesize(_header.datatype);
 	}
 
+	// Header whose spatial coordinates place the centre of the volume at the
+	// origin, without rotation.
+	static nifti_1_header scanner_header(const smt::sarray<float, 3>& pixsize,
+			const std::size_t& s0, const std::size_t& s1, const std::size_t& s2) {
+		nifti_1_header header;
+		std::memset(&header, 0, sizeof(header));
+		header.pixdim[0] = 1.0f;
+		header.pixdim[1] = pixsize(0);
+		header.pixdim[2] = pixsize(1);
+		header.pixdim[3] = pixsize(2);
+		header.xyzt_units = SPACE_TIME_TO_XYZT(NIFTI_UNITS_MM, NIFTI_UNITS_UNKNOWN);
+		header.qform_code = NIFTI_XFORM_SCANNER_ANAT;
+		header.quatern_b = 0.0f;
+		header.quatern_c = 0.0f;
+		header.quatern_d = 0.0f;
+		header.qoffset_x = -0.5f*pixsize(0)*(s0-1.0f);
+		header.qoffset_y = -0.5f*pixsize(1)*(s1-1.0f);
+		header.qoffset_z = -0.5f*pixsize(2)*(s2-1.0f);
+		header.sform_code = NIFTI_XFORM_UNKNOWN;
+
+		return header;
+	}
+
 	nifti_1_header default_header(const nifti_1_header& like) const {
 		nifti_1_header header = like;
 
@@ -38,6 +38,8 @@
 
 #include "debug.h"
 #include "env.h"
+#include "profile.h"
+#include "trace.h"
 
 namespace smt {
 
@@ -65,14 +67,19 @@ typename std::enable_if<Range::Dim == 1, void>::type parfor(const Range& rg, Fun
 		const unsigned int& nthreads = 1, const std::size_t& chunk = 1) {
 
 	if(nthreads > 1) {
+		smt::profile_parfor profile_loop(rg.size(), nthreads);
+		const smt::trace_scope trace_loop("parfor", rg.size());
+		smt::tracer().reserve(nthreads);
 		std::vector<std::thread> threads;
 		threads.reserve(nthreads);
 
 		std::atomic<std::size_t> tmp{0};
 		for(unsigned int ii = 0; ii < nthreads; ++ii) {
 			threads.emplace_back([&](const unsigned int tt) {
+				const smt::profile_parfor::scope profile_scope(profile_loop, tt);
 				std::size_t jj;
 				while((jj = tmp.fetch_add(chunk, std::memory_order_relaxed)) < rg.size()) {
+					const smt::trace_scope trace_chunk("chunk", jj, tt);
 					for(std::size_t kk = 0; kk < chunk && jj+kk < rg.size(); ++kk) {
 						f(jj+kk, tt);
 					}
@@ -86,6 +93,9 @@ typename std::enable_if<Range::Dim == 1, void>::type parfor(const Range& rg, Fun
 			}
 		}
 	} else {
+		smt::profile_parfor profile_loop(rg.size(), 1);
+		const smt::trace_scope trace_loop("parfor", rg.size());
+		const smt::profile_parfor::scope profile_scope(profile_loop, 0);
 		for(std::size_t ii = 0; ii < rg.size(); ++ii) {
 			f(ii, 0);
 		}
@@ -97,14 +107,19 @@ typename std::enable_if<Range::Dim == 2, void>::type parfor(const Range& rg, Fun
 		const unsigned int& nthreads = 1, const std::size_t& chunk = 1) {
 
 	if(nthreads > 1) {
+		smt::profile_parfor profile_loop(rg.size(), nthreads);
+		const smt::trace_scope trace_loop("parfor", rg.size());
+		smt::tracer().reserve(nthreads);
 		std::vector<std::thread> threads;
 		threads.reserve(nthreads);
 
 		std::atomic<std::size_t> tmp{0};
 		for(unsigned int ii = 0; ii < nthreads; ++ii) {
 			threads.emplace_back([&](const unsigned int tt) {
+				const smt::profile_parfor::scope profile_scope(profile_loop, tt);
 				std::size_t jj;
 				while((jj = tmp.fetch_add(chunk, std::memory_order_relaxed)) < rg.size()) {
+					const smt::trace_scope trace_chunk("chunk", jj, tt);
 					for(std::size_t kk = 0; kk < chunk && jj+kk < rg.size(); ++kk) {
 						std::size_t i0, i1;
 						std::tie(i0, i1) = rg.index(jj+kk);
@@ -120,6 +135,9 @@ typename std::enable_if<Range::Dim == 2, void>::type parfor(const Range& rg, Fun
 			}
 		}
 	} else {
+		smt::profile_parfor profile_loop(rg.size(), 1);
+		const smt::trace_scope trace_loop("parfor", rg.size());
+		const smt::profile_parfor::scope profile_scope(profile_loop, 0);
 		for(std::size_t ii = 0; ii < rg.size(); ++ii) {
 			std::size_t i0, i1;
 			std::tie(i0, i1) = rg.index(ii);
@@ -133,14 +151,19 @@ typename std::enable_if<Range::Dim == 3, void>::type parfor(const Range& rg, Fun
 		const unsigned int& nthreads = 1, const std::size_t& chunk = 1) {
 
 	if(nthreads > 1) {
+		smt::profile_parfor profile_loop(rg.size(), nthreads);
+		const smt::trace_scope trace_loop("parfor", rg.size());
+		smt::tracer().reserve(nthreads);
 		std::vector<std::thread> threads;
 		threads.reserve(nthreads);
 
 		std::atomic<std::size_t> tmp{0};
 		for(unsigned int ii = 0; ii < nthreads; ++ii) {
 			threads.emplace_back([&](const unsigned int tt) {
+				const smt::profile_parfor::scope profile_scope(profile_loop, tt);
 				std::size_t jj;
 				while((jj = tmp.fetch_add(chunk, std::memory_order_relaxed)) < rg.size()) {
+					const smt::trace_scope trace_chunk("chunk", jj, tt);
 					for(std::size_t kk = 0; kk < chunk && jj+kk < rg.size(); ++kk) {
 						std::size_t i0, i1, i2;
 						std::tie(i0, i1, i2) = rg.index(jj+kk);
@@ -156,6 +179,9 @@ typename std::enable_if<Range::Dim == 3, void>::type parfor(const Range& rg, Fun
 			}
 		}
 	} else {
+		smt::profile_parfor profile_loop(rg.size(), 1);
+		const smt::trace_scope trace_loop("parfor", rg.size());
+		const smt::profile_parfor::scope profile_scope(profile_loop, 0);
 		for(std::size_t ii = 0; ii < rg.size(); ++ii) {
 			std::size_t i0, i1, i2;
 			std::tie(i0, i1, i2) = rg.index(ii);
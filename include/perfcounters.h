@@ -0,0 +1,138 @@
+//
+// Copyright (c) 2018 Enrico Kaden & University College London
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// * Redistributions of source code must retain the above copyright notice, this
+//   list of conditions and the following disclaimer.
+//
+// * Redistributions in binary form must reproduce the above copyright notice,
+//   this list of conditions and the following disclaimer in the documentation
+//   and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#ifndef _PERFCOUNTERS_H
+#define _PERFCOUNTERS_H
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif // __linux__
+
+namespace smt {
+
+// Hardware counters of the calling thread, i.e. CPU cycles, instructions,
+// cache misses and branch misses, which are read through perf_event_open(2)
+// on Linux. The counters are opened as one group, such that they are
+// scheduled together. A counter that is not available, e.g. under a
+// restrictive perf_event_paranoid setting, in a container or on another
+// platform, reads as -1.
+class perfcounters {
+public:
+	static const std::size_t size = 4;
+
+	typedef std::array<long long int, size> values;
+
+	static const char* name(const std::size_t& ii) {
+		static const char* names[size] = {"cycles", "instructions", "cache_misses", "branch_misses"};
+		return names[ii];
+	}
+
+	static values unavailable() {
+		values ret;
+		ret.fill(-1);
+		return ret;
+	}
+
+	// Sum of the available counters; a counter is available if it is
+	// available in both.
+	static values add(const values& lhs, const values& rhs) {
+		values ret;
+		for(std::size_t ii = 0; ii < size; ++ii) {
+			ret[ii] = (lhs[ii] >= 0 && rhs[ii] >= 0)? lhs[ii]+rhs[ii] : -1;
+		}
+		return ret;
+	}
+
+	explicit perfcounters(const bool& enabled) {
+		_fd.fill(-1);
+#ifdef __linux__
+		if(enabled) {
+			static const std::uint64_t configs[size] = {PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS, PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES};
+			for(std::size_t ii = 0; ii < size; ++ii) {
+				struct perf_event_attr attr;
+				std::memset(&attr, 0, sizeof(attr));
+				attr.size = sizeof(attr);
+				attr.type = PERF_TYPE_HARDWARE;
+				attr.config = configs[ii];
+				attr.disabled = (ii == 0)? 1 : 0;
+				attr.exclude_kernel = 1;
+				attr.exclude_hv = 1;
+				attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+				_fd[ii] = static_cast<int>(syscall(__NR_perf_event_open, &attr, 0, -1, _fd[0], 0));
+				if(ii == 0 && _fd[0] < 0) {
+					return;
+				}
+			}
+			ioctl(_fd[0], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+			ioctl(_fd[0], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+		}
+#endif // __linux__
+	}
+
+	perfcounters(const perfcounters&) = delete;
+
+	perfcounters& operator=(const perfcounters&) = delete;
+
+	// Counts since construction, scaled up if the group was multiplexed with
+	// other events.
+	values read() const {
+		values ret = unavailable();
+#ifdef __linux__
+		for(std::size_t ii = 0; ii < size; ++ii) {
+			std::uint64_t buf[3];
+			if(_fd[ii] >= 0 && ::read(_fd[ii], buf, sizeof(buf)) == sizeof(buf) && buf[2] > 0) {
+				ret[ii] = static_cast<long long int>(static_cast<double>(buf[0])*buf[1]/buf[2]);
+			}
+		}
+#endif // __linux__
+		return ret;
+	}
+
+	~perfcounters() {
+#ifdef __linux__
+		for(std::size_t ii = size; ii > 0; --ii) {
+			if(_fd[ii-1] >= 0) {
+				close(_fd[ii-1]);
+			}
+		}
+#endif // __linux__
+	}
+
+private:
+	std::array<int, size> _fd;
+};
+
+} // smt
+
+#endif // _PERFCOUNTERS_H
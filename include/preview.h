@@ -0,0 +1,146 @@
+//
+// Copyright (c) 2018 Enrico Kaden & University College London
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// * Redistributions of source code must retain the above copyright notice, this
+//   list of conditions and the following disclaimer.
+//
+// * Redistributions in binary form must reproduce the above copyright notice,
+//   this list of conditions and the following disclaimer in the documentation
+//   and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#ifndef _PREVIEW_H
+#define _PREVIEW_H
+
+#include <algorithm>
+#include <cstddef>
+#include <vector>
+
+#include "darray.h"
+#include "sarray.h"
+
+namespace smt {
+
+// Subsampling grid of a preview, whose nodes are every k-th voxel along each
+// dimension together with the last voxel, such that every voxel lies between
+// two nodes. The values at the other voxels are interpolated trilinearly from
+// the eight surrounding nodes.
+class previewgrid {
+public:
+	previewgrid() {}
+
+	previewgrid(const std::size_t& s0, const std::size_t& s1, const std::size_t& s2, const std::size_t& k) {
+		const std::size_t s[3] = {s0, s1, s2};
+		for(std::size_t dd = 0; dd < 3; ++dd) {
+			for(std::size_t xx = 0; xx < s[dd]; xx += k) {
+				_nodes[dd].push_back(xx);
+			}
+			if(_nodes[dd].back() != s[dd]-1) {
+				_nodes[dd].push_back(s[dd]-1);
+			}
+			_index[dd].assign(s[dd], _nodes[dd].size());
+			for(std::size_t gg = 0; gg < _nodes[dd].size(); ++gg) {
+				_index[dd][_nodes[dd][gg]] = gg;
+			}
+		}
+	}
+
+	explicit operator bool() const {
+		return ! _nodes[0].empty();
+	}
+
+	// Number of nodes along dimension dd.
+	std::size_t size(const std::size_t& dd) const {
+		return _nodes[dd].size();
+	}
+
+	// Voxel coordinate of node gg along dimension dd.
+	std::size_t node(const std::size_t& dd, const std::size_t& gg) const {
+		return _nodes[dd][gg];
+	}
+
+	// Node index of voxel coordinate xx along dimension dd, or size(dd) if
+	// the voxel is not on the grid.
+	std::size_t index(const std::size_t& dd, const std::size_t& xx) const {
+		return _index[dd][xx];
+	}
+
+	bool is_node(const std::size_t& ii, const std::size_t& jj, const std::size_t& kk) const {
+		return index(0, ii) < size(0) && index(1, jj) < size(1) && index(2, kk) < size(2);
+	}
+
+	// Trilinear interpolation at voxel (ii, jj, kk) of the node values, using
+	// the surrounding nodes marked as valid with renormalised weights. False
+	// if none of them with a nonzero weight is valid.
+	template <typename T, std::size_t N>
+	bool interpolate(const std::size_t& ii, const std::size_t& jj, const std::size_t& kk,
+			const smt::darray<smt::sarray<T, N>, 3>& values,
+			const smt::darray<unsigned char, 3>& valid,
+			smt::sarray<T, N>& x) const {
+		std::size_t g0[3];
+		T t[3];
+		const std::size_t xx[3] = {ii, jj, kk};
+		for(std::size_t dd = 0; dd < 3; ++dd) {
+			g0[dd] = std::upper_bound(_nodes[dd].begin(), _nodes[dd].end(), xx[dd])-_nodes[dd].begin()-1;
+			if(g0[dd]+1 < _nodes[dd].size()) {
+				t[dd] = T(xx[dd]-_nodes[dd][g0[dd]])/T(_nodes[dd][g0[dd]+1]-_nodes[dd][g0[dd]]);
+			} else {
+				t[dd] = 0;
+			}
+		}
+
+		T wsum = 0;
+		for(std::size_t nn = 0; nn < N; ++nn) {
+			x(nn) = 0;
+		}
+		for(std::size_t cc = 0; cc < 8; ++cc) {
+			std::size_t gg[3];
+			T w = 1;
+			for(std::size_t dd = 0; dd < 3; ++dd) {
+				const std::size_t bit = (cc >> dd) & 1;
+				w *= bit? t[dd] : T(1)-t[dd];
+				gg[dd] = std::min(g0[dd]+bit, _nodes[dd].size()-1);
+			}
+			if(w > T(0) && valid(gg[0], gg[1], gg[2])) {
+				for(std::size_t nn = 0; nn < N; ++nn) {
+					x(nn) += w*values(gg[0], gg[1], gg[2])(nn);
+				}
+				wsum += w;
+			}
+		}
+		if(! (wsum > T(0))) {
+			return false;
+		}
+		for(std::size_t nn = 0; nn < N; ++nn) {
+			x(nn) /= wsum;
+		}
+
+		return true;
+	}
+
+	~previewgrid() {
+	}
+
+private:
+	std::vector<std::size_t> _nodes[3];
+	std::vector<std::size_t> _index[3];
+};
+
+} // smt
+
+#endif // _PREVIEW_H
@@ -0,0 +1,491 @@
+//
+// Copyright (c) 2018 Enrico Kaden & University College London
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// * Redistributions of source code must retain the above copyright notice, this
+//   list of conditions and the following disclaimer.
+//
+// * Redistributions in binary form must reproduce the above copyright notice,
+//   this list of conditions and the following disclaimer in the documentation
+//   and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#ifndef _PROFILE_H
+#define _PROFILE_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <iomanip>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <sys/resource.h>
+#include <sys/time.h>
+
+#include "darray.h"
+#include "debug.h"
+#include "env.h"
+#include "perfcounters.h"
+#include "trace.h"
+
+namespace smt {
+
+// Run-time profile, which is enabled by setting the environment variable
+// SMT_PROFILE to the name of a file, to which the profile is written in JSON
+// format at exit. If the variable is unset, every hook reduces to a test of
+// the enabled flag. The hardware counters of the stages and of the threads
+// of the parallel loops are reported where available.
+class profile {
+public:
+	typedef std::chrono::steady_clock clock;
+
+	profile():
+		_path(smt::getenv("SMT_PROFILE")),
+		_enabled(! _path.empty()),
+		_start(clock::now()),
+		_cpu_start(cputime()),
+		_bytes_read(0),
+		_bytes_written(0) {
+	}
+
+	profile(const profile&) = delete;
+
+	profile& operator=(const profile&) = delete;
+
+	bool enabled() const {
+		return _enabled;
+	}
+
+	double walltime() const {
+		return std::chrono::duration<double>(clock::now()-_start).count();
+	}
+
+	// User and system time of the process (s), summed over its threads.
+	static double cputime() {
+		struct rusage usage;
+		getrusage(RUSAGE_SELF, &usage);
+		return usage.ru_utime.tv_sec+usage.ru_stime.tv_sec+1e-6*(usage.ru_utime.tv_usec+usage.ru_stime.tv_usec);
+	}
+
+	void add_read(const unsigned long int& bytes) {
+		if(_enabled) {
+			_bytes_read.fetch_add(bytes, std::memory_order_relaxed);
+		}
+	}
+
+	void add_written(const unsigned long int& bytes) {
+		if(_enabled) {
+			_bytes_written.fetch_add(bytes, std::memory_order_relaxed);
+		}
+	}
+
+	void add_stage(const std::string& name, const std::string& file, const unsigned long int& items, const double& begin, const double& wall, const double& cpu, const perfcounters::values& counters) {
+		std::lock_guard<std::mutex> lock(_mutex);
+		_stages.push_back(stage_record{name, file, items, begin, wall, cpu, counters});
+	}
+
+	void add_parfor(const unsigned long int& items, const double& begin, const double& wall, std::vector<double>&& busy, const perfcounters::values& counters) {
+		std::lock_guard<std::mutex> lock(_mutex);
+		_parfors.push_back(parfor_record{items, begin, wall, std::move(busy), counters});
+	}
+
+	void add_section(const std::string& name, std::vector<double>&& time, std::vector<unsigned long int>&& count) {
+		std::lock_guard<std::mutex> lock(_mutex);
+		_sections.push_back(section_record{name, std::move(time), std::move(count)});
+	}
+
+	~profile() {
+		if(_enabled) {
+			write();
+		}
+	}
+
+private:
+	struct stage_record {
+		std::string name;
+		std::string file;
+		unsigned long int items;
+		double begin;
+		double wall;
+		double cpu;
+		perfcounters::values counters;
+	};
+
+	struct parfor_record {
+		unsigned long int items;
+		double begin;
+		double wall;
+		std::vector<double> busy;
+		perfcounters::values counters;
+	};
+
+	struct section_record {
+		std::string name;
+		std::vector<double> time;
+		std::vector<unsigned long int> count;
+	};
+
+	const std::string _path;
+	const bool _enabled;
+	const clock::time_point _start;
+	const double _cpu_start;
+	std::atomic<unsigned long int> _bytes_read;
+	std::atomic<unsigned long int> _bytes_written;
+	std::mutex _mutex;
+	std::vector<stage_record> _stages;
+	std::vector<parfor_record> _parfors;
+	std::vector<section_record> _sections;
+
+	static long int peak_rss() {
+		struct rusage usage;
+		getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+		return usage.ru_maxrss;
+#else
+		return 1024L*usage.ru_maxrss;
+#endif // __APPLE__
+	}
+
+	static std::string quote(const std::string& s) {
+		std::string ret{"\""};
+		for(const char& c : s) {
+			if(c == '"' || c == '\\') {
+				ret += '\\';
+				ret += c;
+			} else if(static_cast<unsigned char>(c) < 0x20) {
+				ret += ' ';
+			} else {
+				ret += c;
+			}
+		}
+		ret += '"';
+
+		return ret;
+	}
+
+	static std::string ratio(const long long int& num, const long long int& den, const double& scale) {
+		std::ostringstream sout;
+		sout << std::fixed << std::setprecision(6);
+		if(num >= 0 && den > 0) {
+			sout << scale*num/den;
+		} else {
+			sout << "null";
+		}
+
+		return sout.str();
+	}
+
+	// Counters together with the instructions per cycle and the misses per
+	// thousand instructions, or null if no counter is available.
+	static std::string counters(const perfcounters::values& c) {
+		std::ostringstream sout;
+		if(std::all_of(c.begin(), c.end(), [](const long long int& v) { return v < 0; })) {
+			sout << "null";
+		} else {
+			sout << "{";
+			for(std::size_t ii = 0; ii < perfcounters::size; ++ii) {
+				sout << "\"" << perfcounters::name(ii) << "\": ";
+				if(c[ii] >= 0) {
+					sout << c[ii];
+				} else {
+					sout << "null";
+				}
+				sout << ", ";
+			}
+			sout << "\"ipc\": " << ratio(c[1], c[0], 1)
+					<< ", \"cache_mpki\": " << ratio(c[2], c[1], 1000)
+					<< ", \"branch_mpki\": " << ratio(c[3], c[1], 1000) << "}";
+		}
+
+		return sout.str();
+	}
+
+	void write() {
+		std::lock_guard<std::mutex> lock(_mutex);
+		std::ofstream fout(_path.c_str());
+		if(! fout.good()) {
+			smt::error("Unable to write ‘" + _path + "’.");
+			return;
+		}
+
+		fout << std::fixed << std::setprecision(6);
+		fout << "{" << std::endl;
+		fout << "  \"wall_time\": " << walltime() << "," << std::endl;
+		fout << "  \"cpu_time\": " << cputime()-_cpu_start << "," << std::endl;
+		fout << "  \"peak_rss\": " << peak_rss() << "," << std::endl;
+		fout << "  \"bytes_read\": " << _bytes_read.load() << "," << std::endl;
+		fout << "  \"bytes_written\": " << _bytes_written.load() << "," << std::endl;
+
+		fout << "  \"stages\": [";
+		for(std::size_t ii = 0; ii < _stages.size(); ++ii) {
+			const stage_record& r = _stages[ii];
+			fout << ((ii > 0)? "," : "") << std::endl;
+			fout << "    {\"name\": " << quote(r.name) << ", \"file\": " << quote(r.file)
+					<< ", \"begin\": " << r.begin << ", \"wall_time\": " << r.wall << ", \"cpu_time\": " << r.cpu
+					<< ", \"items\": " << r.items << ", \"items_per_s\": " << ((r.wall > 0)? r.items/r.wall : 0.0)
+					<< ", \"counters\": " << counters(r.counters) << "}";
+		}
+		fout << std::endl << "  ]," << std::endl;
+
+		fout << "  \"parfor\": [";
+		for(std::size_t ii = 0; ii < _parfors.size(); ++ii) {
+			const parfor_record& r = _parfors[ii];
+			fout << ((ii > 0)? "," : "") << std::endl;
+			fout << "    {\"items\": " << r.items << ", \"begin\": " << r.begin << ", \"wall_time\": " << r.wall << ", \"threads\": [";
+			for(std::size_t tt = 0; tt < r.busy.size(); ++tt) {
+				fout << ((tt > 0)? ", " : "") << "{\"busy\": " << r.busy[tt] << ", \"idle\": " << std::max(0.0, r.wall-r.busy[tt]) << "}";
+			}
+			fout << "], \"counters\": " << counters(r.counters) << "}";
+		}
+		fout << std::endl << "  ]," << std::endl;
+
+		fout << "  \"sections\": [";
+		for(std::size_t ii = 0; ii < _sections.size(); ++ii) {
+			const section_record& r = _sections[ii];
+			double time = 0;
+			unsigned long int count = 0;
+			for(std::size_t tt = 0; tt < r.time.size(); ++tt) {
+				time += r.time[tt];
+				count += r.count[tt];
+			}
+			fout << ((ii > 0)? "," : "") << std::endl;
+			fout << "    {\"name\": " << quote(r.name) << ", \"time\": " << time << ", \"count\": " << count << ", \"threads\": [";
+			for(std::size_t tt = 0; tt < r.time.size(); ++tt) {
+				fout << ((tt > 0)? ", " : "") << r.time[tt];
+			}
+			fout << "]}";
+		}
+		fout << std::endl << "  ]" << std::endl;
+		fout << "}" << std::endl;
+	}
+};
+
+smt::profile& profiler() {
+	static smt::profile p;
+	return p;
+}
+
+namespace {
+
+// Starts the clock of the profile with the program.
+const bool profile_init = (smt::profiler(), true);
+
+} // (anonymous)
+
+// Wall and CPU time and hardware counters of a stage, from construction to
+// stop() or destruction, which is also recorded as an event of the trace. The
+// counters cover the calling thread only.
+class profile_stage {
+public:
+	profile_stage(const std::string& name, const std::string& file = std::string{}):
+		profile_stage(name, file, 0) {
+	}
+
+	profile_stage(const std::string& name, const unsigned long int& items):
+		profile_stage(name, std::string{}, items) {
+	}
+
+	profile_stage(const profile_stage&) = delete;
+
+	profile_stage& operator=(const profile_stage&) = delete;
+
+	void stop() {
+		if(_running) {
+			_running = false;
+			smt::profiler().add_stage(_name, _file, _items, _begin, smt::profiler().walltime()-_begin, smt::profile::cputime()-_cpu_begin, _counters.read());
+		}
+		if(_traced) {
+			_traced = false;
+			smt::tracer().local().push(trace::event{smt::tracer().intern(_file.empty()? _name : _name + " " + _file),
+					_trace_begin, smt::tracer().now()-_trace_begin, _items});
+		}
+	}
+
+	~profile_stage() {
+		stop();
+	}
+
+private:
+	const std::string _name;
+	const std::string _file;
+	const unsigned long int _items;
+	bool _running;
+	bool _traced;
+	double _begin;
+	double _cpu_begin;
+	std::uint64_t _trace_begin;
+	const perfcounters _counters;
+
+	profile_stage(const std::string& name, const std::string& file, const unsigned long int& items):
+		_name((smt::profiler().enabled() || smt::tracer().enabled())? name : std::string{}),
+		_file((smt::profiler().enabled() || smt::tracer().enabled())? file : std::string{}),
+		_items(items),
+		_running(smt::profiler().enabled()),
+		_traced(smt::tracer().enabled()),
+		_begin(_running? smt::profiler().walltime() : 0),
+		_cpu_begin(_running? smt::profile::cputime() : 0),
+		_trace_begin(_traced? smt::tracer().now() : 0),
+		_counters(_running) {
+	}
+};
+
+// Busy time and hardware counters of the threads of a parallel loop. Each
+// thread opens a scope around its share of the work; the loop is recorded on
+// destruction, with the counters summed over the threads.
+class profile_parfor {
+public:
+	class scope {
+	public:
+		scope(profile_parfor& parent, const unsigned int& tt):
+			_parent(parent),
+			_tt(tt),
+			_begin(parent._enabled? smt::profiler().walltime() : 0),
+			_counters(parent._enabled) {
+		}
+
+		scope(const scope&) = delete;
+
+		scope& operator=(const scope&) = delete;
+
+		~scope() {
+			if(_parent._enabled) {
+				_parent._busy[_tt] = smt::profiler().walltime()-_begin;
+				_parent._counters[_tt] = _counters.read();
+			}
+		}
+
+	private:
+		profile_parfor& _parent;
+		const unsigned int _tt;
+		const double _begin;
+		const perfcounters _counters;
+	};
+
+	profile_parfor(const unsigned long int& items, const unsigned int& nthreads):
+		_enabled(smt::profiler().enabled()),
+		_items(items),
+		_begin(_enabled? smt::profiler().walltime() : 0),
+		_busy(_enabled? nthreads : 0, 0.0),
+		_counters(_enabled? nthreads : 0, perfcounters::unavailable()) {
+	}
+
+	profile_parfor(const profile_parfor&) = delete;
+
+	profile_parfor& operator=(const profile_parfor&) = delete;
+
+	~profile_parfor() {
+		if(_enabled) {
+			perfcounters::values counters = perfcounters::unavailable();
+			for(std::size_t tt = 0; tt < _counters.size(); ++tt) {
+				counters = (tt > 0)? perfcounters::add(counters, _counters[tt]) : _counters[tt];
+			}
+			smt::profiler().add_parfor(_items, _begin, smt::profiler().walltime()-_begin, std::move(_busy), counters);
+		}
+	}
+
+private:
+	const bool _enabled;
+	const unsigned long int _items;
+	const double _begin;
+	std::vector<double> _busy;
+	std::vector<perfcounters::values> _counters;
+};
+
+// Time spent per thread in a section of the per-voxel work, e.g. the voxel
+// gather or the model fit, accumulated by profile_timer.
+class profile_section {
+	friend class profile_timer;
+
+public:
+	profile_section(const std::string& name, const unsigned int& nthreads):
+		_enabled(smt::profiler().enabled()),
+		_name(name),
+		_time(_enabled? nthreads : 0, 8),
+		_count(_enabled? nthreads : 0, 8) {
+		if(_enabled) {
+			_time = 0.0;
+			_count = 0ul;
+		}
+	}
+
+	profile_section(const profile_section&) = delete;
+
+	profile_section& operator=(const profile_section&) = delete;
+
+	~profile_section() {
+		if(_enabled) {
+			std::vector<double> time(_time.size(0));
+			std::vector<unsigned long int> count(_count.size(0));
+			for(std::size_t tt = 0; tt < time.size(); ++tt) {
+				time[tt] = _time(tt, 0);
+				count[tt] = _count(tt, 0);
+			}
+			smt::profiler().add_section(_name, std::move(time), std::move(count));
+		}
+	}
+
+private:
+	const bool _enabled;
+	const std::string _name;
+	// One row per thread, padded to a cache line, which is accessed at
+	// column zero only.
+	smt::darray<double, 2> _time;
+	smt::darray<unsigned long int, 2> _count;
+};
+
+class profile_timer {
+public:
+	profile_timer(profile_section& section, const unsigned int& tt):
+		_section(section),
+		_tt(tt),
+		_running(section._enabled),
+		_begin(_running? profile::clock::now() : profile::clock::time_point()) {
+	}
+
+	profile_timer(const profile_timer&) = delete;
+
+	profile_timer& operator=(const profile_timer&) = delete;
+
+	void stop() {
+		if(_running) {
+			_running = false;
+			_section._time(_tt, 0) += std::chrono::duration<double>(profile::clock::now()-_begin).count();
+			_section._count(_tt, 0) += 1;
+		}
+	}
+
+	~profile_timer() {
+		stop();
+	}
+
+private:
+	profile_section& _section;
+	const unsigned int _tt;
+	bool _running;
+	const profile::clock::time_point _begin;
+};
+
+} // smt
+
+#endif // _PROFILE_H
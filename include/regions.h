@@ -0,0 +1,353 @@
+//
+// Copyright (c) 2018 Enrico Kaden & University College London
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// * Redistributions of source code must retain the above copyright notice, this
+//   list of conditions and the following disclaimer.
+//
+// * Redistributions in binary form must reproduce the above copyright notice,
+//   this list of conditions and the following disclaimer in the documentation
+//   and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#ifndef _REGIONS_H
+#define _REGIONS_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <set>
+#include <tuple>
+
+#include "cartesianrange.h"
+#include "darray.h"
+#include "diffenc.h"
+#include "nifti.h"
+#include "parfor.h"
+#include "profile.h"
+#include "ricedebias.h"
+
+namespace smt {
+
+// Regions of a label image, e.g. the parcels of an atlas. Voxels with a
+// positive label, rounded to the nearest integer, belong to the region of
+// that label, unless they are outside the mask. The regions are numbered in
+// ascending order of their labels.
+class regions {
+public:
+	regions() {}
+
+	template <typename float_t>
+	regions(const smt::inifti<float_t, 3>& labels, const smt::inifti<float_t, 3>& mask):
+			_index(labels.size(0), labels.size(1), labels.size(2)) {
+		std::set<long> values;
+		for(std::size_t kk = 0; kk < labels.size(2); ++kk) {
+			for(std::size_t jj = 0; jj < labels.size(1); ++jj) {
+				for(std::size_t ii = 0; ii < labels.size(0); ++ii) {
+					const long value = std::lround(labels(ii, jj, kk));
+					if(value > 0 && ((! mask) || mask(ii, jj, kk) > 0)) {
+						values.insert(value);
+					}
+				}
+			}
+		}
+
+		_labels = smt::darray<long, 1>(values.size());
+		std::copy(values.begin(), values.end(), std::begin(_labels));
+		_counts = smt::darray<std::size_t, 1>(values.size());
+		std::fill(std::begin(_counts), std::end(_counts), 0);
+
+		for(std::size_t kk = 0; kk < labels.size(2); ++kk) {
+			for(std::size_t jj = 0; jj < labels.size(1); ++jj) {
+				for(std::size_t ii = 0; ii < labels.size(0); ++ii) {
+					const long value = std::lround(labels(ii, jj, kk));
+					if(value > 0 && ((! mask) || mask(ii, jj, kk) > 0)) {
+						const std::size_t rr = std::lower_bound(std::begin(_labels), std::end(_labels), value)-std::begin(_labels);
+						_index(ii, jj, kk) = rr;
+						++_counts(rr);
+					} else {
+						_index(ii, jj, kk) = values.size();
+					}
+				}
+			}
+		}
+	}
+
+	// A single region of label 1, i.e. the voxels inside the mask or, without
+	// a mask, the whole image.
+	template <typename float_t>
+	regions(const std::size_t& s0, const std::size_t& s1, const std::size_t& s2, const smt::inifti<float_t, 3>& mask):
+			_index(s0, s1, s2),
+			_labels(1),
+			_counts(1) {
+		_labels(0) = 1;
+		_counts(0) = 0;
+		for(std::size_t kk = 0; kk < s2; ++kk) {
+			for(std::size_t jj = 0; jj < s1; ++jj) {
+				for(std::size_t ii = 0; ii < s0; ++ii) {
+					if((! mask) || mask(ii, jj, kk) > 0) {
+						_index(ii, jj, kk) = 0;
+						++_counts(0);
+					} else {
+						_index(ii, jj, kk) = 1;
+					}
+				}
+			}
+		}
+	}
+
+	explicit operator bool() const {
+		return static_cast<bool>(_index);
+	}
+
+	std::size_t size() const {
+		return _labels.size();
+	}
+
+	// Size of the image along dimension dd.
+	std::size_t size(const std::size_t& dd) const {
+		return _index.size(dd);
+	}
+
+	long label(const std::size_t& rr) const {
+		return _labels(rr);
+	}
+
+	std::size_t count(const std::size_t& rr) const {
+		return _counts(rr);
+	}
+
+	// Region of the voxel, or size() if the voxel is in none.
+	std::size_t operator()(const std::size_t& ii, const std::size_t& jj, const std::size_t& kk) const {
+		return _index(ii, jj, kk);
+	}
+
+	~regions() {
+	}
+
+private:
+	smt::darray<std::size_t, 3> _index;
+	smt::darray<long, 1> _labels;
+	smt::darray<std::size_t, 1> _counts;
+};
+
+// Mean signals of groups of voxels, e.g. the regions of a label image or the
+// blocks of a coarse grid, to which the model is fitted in place of the
+// voxels. The voxel signals are corrected for the Rician bias before they are
+// summed, and with a gradient deviation the scale factors of the b-values are
+// averaged likewise. The sums are kept per thread.
+template <typename float_t>
+class signalmeans {
+public:
+	signalmeans(const smt::inifti<float_t, 4>& input, const smt::diffenc<float_t>& dw, const smt::inifti<float_t, 4>& graddev,
+			const std::tuple<float_t, smt::inifti<float_t, 3>>& rician, const std::size_t& ngroups, const unsigned int& nthreads):
+			_input(input),
+			_dw(dw),
+			_graddev(graddev),
+			_rician(rician),
+			_sum(nthreads, ngroups, input.size(3)),
+			_scales(graddev? nthreads : 0, ngroups, dw.mapping.size()),
+			_count(nthreads, ngroups),
+			_input_buf(nthreads, input.size(3)),
+			_graddev_buf(graddev? nthreads : 0, 9*input.size(0)),
+			_scales_row_buf(graddev? nthreads : 0, dw.mapping.size()*input.size(0)),
+			_scales_buf(graddev? nthreads : 0, dw.mapping.size()) {
+		std::fill(std::begin(_sum), std::end(_sum), float_t(0));
+		std::fill(std::begin(_scales), std::end(_scales), float_t(0));
+		std::fill(std::begin(_count), std::end(_count), 0);
+	}
+
+	signalmeans(const signalmeans&) = delete;
+
+	signalmeans& operator=(const signalmeans&) = delete;
+
+	std::size_t size() const {
+		return _count.size(1);
+	}
+
+	// Resets the sums of thread tt.
+	void clear(const unsigned int& tt) {
+		for(std::size_t gg = 0; gg < size(); ++gg) {
+			for(std::size_t ll = 0; ll < _input.size(3); ++ll) {
+				_sum(tt, gg, ll) = 0;
+			}
+			if(_graddev) {
+				for(std::size_t ll = 0; ll < _dw.mapping.size(); ++ll) {
+					_scales(tt, gg, ll) = 0;
+				}
+			}
+			_count(tt, gg) = 0;
+		}
+	}
+
+	// Adds each voxel (ii, jj, kk) of a row to the sums of thread tt of group
+	// group(ii), unless it is not less than size().
+	template <typename Group>
+	void add(const std::size_t& jj, const std::size_t& kk, const unsigned int& tt, const Group& group) {
+		const std::size_t nmeas = _input.size(3);
+		const std::size_t nx = _input.size(0);
+		const smt::darray_view<float_t, 2> scales_row(_graddev? _dw.mapping.size() : 0, nx, _scales_row_buf.begin()+(_graddev? tt*_dw.mapping.size()*nx : 0));
+		if(_graddev) {
+			const smt::darray_view<float_t, 2> graddev_row(9, nx, _graddev_buf.begin()+tt*9*nx);
+			for(std::size_t ll = 0; ll < 9; ++ll) {
+				for(std::size_t ii = 0; ii < nx; ++ii) {
+					graddev_row(ll, ii) = _graddev(ii, jj, kk, ll);
+				}
+			}
+			_dw.scales_graddev(graddev_row, scales_row);
+		}
+
+		const smt::darray_view<float_t, 1> input_tmp(nmeas, _input_buf.begin()+tt*nmeas);
+		for(std::size_t ii = 0; ii < nx; ++ii) {
+			const std::size_t gg = group(ii);
+			if(gg < size()) {
+				_input.gather(ii, jj, kk, smt::slice(0, nmeas), input_tmp);
+				for(std::size_t ll = 0; ll < nmeas; ++ll) {
+					if(std::get<1>(_rician)) {
+						_sum(tt, gg, ll) += smt::ricedebias(input_tmp(ll), std::get<1>(_rician)(ii, jj, kk));
+					} else if(std::get<0>(_rician) > float_t(0)) {
+						_sum(tt, gg, ll) += smt::ricedebias(input_tmp(ll), std::get<0>(_rician));
+					} else {
+						_sum(tt, gg, ll) += input_tmp(ll);
+					}
+				}
+				if(_graddev) {
+					for(std::size_t ll = 0; ll < _dw.mapping.size(); ++ll) {
+						_scales(tt, gg, ll) += scales_row(ll, ii);
+					}
+				}
+				++_count(tt, gg);
+			}
+		}
+	}
+
+	// Calls objective(y, scales) with the mean signal y of group gg over the
+	// sums of threads t0, ..., t1-1 and the mean scale factors, which are empty
+	// without a gradient deviation. The buffers of thread tt hold the means.
+	// False if the group is empty.
+	template <typename Objective>
+	bool fit(const std::size_t& gg, const unsigned int& t0, const unsigned int& t1, const unsigned int& tt, const Objective& objective) {
+		std::size_t count = 0;
+		for(unsigned int uu = t0; uu < t1; ++uu) {
+			count += _count(uu, gg);
+		}
+		if(count == 0) {
+			return false;
+		}
+
+		const std::size_t nmeas = _input.size(3);
+		const smt::darray_view<float_t, 1> input_tmp(nmeas, _input_buf.begin()+tt*nmeas);
+		for(std::size_t ll = 0; ll < nmeas; ++ll) {
+			float_t tmp = 0;
+			for(unsigned int uu = t0; uu < t1; ++uu) {
+				tmp += _sum(uu, gg, ll);
+			}
+			input_tmp(ll) = tmp/count;
+		}
+		const smt::darray_view<float_t, 1> scales_tmp(_graddev? _dw.mapping.size() : 0, _scales_buf.begin()+(_graddev? tt*_dw.mapping.size() : 0));
+		for(std::size_t ll = 0; ll < scales_tmp.size(); ++ll) {
+			float_t tmp = 0;
+			for(unsigned int uu = t0; uu < t1; ++uu) {
+				tmp += _scales(uu, gg, ll);
+			}
+			scales_tmp(ll) = tmp/count;
+		}
+		objective(input_tmp, scales_tmp);
+
+		return true;
+	}
+
+	~signalmeans() {
+	}
+
+private:
+	const smt::inifti<float_t, 4>& _input;
+	const smt::diffenc<float_t>& _dw;
+	const smt::inifti<float_t, 4>& _graddev;
+	const std::tuple<float_t, smt::inifti<float_t, 3>>& _rician;
+	smt::darray<float_t, 3> _sum;
+	smt::darray<float_t, 3> _scales;
+	smt::darray<std::size_t, 2> _count;
+	smt::darray<float_t, 2> _input_buf;
+	smt::darray<float_t, 2> _graddev_buf;
+	smt::darray<float_t, 2> _scales_row_buf;
+	smt::darray<float_t, 2> _scales_buf;
+};
+
+// Region-wise fit. The voxel signals are summed per region and thread in one
+// parallel pass, and objective(rr, y, scales) is then called once for the
+// mean signal of each region as in signalmeans::fit.
+template <typename float_t, typename Objective>
+void fitregions(const smt::inifti<float_t, 4>& input, const smt::diffenc<float_t>& dw, const smt::inifti<float_t, 4>& graddev,
+		const std::tuple<float_t, smt::inifti<float_t, 3>>& rician, const smt::regions& regions,
+		const unsigned int& nthreads, const std::size_t& chunk, const Objective& objective) {
+	smt::signalmeans<float_t> means(input, dw, graddev, rician, regions.size(), nthreads);
+
+	smt::profile_stage profile_reduce("reduce", input.size(0)*input.size(1)*input.size(2));
+	smt::parfor(smt::cartesianrange<2>(input.size(2), input.size(1)), [&](const std::size_t kk, const std::size_t jj, const unsigned int tt = 0) {
+		means.add(jj, kk, tt, [&](const std::size_t ii) {
+			return regions(ii, jj, kk);
+		});
+	}, nthreads, chunk);
+	profile_reduce.stop();
+
+	smt::profile_stage profile_regions("regions", regions.size());
+	smt::parfor(smt::cartesianrange<1>(regions.size()), [&](const std::size_t rr, const unsigned int tt = 0) {
+		means.fit(rr, 0, nthreads, tt, [&](const smt::darray_view<float_t, 1>& y, const smt::darray_view<float_t, 1>& scales) {
+			objective(rr, y, scales);
+		});
+	}, nthreads, chunk);
+	profile_regions.stop();
+}
+
+// Fit to the mean signal of each block of 2×2×2 voxels within the mask, i.e.
+// of a grid at half the resolution, where objective(ci, cj, ck, y, scales) is
+// called for each block with a voxel in the mask as in signalmeans::fit. The
+// blocks are reduced and fitted a row at a time, such that each thread only
+// keeps the sums of one row of blocks.
+template <typename float_t, typename Objective>
+void fitblocks(const smt::inifti<float_t, 4>& input, const smt::diffenc<float_t>& dw, const smt::inifti<float_t, 4>& graddev,
+		const std::tuple<float_t, smt::inifti<float_t, 3>>& rician, const smt::inifti<float_t, 3>& mask,
+		const unsigned int& nthreads, const std::size_t& chunk, const Objective& objective) {
+	const std::size_t s0 = (input.size(0)+1)/2;
+	const std::size_t s1 = (input.size(1)+1)/2;
+	const std::size_t s2 = (input.size(2)+1)/2;
+	smt::signalmeans<float_t> means(input, dw, graddev, rician, s0, nthreads);
+
+	smt::profile_stage profile_coarse("coarse", s0*s1*s2);
+	smt::parfor(smt::cartesianrange<2>(s2, s1), [&](const std::size_t ck, const std::size_t cj, const unsigned int tt = 0) {
+		means.clear(tt);
+		for(std::size_t kk = 2*ck; kk < std::min(2*ck+2, input.size(2)); ++kk) {
+			for(std::size_t jj = 2*cj; jj < std::min(2*cj+2, input.size(1)); ++jj) {
+				means.add(jj, kk, tt, [&](const std::size_t ii) {
+					return ((! mask) || mask(ii, jj, kk) > 0)? ii/2 : s0;
+				});
+			}
+		}
+
+		for(std::size_t ci = 0; ci < s0; ++ci) {
+			means.fit(ci, tt, tt+1, tt, [&](const smt::darray_view<float_t, 1>& y, const smt::darray_view<float_t, 1>& scales) {
+				objective(ci, cj, ck, y, scales);
+			});
+		}
+	}, nthreads, chunk);
+	profile_coarse.stop();
+}
+
+} // smt
+
+#endif // _REGIONS_H
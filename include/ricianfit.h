@@ -38,13 +38,14 @@
 #include "neldermead.h"
 #include "pow.h"
 #include "sarray.h"
+#include "svector.h"
 
 namespace smt {
 
 template <typename float_t>
 class RiceLikeFunction {
 public:
-	RiceLikeFunction(const smt::darray<float_t, 1>& y,
+	RiceLikeFunction(const smt::darray_view<const float_t, 1>& y,
 			const float_t& minsignal = 0): _y(maxsignal(y, minsignal)) {
 	}
 
@@ -79,10 +80,10 @@ public:
 	}
 
 private:
-	const smt::darray<float_t, 1> _y;
+	const smt::svector<float_t> _y;
 
-	smt::darray<float_t, 1> maxsignal(const smt::darray<float_t, 1>& x, const float_t& minsignal) const {
-		smt::darray<float_t, 1> y(x.size());
+	smt::svector<float_t> maxsignal(const smt::darray_view<const float_t, 1>& x, const float_t& minsignal) const {
+		smt::svector<float_t> y(x.size());
 		for(std::size_t ii = 0; ii < y.size(); ++ii) {
 			y(ii) = std::max(x(ii), minsignal);
 		}
@@ -114,7 +115,7 @@ private:
 };
 
 template <typename float_t>
-smt::sarray<float_t, 2> ricianfit(const smt::darray<float_t, 1>& y,
+smt::sarray<float_t, 2> ricianfit(const smt::darray_view<const float_t, 1>& y,
 		const float_t& minsignal = 0,
 		const float_t& opt_rel = 1000*std::numeric_limits<float_t>::epsilon(),
 		const float_t& opt_abs = 10*std::numeric_limits<float_t>::epsilon()) {
@@ -127,6 +128,14 @@ smt::sarray<float_t, 2> ricianfit(const smt::darray<float_t, 1>& y,
 	return x;
 }
 
+template <typename float_t>
+smt::sarray<float_t, 2> ricianfit(const smt::darray<float_t, 1>& y,
+		const float_t& minsignal = 0,
+		const float_t& opt_rel = 1000*std::numeric_limits<float_t>::epsilon(),
+		const float_t& opt_abs = 10*std::numeric_limits<float_t>::epsilon()) {
+	return ricianfit<float_t>(smt::darray_view<const float_t, 1>(y), minsignal, opt_rel, opt_abs);
+}
+
 } // smt
 
 #endif // _RICIANFIT_H
@@ -40,17 +40,16 @@
 
 namespace smt {
 
-// TODO: unsigned int => std::size_t, signed int => std::ptrdiff_t
 // TODO: Switch from row-major to column-major order.
 
-template <typename T, unsigned int S0, unsigned int S1 = 0>
+template <typename T, std::size_t S0, std::size_t S1 = 0>
 class sarray;
 
-template <typename T, unsigned int S0>
+template <typename T, std::size_t S0>
 class sarray<T, S0> {
 public:
 	typedef T value_type;
-	typedef unsigned int size_type;
+	typedef std::size_t size_type;
 
 	typedef T* iterator;
 	typedef const T* const_iterator;
@@ -266,11 +265,11 @@ private:
 	T _data[S0];
 };
 
-template <typename T, unsigned int S0, unsigned int S1>
+template <typename T, std::size_t S0, std::size_t S1>
 class sarray {
 public:
 	typedef T value_type;
-	typedef unsigned int size_type;
+	typedef std::size_t size_type;
 
 	typedef T* iterator;
 	typedef const T* const_iterator;
@@ -462,30 +461,30 @@ private:
 	T _data[S0*S1];
 };
 
-template <typename T, unsigned int S0, unsigned int S1>
+template <typename T, std::size_t S0, std::size_t S1>
 struct indexable_traits<sarray<T, S0, S1>> {
 	static const bool conforms = true;
 
 	static typename sarray<T, S0, S1>::value_type index(
-			const sarray<T, S0, S1>& a, const unsigned int& ii) {
+			const sarray<T, S0, S1>& a, const std::size_t& ii) {
 		return a[ii];
 	}
 
 	static typename sarray<T, S0, S1>::value_type& index(
-			sarray<T, S0, S1>& a, const unsigned int& ii) {
+			sarray<T, S0, S1>& a, const std::size_t& ii) {
 		return a[ii];
 	}
 
-	static unsigned int size(const sarray<T, S0, S1>& a) {
+	static std::size_t size(const sarray<T, S0, S1>& a) {
 		return a.size();
 	}
 };
 
-template <typename T, unsigned int S0, unsigned int S1>
+template <typename T, std::size_t S0, std::size_t S1>
 sarray<T, S0> gemv(const sarray<T, S0, S1>& A, const sarray<T, S1>& x) {
 	sarray<T, S0> y = 0;
-	for(unsigned int ii = 0; ii < A.size(0); ++ii) {
-		for(unsigned int jj = 0; jj < A.size(1); ++jj) {
+	for(std::size_t ii = 0; ii < A.size(0); ++ii) {
+		for(std::size_t jj = 0; jj < A.size(1); ++jj) {
 			y(ii) += A(ii, jj)*x(jj);
 		}
 	}
@@ -493,17 +492,17 @@ sarray<T, S0> gemv(const sarray<T, S0, S1>& A, const sarray<T, S1>& x) {
 	return y;
 }
 
-template <typename T, unsigned int S0>
+template <typename T, std::size_t S0>
 T dot(const sarray<T, S0>& x, const sarray<T, S0>& y) {
 	T ret = 0;
-	for(unsigned int ii = 0; ii < x.size(0); ++ii) {
+	for(std::size_t ii = 0; ii < x.size(0); ++ii) {
 		ret += x(ii)*y(ii);
 	}
 
 	return ret;
 }
 
-template <typename T, unsigned int S0>
+template <typename T, std::size_t S0>
 T norm1(const sarray<T, S0>& x) {
 	T ret = 0;
 	for(std::size_t ii = 0; ii < S0; ++ii) {
@@ -513,7 +512,7 @@ T norm1(const sarray<T, S0>& x) {
 	return ret;
 }
 
-template <typename T, unsigned int S0>
+template <typename T, std::size_t S0>
 T norm2(const sarray<T, S0>& x) {
 	T ret = 0;
 	for(std::size_t ii = 0; ii < S0; ++ii) {
@@ -523,7 +522,7 @@ T norm2(const sarray<T, S0>& x) {
 	return std::sqrt(ret);
 }
 
-template <typename T, unsigned int S0>
+template <typename T, std::size_t S0>
 T normInf(const sarray<T, S0>& x) {
 	T ret = 0;
 	for(std::size_t ii = 0; ii < S0; ++ii) {
@@ -533,7 +532,7 @@ T normInf(const sarray<T, S0>& x) {
 	return ret;
 }
 
-template <typename T, unsigned int S0, unsigned int S1>
+template <typename T, std::size_t S0, std::size_t S1>
 sarray<T, S0, S1> eye() {
 	sarray<T, S0, S1> ret = 0;
 	for(std::size_t ii = 0; ii < std::min(S0, S1); ++ii) {
@@ -545,7 +544,7 @@ sarray<T, S0, S1> eye() {
 
 } // smt
 
-template <typename T, unsigned int S0>
+template <typename T, std::size_t S0>
 std::ostream& operator<<(std::ostream& s, const smt::sarray<T, S0>& rhs) {
 	s << "[";
 	if(rhs.size() > 0) {
@@ -559,7 +558,7 @@ std::ostream& operator<<(std::ostream& s, const smt::sarray<T, S0>& rhs) {
 	return s;
 }
 
-template <typename T, unsigned int S0, unsigned int S1>
+template <typename T, std::size_t S0, std::size_t S1>
 std::ostream& operator<<(std::ostream& s, const smt::sarray<T, S0, S1>& rhs) {
 	s << "[";
 	if(rhs.size(0) > 0) {
@@ -0,0 +1,89 @@
+//
+// Copyright (c) 2018 Enrico Kaden & University College London
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// * Redistributions of source code must retain the above copyright notice, this
+//   list of conditions and the following disclaimer.
+//
+// * Redistributions in binary form must reproduce the above copyright notice,
+//   this list of conditions and the following disclaimer in the documentation
+//   and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#ifndef _SCHEDULE_H
+#define _SCHEDULE_H
+
+#include <algorithm>
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+#include "debug.h"
+
+namespace smt {
+
+// Range whose work units are visited in the given order, which is a
+// permutation of the indices of the underlying range.
+template <typename Range>
+class orderedrange {
+public:
+	static const unsigned int Dim = Range::Dim;
+
+	orderedrange(const Range& rg, std::vector<std::size_t>&& order):
+		_rg(rg),
+		_order(std::move(order)) {
+		smt::assert(_order.size() == _rg.size());
+	}
+
+	std::size_t size() const {
+		return _order.size();
+	}
+
+	auto index(const std::size_t& ii) const -> decltype(std::declval<const Range&>().index(ii)) {
+		return _rg.index(_order[ii]);
+	}
+
+	~orderedrange() {
+	}
+
+private:
+	const Range _rg;
+	const std::vector<std::size_t> _order;
+};
+
+// Longest-processing-time-first order of the work units of a range, given
+// their estimated costs. As parfor hands out the work units dynamically,
+// this amounts to the greedy LPT schedule, such that the slow work units do
+// not end up at the tail of the loop. Ties keep their original order.
+template <typename Range, typename Costs>
+orderedrange<Range> lpt(const Range& rg, const Costs& costs) {
+	smt::assert(costs.size() == rg.size());
+
+	std::vector<std::size_t> order(rg.size());
+	for(std::size_t ii = 0; ii < order.size(); ++ii) {
+		order[ii] = ii;
+	}
+	std::stable_sort(order.begin(), order.end(), [&](const std::size_t& lhs, const std::size_t& rhs) {
+		return costs[lhs] > costs[rhs];
+	});
+
+	return orderedrange<Range>(rg, std::move(order));
+}
+
+} // smt
+
+#endif // _SCHEDULE_H
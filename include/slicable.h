@@ -35,29 +35,27 @@
 
 namespace smt {
 
-// TODO: unsigned int => std::size_t, signed int => std::ptrdiff_t
-
 class slice {
 public:
-	slice(unsigned int start, unsigned int size, int stride = 1):
+	slice(std::size_t start, std::size_t size, std::ptrdiff_t stride = 1):
 			_start(start), _size(size), _stride(stride) {}
 
-	unsigned int start() const {
+	std::size_t start() const {
 		return _start;
 	}
 
-	unsigned int size() const {
+	std::size_t size() const {
 		return _size;
 	}
 
-	int stride() const {
+	std::ptrdiff_t stride() const {
 		return _stride;
 	}
 
 private:
-	const unsigned int _start;
-	const unsigned int _size;
-	const int _stride;
+	const std::size_t _start;
+	const std::size_t _size;
+	const std::ptrdiff_t _stride;
 };
 
 template <typename C>
@@ -79,19 +77,19 @@ public:
 				>::type
 		>::type ExprT;
 
-		for(unsigned int ii = 0; ii < size(); ++ii) {
+		for(std::size_t ii = 0; ii < size(); ++ii) {
 			operator[](ii) = ExprT(rhs)[ii];
 		}
 
 		return *this;
 	}
 
-	value_type& operator[](const unsigned int& ii) {
-		return _a[start()+ii*stride()];
+	value_type& operator[](const std::size_t& ii) {
+		return _a[start()+std::ptrdiff_t(ii)*stride()];
 	}
 
-	const value_type& operator[](const unsigned int& ii) const {
-		return _a[start()+ii*stride()];
+	const value_type& operator[](const std::size_t& ii) const {
+		return _a[start()+std::ptrdiff_t(ii)*stride()];
 	}
 
 private:
@@ -117,19 +115,19 @@ public:
 				>::type
 		>::type ExprT;
 
-		for(unsigned int ii = 0; ii < size(); ++ii) {
+		for(std::size_t ii = 0; ii < size(); ++ii) {
 			operator[](ii) = ExprT(rhs)[ii];
 		}
 
 		return *this;
 	}
 
-	value_type& operator[](const unsigned int& ii) {
-		return _a[start()+ii*stride()];
+	value_type& operator[](const std::size_t& ii) {
+		return _a[start()+std::ptrdiff_t(ii)*stride()];
 	}
 
-	const value_type& operator[](const unsigned int& ii) const {
-		return _a[start()+ii*stride()];
+	const value_type& operator[](const std::size_t& ii) const {
+		return _a[start()+std::ptrdiff_t(ii)*stride()];
 	}
 
 private:
@@ -0,0 +1,129 @@
+//
+// Copyright (c) 2018 Enrico Kaden & University College London
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// * Redistributions of source code must retain the above copyright notice, this
+//   list of conditions and the following disclaimer.
+//
+// * Redistributions in binary form must reproduce the above copyright notice,
+//   this list of conditions and the following disclaimer in the documentation
+//   and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#ifndef _SMT_H
+#define _SMT_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif // __cplusplus
+
+/*
+ * In-memory interface of libsmt, which fits the models to image buffers
+ * owned by the caller, without any file I/O. The buffers are described by
+ * their sizes and strides, such that both voxel-major and volume-major
+ * layouts are accepted without copying. The strides are given in elements,
+ * and the element (i, j, k, l) is located at
+ * data[i*stride[0]+j*stride[1]+k*stride[2]+l*stride[3]]. A 3-D array has
+ * size[3] == 1. The functions return SMT_SUCCESS or a negative error code.
+ */
+
+#define SMT_API_VERSION 1
+
+#if defined(__GNUC__)
+#define SMT_API __attribute__((visibility("default")))
+#else
+#define SMT_API
+#endif // __GNUC__
+
+#define SMT_SUCCESS 0
+#define SMT_ERROR_ARGUMENT -1
+#define SMT_ERROR_SIZE -2
+#define SMT_ERROR_PROTOCOL -3
+#define SMT_ERROR_MEMORY -4
+#define SMT_ERROR_INTERNAL -5
+
+typedef struct {
+	const float* data;
+	size_t size[4];
+	ptrdiff_t stride[4];
+} smt_array;
+
+typedef struct {
+	float* data;
+	size_t size[4];
+	ptrdiff_t stride[4];
+} smt_mutable_array;
+
+typedef struct {
+	/* Diffusion weighting factors (s/mm²) of the nmeas measurements */
+	const double* bvals;
+	/* Diffusion gradient directions, three components per measurement, which
+	   are required for the gradient deviation only (or NULL) */
+	const double* bvecs;
+	size_t nmeas;
+	/* Diffusion gradient deviation with nine volumes, ordered as in the
+	   NIfTI-1 volumes of the Human Connectome Project (or NULL) */
+	const smt_array* graddev;
+	/* Foreground mask (or NULL) */
+	const smt_array* mask;
+	/* Rician noise, given per voxel (or NULL) or as a scalar (or zero) */
+	const smt_array* rician_map;
+	double rician;
+	/* Maximum diffusivity (mm²/s) */
+	double maxdiff;
+	/* Tolerance (s/mm²) for grouping b-values into shells */
+	double shelltol;
+	/* Model-based estimation of zero b-value signal */
+	int b0;
+	/* Number of threads, or zero for SMT_NUM_THREADS */
+	unsigned int nthreads;
+} smt_options;
+
+/* Default options, as those of the command-line tools */
+SMT_API void smt_default_options(smt_options* options);
+
+/* Description of an error code */
+SMT_API const char* smt_strerror(int code);
+
+/* Microscopic diffusion tensor: the output has six volumes, i.e. the
+   longitudinal and transverse microscopic diffusivity, the microscopic FA,
+   its third power, the microscopic mean diffusivity and the zero b-value
+   signal */
+SMT_API int smt_fitmicrodt(const smt_array* input, const smt_options* options, const smt_mutable_array* output);
+
+/* Multi-compartment microscopic diffusion: the output has five volumes,
+   i.e. the intra-neurite volume fraction, the intrinsic diffusivity, the
+   extra-neurite transverse microscopic diffusivity, the extra-neurite
+   microscopic mean diffusivity and the zero b-value signal */
+SMT_API int smt_fitmcmicro(const smt_array* input, const smt_options* options, const smt_mutable_array* output);
+
+/* Rician noise estimation: the output has two volumes, i.e. the location
+   and the scale of the Rician distribution; only the mask and the number of
+   threads of the options are used */
+SMT_API int smt_ricianfit(const smt_array* input, const smt_options* options, const smt_mutable_array* output);
+
+/* Rician bias correction with the noise of the options: the output has the
+   size of the input, and voxels outside the mask are set to zero */
+SMT_API int smt_ricedebias(const smt_array* input, const smt_options* options, const smt_mutable_array* output);
+
+#ifdef __cplusplus
+}
+#endif // __cplusplus
+
+#endif // _SMT_H
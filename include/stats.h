@@ -0,0 +1,346 @@
+//
+// Copyright (c) 2018 Enrico Kaden & University College London
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// * Redistributions of source code must retain the above copyright notice, this
+//   list of conditions and the following disclaimer.
+//
+// * Redistributions in binary form must reproduce the above copyright notice,
+//   this list of conditions and the following disclaimer in the documentation
+//   and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#ifndef _STATS_H
+#define _STATS_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <fstream>
+#include <limits>
+#include <string>
+#include <vector>
+
+#include "darray.h"
+#include "debug.h"
+#include "finite.h"
+#include "regions.h"
+
+namespace smt {
+
+// Mergeable quantile sketch with relative accuracy alpha (Masson, Rim and
+// Lee: DDSketch, PVLDB 12:2195–2205, 2019). The magnitudes are counted in
+// logarithmically spaced buckets, such that every quantile is returned to
+// within a relative error of alpha, and sketches are merged by adding their
+// bucket counts. The count, sum, minimum and maximum are kept exactly. Values
+// which are not finite are only counted.
+class quantile_sketch {
+public:
+	quantile_sketch(const double& alpha = 0.005):
+		_gamma((1+alpha)/(1-alpha)),
+		_lngamma(std::log(_gamma)),
+		_zero(0),
+		_nonfinite(0),
+		_count(0),
+		_sum(0),
+		_sumsq(0),
+		_min(std::numeric_limits<double>::infinity()),
+		_max(-std::numeric_limits<double>::infinity()) {
+	}
+
+	void insert(const double& x) {
+		if(! smt::isfinite(x)) {
+			++_nonfinite;
+			return;
+		}
+		if(x > _tiny) {
+			_pos.add(key(x), 1);
+		} else if(x < -_tiny) {
+			_neg.add(key(-x), 1);
+		} else {
+			++_zero;
+		}
+		++_count;
+		_sum += x;
+		_sumsq += x*x;
+		_min = std::min(_min, x);
+		_max = std::max(_max, x);
+	}
+
+	void merge(const quantile_sketch& rhs) {
+		smt::assert(_gamma == rhs._gamma);
+		_pos.merge(rhs._pos);
+		_neg.merge(rhs._neg);
+		_zero += rhs._zero;
+		_nonfinite += rhs._nonfinite;
+		_count += rhs._count;
+		_sum += rhs._sum;
+		_sumsq += rhs._sumsq;
+		_min = std::min(_min, rhs._min);
+		_max = std::max(_max, rhs._max);
+	}
+
+	// Number of finite values.
+	std::size_t count() const {
+		return _count;
+	}
+
+	std::size_t nonfinite() const {
+		return _nonfinite;
+	}
+
+	double min() const {
+		return _min;
+	}
+
+	double max() const {
+		return _max;
+	}
+
+	double mean() const {
+		return _sum/_count;
+	}
+
+	double stddev() const {
+		return std::sqrt(std::max(0.0, _sumsq/_count-mean()*mean()));
+	}
+
+	// The q-quantile, 0 <= q <= 1, taken as the value of rank q*(count()-1)
+	// in ascending order.
+	double quantile(const double& q) const {
+		smt::assert(_count > 0 && q >= 0 && q <= 1);
+		const std::size_t rank = static_cast<std::size_t>(q*(_count-1));
+		std::size_t n = 0;
+		double x = 0;
+		if(rank < (n += _neg.total())) {
+			x = -value(_neg.find_descending(rank));
+		} else if(rank < (n += _zero)) {
+			x = 0;
+		} else {
+			x = value(_pos.find_ascending(rank-n));
+		}
+
+		return std::min(std::max(x, _min), _max);
+	}
+
+	// Counts of nbins bins of equal width between min() and max(), with the
+	// values of each bucket placed at its representative value.
+	std::vector<std::size_t> histogram(const std::size_t& nbins) const {
+		std::vector<std::size_t> counts(nbins, 0);
+		const double width = (_max-_min)/nbins;
+		auto bin = [&](const double& x) -> std::size_t {
+			if(! (width > 0)) {
+				return 0;
+			}
+			const double tmp = std::floor((std::min(std::max(x, _min), _max)-_min)/width);
+			return std::min(static_cast<std::size_t>(tmp), nbins-1);
+		};
+		for(std::size_t ii = 0; ii < _neg.counts.size(); ++ii) {
+			counts[bin(-value(_neg.offset+static_cast<int>(ii)))] += _neg.counts[ii];
+		}
+		counts[bin(0)] += _zero;
+		for(std::size_t ii = 0; ii < _pos.counts.size(); ++ii) {
+			counts[bin(value(_pos.offset+static_cast<int>(ii)))] += _pos.counts[ii];
+		}
+
+		return counts;
+	}
+
+	~quantile_sketch() {
+	}
+
+private:
+	// Bucket counts for a contiguous range of keys, grown as needed.
+	struct store {
+		int offset = 0;
+		std::vector<std::size_t> counts;
+
+		void add(const int& key, const std::size_t& n) {
+			if(counts.empty()) {
+				offset = key;
+				counts.assign(1, 0);
+			} else if(key < offset) {
+				counts.insert(counts.begin(), offset-key, 0);
+				offset = key;
+			} else if(key >= offset+static_cast<int>(counts.size())) {
+				counts.resize(key-offset+1, 0);
+			}
+			counts[key-offset] += n;
+		}
+
+		void merge(const store& rhs) {
+			for(std::size_t ii = 0; ii < rhs.counts.size(); ++ii) {
+				if(rhs.counts[ii] > 0) {
+					add(rhs.offset+static_cast<int>(ii), rhs.counts[ii]);
+				}
+			}
+		}
+
+		std::size_t total() const {
+			std::size_t n = 0;
+			for(const std::size_t& c : counts) {
+				n += c;
+			}
+			return n;
+		}
+
+		int find_ascending(const std::size_t& rank) const {
+			std::size_t n = 0;
+			for(std::size_t ii = 0; ii < counts.size(); ++ii) {
+				if(rank < (n += counts[ii])) {
+					return offset+static_cast<int>(ii);
+				}
+			}
+			return offset+static_cast<int>(counts.size())-1;
+		}
+
+		int find_descending(const std::size_t& rank) const {
+			std::size_t n = 0;
+			for(std::size_t ii = counts.size(); ii-- > 0;) {
+				if(rank < (n += counts[ii])) {
+					return offset+static_cast<int>(ii);
+				}
+			}
+			return offset;
+		}
+	};
+
+	static constexpr double _tiny = 1e-30;
+
+	double _gamma;
+	double _lngamma;
+	store _pos;
+	store _neg;
+	std::size_t _zero;
+	std::size_t _nonfinite;
+	std::size_t _count;
+	double _sum;
+	double _sumsq;
+	double _min;
+	double _max;
+
+	int key(const double& x) const {
+		return static_cast<int>(std::ceil(std::log(x)/_lngamma));
+	}
+
+	double value(const int& key) const {
+		return 2*std::pow(_gamma, key)/(_gamma+1);
+	}
+};
+
+// Summary statistics of several parameter maps within the regions of a label
+// image. The values are stored per voxel, rounded to single precision as in
+// the maps, such that the parallel loop neither allocates nor synchronises,
+// and are sketched region by region when written.
+class regionstats {
+public:
+	regionstats() {}
+
+	regionstats(const std::vector<std::string>& names, const smt::regions& regions):
+			_names(names),
+			_regions(&regions),
+			_values(regions.size(0)*regions.size(1)*regions.size(2), names.size()),
+			_filled(regions.size(0)*regions.size(1)*regions.size(2)) {
+		std::fill(std::begin(_filled), std::end(_filled), 0);
+	}
+
+	explicit operator bool() const {
+		return _regions != nullptr;
+	}
+
+	// Sets value x of map mm at voxel (ii, jj, kk), unless the voxel is in no
+	// region.
+	void insert(const std::size_t& ii, const std::size_t& jj, const std::size_t& kk, const std::size_t& mm, const double& x) {
+		if((*_regions)(ii, jj, kk) < _regions->size()) {
+			const std::size_t vv = ii+_regions->size(0)*(jj+_regions->size(1)*kk);
+			_values(vv, mm) = x;
+			_filled(vv) = 1;
+		}
+	}
+
+	bool write(const std::string& path, const std::size_t& nbins = 20) {
+		std::vector<quantile_sketch> sketches(_regions->size()*_names.size());
+		for(std::size_t kk = 0; kk < _regions->size(2); ++kk) {
+			for(std::size_t jj = 0; jj < _regions->size(1); ++jj) {
+				for(std::size_t ii = 0; ii < _regions->size(0); ++ii) {
+					const std::size_t vv = ii+_regions->size(0)*(jj+_regions->size(1)*kk);
+					if(_filled(vv)) {
+						const std::size_t rr = (*_regions)(ii, jj, kk);
+						for(std::size_t mm = 0; mm < _names.size(); ++mm) {
+							sketches[rr*_names.size()+mm].insert(_values(vv, mm));
+						}
+					}
+				}
+			}
+		}
+
+		std::ofstream fout(path.c_str());
+		if(! fout.good()) {
+			smt::error("Unable to write ‘" + path + "’.");
+			return false;
+		}
+		fout.precision(std::numeric_limits<float>::max_digits10);
+		fout << "{" << std::endl;
+		fout << "  \"regions\": [";
+		for(std::size_t rr = 0; rr < _regions->size(); ++rr) {
+			fout << ((rr > 0)? "," : "") << std::endl;
+			fout << "    {\"label\": " << _regions->label(rr) << ", \"voxels\": " << _regions->count(rr);
+			for(std::size_t mm = 0; mm < _names.size(); ++mm) {
+				const quantile_sketch& s = sketches[rr*_names.size()+mm];
+				fout << "," << std::endl << "      \"" << _names[mm] << "\": ";
+				if(s.count() == 0) {
+					if(s.nonfinite() == 0) {
+						fout << "null";
+					} else {
+						fout << "{\"nonfinite\": " << s.nonfinite() << "}";
+					}
+					continue;
+				}
+				fout << "{\"nonfinite\": " << s.nonfinite()
+						<< ", \"mean\": " << s.mean() << ", \"std\": " << s.stddev()
+						<< ", \"min\": " << s.min() << ", \"max\": " << s.max()
+						<< ", \"median\": " << s.quantile(0.5)
+						<< ", \"percentiles\": {\"5\": " << s.quantile(0.05) << ", \"25\": " << s.quantile(0.25)
+						<< ", \"75\": " << s.quantile(0.75) << ", \"95\": " << s.quantile(0.95) << "}"
+						<< ", \"histogram\": [";
+				const std::vector<std::size_t> counts = s.histogram(nbins);
+				for(std::size_t bb = 0; bb < counts.size(); ++bb) {
+					fout << ((bb > 0)? ", " : "") << counts[bb];
+				}
+				fout << "]}";
+			}
+			fout << "}";
+		}
+		fout << std::endl << "  ]" << std::endl;
+		fout << "}" << std::endl;
+
+		return true;
+	}
+
+	~regionstats() {
+	}
+
+private:
+	std::vector<std::string> _names;
+	const smt::regions* _regions = nullptr;
+	smt::darray<float, 2> _values;
+	smt::darray<unsigned char, 1> _filled;
+};
+
+} // smt
+
+#endif // _STATS_H
@@ -0,0 +1,351 @@
+//
+// Copyright (c) 2018 Enrico Kaden & University College London
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// * Redistributions of source code must retain the above copyright notice, this
+//   list of conditions and the following disclaimer.
+//
+// * Redistributions in binary form must reproduce the above copyright notice,
+//   this list of conditions and the following disclaimer in the documentation
+//   and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#ifndef _SVECTOR_H
+#define _SVECTOR_H
+
+#include <algorithm>
+#include <cstddef>
+#include <type_traits>
+
+#include "aligned.h"
+#include "darray.h"
+#include "debug.h"
+#include "indexable.h"
+#include "slicable.h"
+
+namespace smt {
+
+// One-dimensional array that keeps up to N elements in place and only
+// allocates on the heap beyond that, e.g. for per-voxel signals.
+template <typename T, std::size_t N = 512>
+class svector {
+public:
+	typedef T value_type;
+	typedef std::size_t size_type;
+
+	typedef T* iterator;
+	typedef const T* const_iterator;
+
+	typedef T& reference;
+	typedef const T& const_reference;
+
+	svector(): _size(0), _data(_buffer) {
+		static_assert(N > 0, "N > 0");
+	}
+
+	explicit svector(const size_type& s0):
+			_size(s0), _data((s0 > N)? smt::aligned_new<T>(s0) : _buffer) {
+		static_assert(N > 0, "N > 0");
+	}
+
+	svector(const svector<T, N>& rhs): svector(rhs.size()) {
+		std::copy(rhs.begin(), rhs.end(), begin());
+	}
+
+	svector(svector<T, N>&& rhs): _size(rhs._size), _data(_buffer) {
+		if(rhs.is_inline()) {
+			std::copy(rhs.begin(), rhs.end(), begin());
+		} else {
+			_data = rhs._data;
+			rhs._data = rhs._buffer;
+		}
+		rhs._size = 0;
+	}
+
+	~svector() {
+		if(! is_inline()) {
+			smt::aligned_delete(_data, _size);
+		}
+		_data = _buffer;
+		_size = 0;
+	}
+
+	explicit operator bool() const {
+		return size() != 0;
+	}
+
+	operator smt::darray_view<T, 1>() {
+		return smt::darray_view<T, 1>(size(), begin());
+	}
+
+	operator smt::darray_view<const T, 1>() const {
+		return smt::darray_view<const T, 1>(size(), begin());
+	}
+
+	svector<T, N>& operator=(const svector<T, N>& rhs) {
+		smt::assert(size() <= rhs.size());
+		std::copy(rhs.begin(), rhs.begin()+size(), begin());
+
+		return *this;
+	}
+
+	svector<T, N>& operator=(svector<T, N>&& rhs) {
+		if(this != &rhs) {
+			if(rhs.is_inline()) {
+				resize(rhs.size());
+				std::copy(rhs.begin(), rhs.end(), begin());
+			} else {
+				if(! is_inline()) {
+					smt::aligned_delete(_data, _size);
+				}
+				_size = rhs._size;
+				_data = rhs._data;
+				rhs._size = 0;
+				rhs._data = rhs._buffer;
+			}
+		}
+
+		return *this;
+	}
+
+	// See darray::operator= for the evaluation of the expression.
+	template <typename RHS>
+	svector<T, N>& operator=(const RHS& rhs) {
+		typedef typename std::conditional<
+				smt::expr_traits<RHS>::conforms,
+				RHS,
+				typename std::conditional<
+						smt::indexable_traits<RHS>::conforms,
+						smt::constref<RHS>,
+						smt::scalar<RHS>
+				>::type
+		>::type ExprT;
+
+		const ExprT e(rhs);
+		smt::assert(size() <= e.size());
+		T* const data = _data;
+		const std::size_t n = size();
+		for(std::size_t ii = 0; ii < n; ++ii) {
+			data[ii] = e[ii];
+		}
+
+		return *this;
+	}
+
+	template <typename RHS>
+	svector<T, N>& operator+=(const RHS& rhs) {
+		typedef typename std::conditional<
+				smt::expr_traits<RHS>::conforms,
+				RHS,
+				typename std::conditional<
+						smt::indexable_traits<RHS>::conforms,
+						smt::constref<RHS>,
+						smt::scalar<RHS>
+				>::type
+		>::type ExprT;
+
+		const ExprT e(rhs);
+		smt::assert(size() <= e.size());
+		T* const data = _data;
+		const std::size_t n = size();
+		for(std::size_t ii = 0; ii < n; ++ii) {
+			data[ii] += e[ii];
+		}
+
+		return *this;
+	}
+
+	template <typename RHS>
+	svector<T, N>& operator-=(const RHS& rhs) {
+		typedef typename std::conditional<
+				smt::expr_traits<RHS>::conforms,
+				RHS,
+				typename std::conditional<
+						smt::indexable_traits<RHS>::conforms,
+						smt::constref<RHS>,
+						smt::scalar<RHS>
+				>::type
+		>::type ExprT;
+
+		const ExprT e(rhs);
+		smt::assert(size() <= e.size());
+		T* const data = _data;
+		const std::size_t n = size();
+		for(std::size_t ii = 0; ii < n; ++ii) {
+			data[ii] -= e[ii];
+		}
+
+		return *this;
+	}
+
+	template <typename RHS>
+	svector<T, N>& operator*=(const RHS& rhs) {
+		typedef typename std::conditional<
+				smt::expr_traits<RHS>::conforms,
+				RHS,
+				typename std::conditional<
+						smt::indexable_traits<RHS>::conforms,
+						smt::constref<RHS>,
+						smt::scalar<RHS>
+				>::type
+		>::type ExprT;
+
+		const ExprT e(rhs);
+		smt::assert(size() <= e.size());
+		T* const data = _data;
+		const std::size_t n = size();
+		for(std::size_t ii = 0; ii < n; ++ii) {
+			data[ii] *= e[ii];
+		}
+
+		return *this;
+	}
+
+	template <typename RHS>
+	svector<T, N>& operator/=(const RHS& rhs) {
+		typedef typename std::conditional<
+				smt::expr_traits<RHS>::conforms,
+				RHS,
+				typename std::conditional<
+						smt::indexable_traits<RHS>::conforms,
+						smt::constref<RHS>,
+						smt::scalar<RHS>
+				>::type
+		>::type ExprT;
+
+		const ExprT e(rhs);
+		smt::assert(size() <= e.size());
+		T* const data = _data;
+		const std::size_t n = size();
+		for(std::size_t ii = 0; ii < n; ++ii) {
+			data[ii] /= e[ii];
+		}
+
+		return *this;
+	}
+
+	iterator begin() {
+		return _data;
+	}
+
+	const_iterator begin() const {
+		return _data;
+	}
+
+	iterator end() {
+		return _data+size();
+	}
+
+	const_iterator end() const {
+		return _data+size();
+	}
+
+	reference front() {
+		return _data[0];
+	}
+
+	const_reference front() const {
+		return _data[0];
+	}
+
+	reference back() {
+		smt::assert(0 < size());
+		return _data[size()-1];
+	}
+
+	const_reference back() const {
+		smt::assert(0 < size());
+		return _data[size()-1];
+	}
+
+	reference operator[](const size_type& ii) {
+		smt::assert(0 <= ii && ii < size());
+		return _data[ii];
+	}
+
+	const_reference operator[](const size_type& ii) const {
+		smt::assert(0 <= ii && ii < size());
+		return _data[ii];
+	}
+
+	slice_indexable<svector<T, N>> operator[](const slice& s) {
+		return slice_indexable<svector<T, N>>(s, *this);
+	}
+
+	const_slice_indexable<svector<T, N>> operator[](const slice& s) const {
+		return const_slice_indexable<svector<T, N>>(s, *this);
+	}
+
+	reference operator()(const size_type& i0) {
+		smt::assert(0 <= i0 && i0 < size());
+		return _data[i0];
+	}
+
+	const_reference operator()(const size_type& i0) const {
+		smt::assert(0 <= i0 && i0 < size());
+		return _data[i0];
+	}
+
+	void resize(const size_type& s0) {
+		if(! is_inline()) {
+			smt::aligned_delete(_data, _size);
+		}
+		_size = s0;
+		_data = (s0 > N)? smt::aligned_new<T>(s0) : _buffer;
+	}
+
+	size_type size() const {
+		return _size;
+	}
+
+	size_type size(const size_type& ii) const {
+		smt::assert(ii == 0);
+		return _size;
+	}
+
+	bool is_inline() const {
+		return _data == _buffer;
+	}
+
+private:
+	size_type _size;
+	T* _data;
+	T _buffer[N];
+};
+
+template <typename T, std::size_t N>
+struct indexable_traits<svector<T, N>> {
+	static const bool conforms = true;
+
+	static typename svector<T, N>::value_type index(
+			const svector<T, N>& a, const std::size_t& ii) {
+		return a[ii];
+	}
+
+	static typename svector<T, N>::value_type& index(
+			svector<T, N>& a, const std::size_t& ii) {
+		return a[ii];
+	}
+
+	static std::size_t size(const svector<T, N>& a) {
+		return a.size();
+	}
+};
+
+} // smt
+
+#endif // _SVECTOR_H
@@ -0,0 +1,171 @@
+//
+// Copyright (c) 2018 Enrico Kaden & University College London
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// * Redistributions of source code must retain the above copyright notice, this
+//   list of conditions and the following disclaimer.
+//
+// * Redistributions in binary form must reproduce the above copyright notice,
+//   this list of conditions and the following disclaimer in the documentation
+//   and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+
+#ifndef _THREADPOOL_H
+#define _THREADPOOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "trace.h"
+
+namespace smt {
+
+// Worker threads which are started once and reused by successive loops, for
+// long-running processes where spawning the threads of parfor for each
+// request would dominate small workloads.
+class threadpool {
+public:
+	explicit threadpool(const unsigned int& nthreads):
+		_mutex(),
+		_start(),
+		_done(),
+		_job(nullptr),
+		_size(0),
+		_chunk(1),
+		_next(0),
+		_busy(0),
+		_generation(0),
+		_stop(false),
+		_error(),
+		_threads() {
+
+		smt::tracer().reserve(nthreads);
+		_threads.reserve(nthreads);
+		for(unsigned int ii = 0; ii < nthreads; ++ii) {
+			_threads.emplace_back(&threadpool::work, this, ii);
+		}
+	}
+
+	threadpool(const threadpool&) = delete;
+
+	threadpool& operator=(const threadpool&) = delete;
+
+	unsigned int size() const {
+		return _threads.size();
+	}
+
+	// Call f(ii, tt) for ii = 0, ..., n-1 on the workers, where tt is the index
+	// of the worker, and return once all calls have finished. The indices are
+	// fetched in chunks as in parfor. If a call throws, the remaining indices
+	// are skipped and the first exception is rethrown here.
+	void run(const std::size_t& n, const std::function<void(std::size_t, unsigned int)>& f, const std::size_t& chunk = 1) {
+		const smt::trace_scope trace_loop("parfor", n);
+		std::unique_lock<std::mutex> lock(_mutex);
+		_job = &f;
+		_size = n;
+		_chunk = chunk;
+		_next.store(0, std::memory_order_relaxed);
+		_busy = _threads.size();
+		++_generation;
+		_start.notify_all();
+		_done.wait(lock, [this]() { return _busy == 0; });
+		_job = nullptr;
+		if(_error) {
+			std::exception_ptr error = nullptr;
+			std::swap(error, _error);
+			std::rethrow_exception(error);
+		}
+	}
+
+	~threadpool() {
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			_stop = true;
+		}
+		_start.notify_all();
+		for(std::thread& t : _threads) {
+			if(t.joinable()) {
+				t.join();
+			}
+		}
+	}
+private:
+	void work(const unsigned int tt) {
+		std::uint64_t generation = 0;
+		while(true) {
+			const std::function<void(std::size_t, unsigned int)>* job;
+			std::size_t size, chunk;
+			{
+				std::unique_lock<std::mutex> lock(_mutex);
+				_start.wait(lock, [&]() { return _stop || _generation != generation; });
+				if(_stop) {
+					return;
+				}
+				generation = _generation;
+				job = _job;
+				size = _size;
+				chunk = _chunk;
+			}
+
+			std::size_t jj;
+			while((jj = _next.fetch_add(chunk, std::memory_order_relaxed)) < size) {
+				const smt::trace_scope trace_chunk("chunk", jj, tt);
+				try {
+					for(std::size_t kk = 0; kk < chunk && jj+kk < size; ++kk) {
+						(*job)(jj+kk, tt);
+					}
+				} catch(...) {
+					_next.store(size, std::memory_order_relaxed);
+					std::lock_guard<std::mutex> lock(_mutex);
+					if(! _error) {
+						_error = std::current_exception();
+					}
+				}
+			}
+
+			std::lock_guard<std::mutex> lock(_mutex);
+			if(--_busy == 0) {
+				_done.notify_all();
+			}
+		}
+	}
+
+	std::mutex _mutex;
+	std::condition_variable _start;
+	std::condition_variable _done;
+	const std::function<void(std::size_t, unsigned int)>* _job;
+	std::size_t _size;
+	std::size_t _chunk;
+	std::atomic<std::size_t> _next;
+	unsigned int _busy;
+	std::uint64_t _generation;
+	bool _stop;
+	std::exception_ptr _error;
+	std::vector<std::thread> _threads;
+};
+
+} // smt
+
+#endif // _THREADPOOL_H
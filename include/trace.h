@@ -0,0 +1,270 @@
+//
+// Copyright (c) 2018 Enrico Kaden & University College London
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// * Redistributions of source code must retain the above copyright notice, this
+//   list of conditions and the following disclaimer.
+//
+// * Redistributions in binary form must reproduce the above copyright notice,
+//   this list of conditions and the following disclaimer in the documentation
+//   and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#ifndef _TRACE_H
+#define _TRACE_H
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <fstream>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "debug.h"
+#include "env.h"
+
+namespace smt {
+
+// Timeline of the program, which is enabled by setting the environment
+// variable SMT_TRACE to the name of a file, to which the timeline is written
+// in the Chrome trace-event format at exit. Events are recorded into ring
+// buffers without locking; if a buffer overflows, the oldest events are
+// overwritten. The workers of parfor and threadpool record into one buffer
+// per worker index, which is shared by successive loops, such that the
+// timeline shows one lane per worker rather than per loop and thread. Other
+// threads, e.g. the main thread, record into a buffer of their own. If the
+// variable is unset, every hook reduces to a test of the enabled flag.
+class trace {
+public:
+	typedef std::chrono::steady_clock clock;
+
+	// Events per thread, beyond which the oldest events are overwritten.
+	static const std::size_t capacity = 1 << 16;
+
+	struct event {
+		const char* name;
+		std::uint64_t begin;
+		std::uint64_t duration;
+		std::uint64_t arg;
+	};
+
+	class buffer {
+	public:
+		buffer(const std::size_t& tid, const std::string& label):
+			_tid(tid),
+			_label(label),
+			_events(new event[capacity]),
+			_head(0) {
+		}
+
+		void push(const event& e) {
+			const std::size_t head = _head.load(std::memory_order_relaxed);
+			_events[head%capacity] = e;
+			_head.store(head+1, std::memory_order_release);
+		}
+
+		~buffer() {
+		}
+
+	private:
+		friend class trace;
+
+		const std::size_t _tid;
+		const std::string _label;
+		const std::unique_ptr<event[]> _events;
+		std::atomic<std::size_t> _head;
+	};
+
+	trace():
+		_path(smt::getenv("SMT_TRACE")),
+		_enabled(! _path.empty()),
+		_start(clock::now()) {
+	}
+
+	trace(const trace&) = delete;
+
+	trace& operator=(const trace&) = delete;
+
+	bool enabled() const {
+		return _enabled;
+	}
+
+	// Time since the start of the program (ns).
+	std::uint64_t now() const {
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now()-_start).count();
+	}
+
+	// Buffer of the calling thread, which is created on first use.
+	buffer& local() {
+		static thread_local buffer* buf = nullptr;
+		if(buf == nullptr) {
+			std::lock_guard<std::mutex> lock(_mutex);
+			_buffers.emplace_back(new buffer(_buffers.size(), (_buffers.empty())? "main" : "thread " + std::to_string(_buffers.size())));
+			buf = _buffers.back().get();
+		}
+
+		return *buf;
+	}
+
+	// Creates the buffers of workers 0, ..., nworkers-1, if not yet present.
+	// This is called by the thread that starts a loop, before the workers
+	// record any event.
+	void reserve(const unsigned int& nworkers) {
+		if(_enabled) {
+			std::lock_guard<std::mutex> lock(_mutex);
+			while(_workers.size() < nworkers) {
+				_buffers.emplace_back(new buffer(_buffers.size(), "worker " + std::to_string(_workers.size())));
+				_workers.push_back(_buffers.back().get());
+			}
+		}
+	}
+
+	// Buffer of worker tt, as created by reserve.
+	buffer& worker(const unsigned int& tt) {
+		smt::assert(tt < _workers.size());
+		return *_workers[tt];
+	}
+
+	// Copy of name, which lives as long as the trace.
+	const char* intern(const std::string& name) {
+		std::lock_guard<std::mutex> lock(_mutex);
+		_names.push_back(name);
+
+		return _names.back().c_str();
+	}
+
+	~trace() {
+		if(_enabled) {
+			write();
+		}
+	}
+
+private:
+	const std::string _path;
+	const bool _enabled;
+	const clock::time_point _start;
+	std::mutex _mutex;
+	std::vector<std::unique_ptr<buffer>> _buffers;
+	std::vector<buffer*> _workers;
+	std::deque<std::string> _names;
+
+	static std::string quote(const char* s) {
+		std::string ret{"\""};
+		for(; *s != '\0'; ++s) {
+			if(*s == '"' || *s == '\\') {
+				ret += '\\';
+				ret += *s;
+			} else if(static_cast<unsigned char>(*s) < 0x20) {
+				ret += ' ';
+			} else {
+				ret += *s;
+			}
+		}
+		ret += '"';
+
+		return ret;
+	}
+
+	void write() {
+		std::lock_guard<std::mutex> lock(_mutex);
+		std::ofstream fout(_path.c_str());
+		if(! fout.good()) {
+			smt::error("Unable to write ‘" + _path + "’.");
+			return;
+		}
+
+		fout << std::fixed << std::setprecision(3);
+		fout << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [";
+		bool first = true;
+		for(const std::unique_ptr<buffer>& buf : _buffers) {
+			fout << (first? "" : ",") << std::endl;
+			first = false;
+			fout << "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": " << buf->_tid
+					<< ", \"args\": {\"name\": " << quote(buf->_label.c_str()) << "}}";
+			const std::size_t head = buf->_head.load(std::memory_order_acquire);
+			for(std::size_t ii = (head > capacity)? head-capacity : 0; ii < head; ++ii) {
+				const event& e = buf->_events[ii%capacity];
+				fout << "," << std::endl;
+				fout << "{\"name\": " << quote(e.name) << ", \"ph\": \"X\", \"pid\": 1, \"tid\": " << buf->_tid
+						<< ", \"ts\": " << 1e-3*e.begin << ", \"dur\": " << 1e-3*e.duration
+						<< ", \"args\": {\"arg\": " << e.arg << "}}";
+			}
+		}
+		fout << std::endl << "]}" << std::endl;
+	}
+};
+
+smt::trace& tracer() {
+	static smt::trace t;
+	return t;
+}
+
+namespace {
+
+// Starts the clock of the trace with the program.
+const bool trace_init = (smt::tracer(), true);
+
+} // (anonymous)
+
+// Complete event from construction to destruction in the buffer of the
+// calling thread or, if given, of worker tt. The name must outlive the trace,
+// e.g. a string literal or a name returned by trace::intern.
+class trace_scope {
+public:
+	trace_scope(const char* name, const std::uint64_t& arg = 0):
+		_name(name),
+		_arg(arg),
+		_worker(false),
+		_tt(0),
+		_begin(smt::tracer().enabled()? smt::tracer().now() : 0) {
+	}
+
+	trace_scope(const char* name, const std::uint64_t& arg, const unsigned int& tt):
+		_name(name),
+		_arg(arg),
+		_worker(true),
+		_tt(tt),
+		_begin(smt::tracer().enabled()? smt::tracer().now() : 0) {
+	}
+
+	trace_scope(const trace_scope&) = delete;
+
+	trace_scope& operator=(const trace_scope&) = delete;
+
+	~trace_scope() {
+		if(smt::tracer().enabled()) {
+			trace::buffer& buf = _worker? smt::tracer().worker(_tt) : smt::tracer().local();
+			buf.push(trace::event{_name, _begin, smt::tracer().now()-_begin, _arg});
+		}
+	}
+
+private:
+	const char* const _name;
+	const std::uint64_t _arg;
+	const bool _worker;
+	const unsigned int _tt;
+	const std::uint64_t _begin;
+};
+
+} // smt
+
+#endif // _TRACE_H
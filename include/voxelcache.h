@@ -0,0 +1,195 @@
+//
+// Copyright (c) 2018 Enrico Kaden & University College London
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// * Redistributions of source code must retain the above copyright notice, this
+//   list of conditions and the following disclaimer.
+//
+// * Redistributions in binary form must reproduce the above copyright notice,
+//   this list of conditions and the following disclaimer in the documentation
+//   and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#ifndef _VOXELCACHE_H
+#define _VOXELCACHE_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "debug.h"
+#include "sarray.h"
+
+namespace smt {
+
+// Content-addressed store of per-voxel fit results. Each result is filed
+// under a 64-bit hash of everything it depends on, i.e. the voxel signal and
+// the fit settings, so that a later run skips the voxels whose hash it has
+// seen. The table is read once, looked up concurrently and extended by
+// per-thread staging lists, which are merged when the table is written.
+//
+// File layout: the magic "SMTVXC\0\0", the sizes of float_t and of a result
+// as two uint32, the number of entries as uint64, followed by the entries
+// (uint64 hash, N float_t values) in ascending order of their hashes.
+template <typename float_t, std::size_t N>
+class voxelcache {
+public:
+	voxelcache() {}
+
+	voxelcache(const std::string& path, const unsigned int& nthreads):
+			_path(path),
+			_staged(nthreads) {
+		std::FILE* const fin = std::fopen(_path.c_str(), "rb");
+		if(fin == nullptr) {
+			return;
+		}
+		char magic[8];
+		std::uint32_t sizes[2];
+		std::uint64_t n;
+		bool success = std::fread(magic, 1, 8, fin) == 8 && std::memcmp(magic, _magic, 8) == 0
+				&& std::fread(sizes, sizeof(std::uint32_t), 2, fin) == 2 && sizes[0] == sizeof(float_t) && sizes[1] == N
+				&& std::fread(&n, sizeof(std::uint64_t), 1, fin) == 1;
+		if(success) {
+			// The number of entries is checked against the size of the file
+			// before it is trusted with the allocation.
+			const long offset = std::ftell(fin);
+			success = offset >= 0 && std::fseek(fin, 0, SEEK_END) == 0;
+			const long end = success? std::ftell(fin) : -1;
+			success = success && end >= offset && std::fseek(fin, offset, SEEK_SET) == 0
+					&& n == std::uint64_t(end-offset)/sizeof(entry) && n*sizeof(entry) == std::uint64_t(end-offset);
+		}
+		if(success) {
+			_entries.resize(n);
+			success = std::fread(_entries.data(), sizeof(entry), n, fin) == n;
+		}
+		std::fclose(fin);
+		if(! success) {
+			smt::error("‘" + _path + "’ is not a voxel cache.");
+			std::exit(EXIT_FAILURE);
+		}
+		std::sort(_entries.begin(), _entries.end());
+	}
+
+	explicit operator bool() const {
+		return ! _path.empty();
+	}
+
+	std::size_t size() const {
+		return _entries.size();
+	}
+
+	bool find(const std::uint64_t& hash, smt::sarray<float_t, N>& x) const {
+		const auto it = std::lower_bound(_entries.begin(), _entries.end(), entry{hash, {}});
+		if(it == _entries.end() || it->hash != hash) {
+			return false;
+		}
+		for(std::size_t ii = 0; ii < N; ++ii) {
+			x(ii) = it->x[ii];
+		}
+		return true;
+	}
+
+	// Reserves the staging lists for n results in all, e.g. the voxels in the
+	// mask, in equal shares of the threads, such that insert does not allocate
+	// in the parallel loop as long as no thread stages more than its share.
+	void reserve(const std::size_t& n) {
+		for(std::vector<entry>& s : _staged) {
+			s.reserve((n+_staged.size()-1)/_staged.size());
+		}
+	}
+
+	void insert(const std::uint64_t& hash, const smt::sarray<float_t, N>& x, const unsigned int& tt) {
+		entry e;
+		e.hash = hash;
+		for(std::size_t ii = 0; ii < N; ++ii) {
+			e.x[ii] = x(ii);
+		}
+		_staged[tt].push_back(e);
+	}
+
+	// Number of results staged by insert since the table was read.
+	std::size_t staged() const {
+		std::size_t n = 0;
+		for(const std::vector<entry>& s : _staged) {
+			n += s.size();
+		}
+		return n;
+	}
+
+	bool write() {
+		for(std::vector<entry>& s : _staged) {
+			_entries.insert(_entries.end(), s.begin(), s.end());
+			std::vector<entry>().swap(s);
+		}
+		std::sort(_entries.begin(), _entries.end());
+		_entries.erase(std::unique(_entries.begin(), _entries.end(), [](const entry& lhs, const entry& rhs) {
+			return lhs.hash == rhs.hash;
+		}), _entries.end());
+
+		const std::string tmp = _path + ".tmp";
+		std::FILE* const fout = std::fopen(tmp.c_str(), "wb");
+		if(fout == nullptr) {
+			smt::error("Unable to write ‘" + tmp + "’.");
+			return false;
+		}
+		const std::uint32_t sizes[2] = {sizeof(float_t), N};
+		const std::uint64_t n = _entries.size();
+		bool success = std::fwrite(_magic, 1, 8, fout) == 8
+				&& std::fwrite(sizes, sizeof(std::uint32_t), 2, fout) == 2
+				&& std::fwrite(&n, sizeof(std::uint64_t), 1, fout) == 1
+				&& std::fwrite(_entries.data(), sizeof(entry), n, fout) == n;
+		success = (std::fclose(fout) == 0) && success;
+		if(! success || std::rename(tmp.c_str(), _path.c_str()) != 0) {
+			std::remove(tmp.c_str());
+			smt::error("Unable to write ‘" + _path + "’.");
+			return false;
+		}
+
+		return true;
+	}
+
+	~voxelcache() {
+	}
+
+private:
+	struct entry {
+		std::uint64_t hash;
+		float_t x[N];
+
+		bool operator<(const entry& rhs) const {
+			return hash < rhs.hash;
+		}
+	};
+
+	static constexpr char _magic[8] = {'S', 'M', 'T', 'V', 'X', 'C', '\0', '\0'};
+
+	std::string _path;
+	std::vector<entry> _entries;
+	std::vector<std::vector<entry>> _staged;
+};
+
+template <typename float_t, std::size_t N>
+constexpr char voxelcache<float_t, N>::_magic[8];
+
+} // smt
+
+#endif // _VOXELCACHE_H
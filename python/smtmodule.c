@@ -0,0 +1,347 @@
+//
+// Copyright (c) 2018 Enrico Kaden & University College London
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// * Redistributions of source code must retain the above copyright notice, this
+//   list of conditions and the following disclaimer.
+//
+// * Redistributions in binary form must reproduce the above copyright notice,
+//   this list of conditions and the following disclaimer in the documentation
+//   and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+
+#include <string.h>
+
+#include "smt.h"
+
+/*
+ * CPython extension over the in-memory interface of libsmt. The images are
+ * passed as float32 buffers, e.g. NumPy arrays, which are used in place
+ * through the buffer protocol: the axes are x, y, z and, for 4-D arrays, the
+ * measurements, and any strides are honoured, such that both voxel-major and
+ * volume-major arrays are accepted without copying. The global interpreter
+ * lock is released while the voxels are processed.
+ */
+
+/* Buffer of float32 elements with the given number of dimensions, of which
+   the fourth is one for a 3-D buffer. */
+static int get_array(PyObject* obj, const char* name, int ndim, int writable, Py_buffer* view, smt_array* array) {
+	if(PyObject_GetBuffer(obj, view, PyBUF_RECORDS_RO | (writable? PyBUF_WRITABLE : 0)) != 0) {
+		return -1;
+	}
+	if(view->format == NULL || strcmp(view->format, "f") != 0 || view->itemsize != sizeof(float)) {
+		PyErr_Format(PyExc_TypeError, "%s must be an array of float32", name);
+		PyBuffer_Release(view);
+		return -1;
+	}
+	if(view->ndim != ndim) {
+		PyErr_Format(PyExc_ValueError, "%s must have %d dimensions", name, ndim);
+		PyBuffer_Release(view);
+		return -1;
+	}
+	array->data = (const float*)view->buf;
+	for(int ii = 0; ii < 4; ++ii) {
+		array->size[ii] = (ii < ndim)? (size_t)view->shape[ii] : 1;
+		array->stride[ii] = (ii < ndim)? view->strides[ii]/view->itemsize : 0;
+		if(ii < ndim && view->strides[ii]%view->itemsize != 0) {
+			PyErr_Format(PyExc_ValueError, "%s has unaligned strides", name);
+			PyBuffer_Release(view);
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+/* Optional buffer, which is ignored if None. */
+static int get_optional_array(PyObject* obj, const char* name, int ndim, Py_buffer* view, smt_array* array, const smt_array** ptr) {
+	view->obj = NULL;
+	if(obj == NULL || obj == Py_None) {
+		*ptr = NULL;
+		return 0;
+	}
+	if(get_array(obj, name, ndim, 0, view, array) != 0) {
+		return -1;
+	}
+	*ptr = array;
+
+	return 0;
+}
+
+static void release(Py_buffer* view) {
+	if(view->obj != NULL) {
+		PyBuffer_Release(view);
+	}
+}
+
+/* Output of the given size, which is either provided by the caller or
+   allocated as a bytearray and returned as a memoryview in C order. */
+static PyObject* get_output(PyObject* out, const smt_array* input, size_t nvolumes, Py_buffer* view, smt_mutable_array* output) {
+	smt_array tmp;
+	if(out == NULL || out == Py_None) {
+		const size_t n = input->size[0]*input->size[1]*input->size[2]*nvolumes;
+		PyObject* bytes = PyByteArray_FromStringAndSize(NULL, (Py_ssize_t)(n*sizeof(float)));
+		if(bytes == NULL) {
+			return NULL;
+		}
+		PyObject* mview = PyMemoryView_FromObject(bytes);
+		Py_DECREF(bytes);
+		if(mview == NULL) {
+			return NULL;
+		}
+		PyObject* cast = PyObject_CallMethod(mview, "cast", "s(nnnn)", "f", (Py_ssize_t)input->size[0], (Py_ssize_t)input->size[1], (Py_ssize_t)input->size[2], (Py_ssize_t)nvolumes);
+		Py_DECREF(mview);
+		out = cast;
+	} else {
+		Py_INCREF(out);
+	}
+	if(out == NULL) {
+		return NULL;
+	}
+
+	if(get_array(out, "out", 4, 1, view, &tmp) != 0) {
+		Py_DECREF(out);
+		return NULL;
+	}
+	output->data = (float*)tmp.data;
+	memcpy(output->size, tmp.size, sizeof(tmp.size));
+	memcpy(output->stride, tmp.stride, sizeof(tmp.stride));
+
+	return out;
+}
+
+/* Sequence of floats, e.g. the b-values. */
+static double* get_doubles(PyObject* obj, const char* name, size_t* n) {
+	PyObject* seq = PySequence_Fast(obj, name);
+	if(seq == NULL) {
+		return NULL;
+	}
+	const Py_ssize_t len = PySequence_Fast_GET_SIZE(seq);
+	double* ret = (double*)PyMem_Malloc((len > 0? len : 1)*sizeof(double));
+	if(ret == NULL) {
+		Py_DECREF(seq);
+		PyErr_NoMemory();
+		return NULL;
+	}
+	for(Py_ssize_t ii = 0; ii < len; ++ii) {
+		ret[ii] = PyFloat_AsDouble(PySequence_Fast_GET_ITEM(seq, ii));
+	}
+	Py_DECREF(seq);
+	if(PyErr_Occurred()) {
+		PyMem_Free(ret);
+		return NULL;
+	}
+	*n = (size_t)len;
+
+	return ret;
+}
+
+/* Gradient directions, given either as nmeas triples or as three rows of
+   nmeas components in FSL format. */
+static double* get_bvecs(PyObject* obj, size_t nmeas) {
+	PyObject* seq = PySequence_Fast(obj, "bvecs must be a sequence");
+	if(seq == NULL) {
+		return NULL;
+	}
+	const Py_ssize_t len = PySequence_Fast_GET_SIZE(seq);
+	double* ret = (double*)PyMem_Malloc((3*nmeas > 0? 3*nmeas : 1)*sizeof(double));
+	if(ret == NULL) {
+		Py_DECREF(seq);
+		PyErr_NoMemory();
+		return NULL;
+	}
+	const int fsl = (len == 3 && nmeas != 3);
+	if(len != (fsl? 3 : (Py_ssize_t)nmeas)) {
+		PyErr_SetString(PyExc_ValueError, "bvecs does not match bvals");
+		goto fail;
+	}
+	for(Py_ssize_t ii = 0; ii < len; ++ii) {
+		size_t m;
+		double* row = get_doubles(PySequence_Fast_GET_ITEM(seq, ii), "bvecs must be a sequence of sequences", &m);
+		if(row == NULL) {
+			goto fail;
+		}
+		if(m != (fsl? nmeas : 3)) {
+			PyMem_Free(row);
+			PyErr_SetString(PyExc_ValueError, "bvecs does not match bvals");
+			goto fail;
+		}
+		for(size_t jj = 0; jj < m; ++jj) {
+			if(fsl) {
+				ret[3*jj+ii] = row[jj];
+			} else {
+				ret[3*ii+jj] = row[jj];
+			}
+		}
+		PyMem_Free(row);
+	}
+	Py_DECREF(seq);
+
+	return ret;
+
+fail:
+	Py_DECREF(seq);
+	PyMem_Free(ret);
+	return NULL;
+}
+
+typedef int (*smt_function)(const smt_array*, const smt_options*, const smt_mutable_array*);
+
+/* Common argument handling of the four functions. nvolumes is the number of
+   output volumes, or zero for that of the input. */
+static PyObject* call(smt_function fun, size_t nvolumes, int protocol, PyObject* args, PyObject* kwargs) {
+	static char* keywords[] = {"input", "bvals", "bvecs", "graddev", "mask", "rician", "maxdiff", "shelltol", "b0", "nthreads", "out", NULL};
+	PyObject* input_obj = NULL;
+	PyObject* bvals_obj = Py_None;
+	PyObject* bvecs_obj = Py_None;
+	PyObject* graddev_obj = Py_None;
+	PyObject* mask_obj = Py_None;
+	PyObject* rician_obj = Py_None;
+	PyObject* out_obj = Py_None;
+	smt_options options;
+	smt_default_options(&options);
+	int b0 = 0;
+	unsigned int nthreads = 0;
+	if(! PyArg_ParseTupleAndKeywords(args, kwargs, "O|OOOOOddpIO", keywords, &input_obj, &bvals_obj, &bvecs_obj, &graddev_obj, &mask_obj, &rician_obj,
+			&options.maxdiff, &options.shelltol, &b0, &nthreads, &out_obj)) {
+		return NULL;
+	}
+	options.b0 = b0;
+	options.nthreads = nthreads;
+
+	Py_buffer input_view, graddev_view, mask_view, rician_view, out_view;
+	smt_array input, graddev, mask, rician;
+	smt_mutable_array output;
+	double* bvals = NULL;
+	double* bvecs = NULL;
+	PyObject* ret = NULL;
+	graddev_view.obj = mask_view.obj = rician_view.obj = out_view.obj = NULL;
+
+	if(get_array(input_obj, "input", 4, 0, &input_view, &input) != 0) {
+		return NULL;
+	}
+	if(! protocol && (bvals_obj != Py_None || bvecs_obj != Py_None || graddev_obj != Py_None)) {
+		PyErr_SetString(PyExc_TypeError, "bvals, bvecs and graddev are not accepted");
+		goto done;
+	}
+	if(protocol) {
+		if(bvals_obj == Py_None) {
+			PyErr_SetString(PyExc_TypeError, "bvals is required");
+			goto done;
+		}
+		if((bvals = get_doubles(bvals_obj, "bvals must be a sequence", &options.nmeas)) == NULL) {
+			goto done;
+		}
+		options.bvals = bvals;
+		if(bvecs_obj != Py_None) {
+			if((bvecs = get_bvecs(bvecs_obj, options.nmeas)) == NULL) {
+				goto done;
+			}
+			options.bvecs = bvecs;
+		}
+	}
+	if(get_optional_array(graddev_obj, "graddev", 4, &graddev_view, &graddev, &options.graddev) != 0
+			|| get_optional_array(mask_obj, "mask", 3, &mask_view, &mask, &options.mask) != 0) {
+		goto done;
+	}
+	if(rician_obj != Py_None) {
+		if(PyNumber_Check(rician_obj) && ! PyObject_CheckBuffer(rician_obj)) {
+			options.rician = PyFloat_AsDouble(rician_obj);
+			if(PyErr_Occurred()) {
+				goto done;
+			}
+		} else if(get_optional_array(rician_obj, "rician", 3, &rician_view, &rician, &options.rician_map) != 0) {
+			goto done;
+		}
+	}
+
+	if((ret = get_output(out_obj, &input, (nvolumes > 0)? nvolumes : input.size[3], &out_view, &output)) == NULL) {
+		goto done;
+	}
+
+	int code;
+	Py_BEGIN_ALLOW_THREADS
+	code = fun(&input, &options, &output);
+	Py_END_ALLOW_THREADS
+	if(code == SMT_ERROR_MEMORY) {
+		PyErr_NoMemory();
+		Py_CLEAR(ret);
+	} else if(code == SMT_ERROR_INTERNAL) {
+		PyErr_SetString(PyExc_RuntimeError, smt_strerror(code));
+		Py_CLEAR(ret);
+	} else if(code != SMT_SUCCESS) {
+		PyErr_SetString(PyExc_ValueError, smt_strerror(code));
+		Py_CLEAR(ret);
+	}
+
+done:
+	release(&out_view);
+	release(&rician_view);
+	release(&mask_view);
+	release(&graddev_view);
+	PyBuffer_Release(&input_view);
+	PyMem_Free(bvecs);
+	PyMem_Free(bvals);
+	return ret;
+}
+
+static PyObject* py_fitmicrodt(PyObject* self, PyObject* args, PyObject* kwargs) {
+	return call(smt_fitmicrodt, 6, 1, args, kwargs);
+}
+
+static PyObject* py_fitmcmicro(PyObject* self, PyObject* args, PyObject* kwargs) {
+	return call(smt_fitmcmicro, 5, 1, args, kwargs);
+}
+
+static PyObject* py_ricianfit(PyObject* self, PyObject* args, PyObject* kwargs) {
+	return call(smt_ricianfit, 2, 0, args, kwargs);
+}
+
+static PyObject* py_ricedebias(PyObject* self, PyObject* args, PyObject* kwargs) {
+	return call(smt_ricedebias, 0, 0, args, kwargs);
+}
+
+static PyMethodDef methods[] = {
+	{"fitmicrodt", (PyCFunction)(void(*)(void))py_fitmicrodt, METH_VARARGS | METH_KEYWORDS,
+		"fitmicrodt(input, bvals, bvecs=None, graddev=None, mask=None, rician=None, maxdiff=3.05e-3, shelltol=0, b0=False, nthreads=0, out=None)\n\n"
+		"Microscopic diffusion tensor. Returns out, or a new float32 array, with the six volumes of the fitmicrodt tool."},
+	{"fitmcmicro", (PyCFunction)(void(*)(void))py_fitmcmicro, METH_VARARGS | METH_KEYWORDS,
+		"fitmcmicro(input, bvals, bvecs=None, graddev=None, mask=None, rician=None, maxdiff=3.05e-3, shelltol=0, b0=False, nthreads=0, out=None)\n\n"
+		"Multi-compartment microscopic diffusion. Returns out, or a new float32 array, with the five volumes of the fitmcmicro tool."},
+	{"ricianfit", (PyCFunction)(void(*)(void))py_ricianfit, METH_VARARGS | METH_KEYWORDS,
+		"ricianfit(input, *, mask=None, nthreads=0, out=None)\n\n"
+		"Rician noise estimation. Returns out, or a new float32 array, with the location and scale volumes."},
+	{"ricedebias", (PyCFunction)(void(*)(void))py_ricedebias, METH_VARARGS | METH_KEYWORDS,
+		"ricedebias(input, *, mask=None, rician=None, nthreads=0, out=None)\n\n"
+		"Rician bias correction. Returns out, or a new float32 array, of the size of the input."},
+	{NULL, NULL, 0, NULL}
+};
+
+static struct PyModuleDef module = {
+	PyModuleDef_HEAD_INIT,
+	"smt",
+	"Spherical mean technique on in-memory float32 arrays, e.g. NumPy arrays of shape (x, y, z, measurements).",
+	-1,
+	methods
+};
+
+PyMODINIT_FUNC PyInit_smt(void) {
+	return PyModule_Create(&module);
+}
@@ -24,26 +24,39 @@
 // OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 //
 
+#include <chrono>
+#include <cstdint>
 #include <cstdlib>
+#include <fstream>
 #include <iostream>
+#include <limits>
 #include <map>
 #include <sstream>
 #include <string>
 #include <tuple>
+#include <vector>
 
 #include "cartesianrange.h"
 #include "darray.h"
 #include "debug.h"
 #include "diffenc.h"
+#include "finite.h"
 #include "fitmicrodt.h"
 #include "fmt.h"
+#include "hash.h"
 #include "nifti.h"
 #include "opts.h"
 #include "parfor.h"
+#include "preview.h"
+#include "profile.h"
 #include "progress.h"
+#include "regions.h"
 #include "ricedebias.h"
 #include "sarray.h"
+#include "schedule.h"
+#include "stats.h"
 #include "version.h"
+#include "voxelcache.h"
 
 static const char VERSION[] = R"(fitmicrodt)" " " STR(SMT_VERSION_STRING);
 
@@ -90,17 +103,28 @@ Usage:
   fitmicrodt --version
 
 Options:
-  --bvals <bvals>      Diffusion weighting factors (s/mm²) in FSL format
-  --bvecs <bvecs>      Diffusion gradient directions in FSL format
-  --grads <grads>      Diffusion gradients (s/mm²) in MRtrix format
-  --graddev <graddev>  Diffusion gradient deviation [default: none]
-  --mask <mask>        Foreground mask [default: none]
-  --rician <rician>    Rician noise [default: none]
-  --maxdiff <maxdiff>  Maximum diffusivity (mm²/s) [default: 3.05e-3]
-  --b0                 Model-based estimation of zero b-value signal
-  -h, --help           Help screen
-  --license            License information
-  --version            Software version
+  --bvals <bvals>        Diffusion weighting factors (s/mm²) in FSL format
+  --bvecs <bvecs>        Diffusion gradient directions in FSL format
+  --grads <grads>        Diffusion gradients (s/mm²) in MRtrix format
+  --shells <shells>      Shell table of spherical means from smtmean
+  --graddev <graddev>    Diffusion gradient deviation [default: none]
+  --mask <mask>          Foreground mask [default: none]
+  --rician <rician>      Rician noise [default: none]
+  --maxdiff <maxdiff>    Maximum diffusivity (mm²/s) [default: 3.05e-3]
+  --shelltol <shelltol>  Tolerance (s/mm²) for grouping b-values into shells [default: 0]
+  --costmap <costmap>    Fit time (µs) per voxel [default: none]
+  --costs <costs>        Cost estimates per voxel for scheduling [default: none]
+  --labels <labels>      Region labels for a region-wise fit [default: none]
+  --paint <paint>        Region estimates as parameter maps [default: none]
+  --stats <stats>        Summary statistics of the parameter maps in JSON [default: none]
+  --tissue <tissue>      Tissue labels for the summary statistics [default: none]
+  --cache <cache>        Per-voxel result cache for incremental re-fits [default: none]
+  --preview <preview>    Preview fitted at every k-th voxel [default: 1]
+  --multires             Coarse-to-fine fit initialised from 2×2×2 block means
+  --b0                   Model-based estimation of zero b-value signal
+  -h, --help             Help screen
+  --license              License information
+  --version              Software version
 )";
 
 template <typename float_t>
@@ -115,6 +139,19 @@ smt::diffenc<float_t> read_diffenc(std::map<std::string, docopt::value>& args) {
 	}
 }
 
+template <typename float_t>
+smt::shells<float_t> read_shells(std::map<std::string, docopt::value>& args) {
+	if(args["--shells"]) {
+		if(args["--bvals"] || args["--bvecs"] || args["--grads"]) {
+			smt::error("Either --bvals <bvals>, --bvecs <bvecs>, --grads <grads> or --shells <shells> are required.");
+			std::exit(EXIT_FAILURE);
+		}
+		return smt::shells<float_t>(args["--shells"].asString());
+	} else {
+		return smt::shells<float_t>();
+	}
+}
+
 template <typename float_t>
 smt::inifti<float_t, 4> read_graddev(std::map<std::string, docopt::value>& args) {
 	if(args["--graddev"] && args["--graddev"].asString() != "none") {
@@ -133,6 +170,33 @@ smt::inifti<float_t, 3> read_mask(std::map<std::string, docopt::value>& args) {
 	}
 }
 
+template <typename float_t>
+smt::inifti<float_t, 3> read_costs(std::map<std::string, docopt::value>& args) {
+	if(args["--costs"] && args["--costs"].asString() != "none") {
+		return smt::inifti<float_t, 3>(args["--costs"].asString());
+	} else {
+		return smt::inifti<float_t, 3>();
+	}
+}
+
+template <typename float_t>
+smt::inifti<float_t, 3> read_labels(std::map<std::string, docopt::value>& args) {
+	if(args["--labels"] && args["--labels"].asString() != "none") {
+		return smt::inifti<float_t, 3>(args["--labels"].asString());
+	} else {
+		return smt::inifti<float_t, 3>();
+	}
+}
+
+template <typename float_t>
+smt::inifti<float_t, 3> read_tissue(std::map<std::string, docopt::value>& args) {
+	if(args["--tissue"] && args["--tissue"].asString() != "none") {
+		return smt::inifti<float_t, 3>(args["--tissue"].asString());
+	} else {
+		return smt::inifti<float_t, 3>();
+	}
+}
+
 template <typename float_t>
 std::tuple<float_t, smt::inifti<float_t, 3>> read_rician(std::map<std::string, docopt::value>& args) {
 	if(args["--rician"] && args["--rician"].asString() != "none") {
@@ -165,20 +229,34 @@ float_t read_maxdiff(std::map<std::string, docopt::value>& args) {
 }
 
 template <typename float_t>
-smt::sarray<float_t, 3, 3> reshape_graddev(const smt::darray<float_t, 1>& g) {
-	smt::assert(g.size(0) == 9);
-	smt::sarray<float_t, 3, 3> G;
-	G(0, 0) = g(0);
-	G(1, 0) = g(1);
-	G(2, 0) = g(2);
-	G(0, 1) = g(3);
-	G(1, 1) = g(4);
-	G(2, 1) = g(5);
-	G(0, 2) = g(6);
-	G(1, 2) = g(7);
-	G(2, 2) = g(8);
-
-	return G;
+float_t read_shelltol(std::map<std::string, docopt::value>& args) {
+	if(args["--shelltol"]) {
+		std::istringstream sin(args["--shelltol"].asString());
+		float_t shelltol;
+		if(! (sin >> shelltol) || shelltol < float_t(0)) {
+			smt::error("Unable to parse ‘" + args["--shelltol"].asString() + "’.");
+			std::exit(EXIT_FAILURE);
+		} else {
+			return shelltol;
+		}
+	} else {
+		return float_t(0);
+	}
+}
+
+std::size_t read_preview(std::map<std::string, docopt::value>& args) {
+	if(args["--preview"]) {
+		std::istringstream sin(args["--preview"].asString());
+		long long int preview;
+		if(! (sin >> preview) || preview < 1 || ! sin.eof()) {
+			smt::error("Unable to parse ‘" + args["--preview"].asString() + "’.");
+			std::exit(EXIT_FAILURE);
+		} else {
+			return preview;
+		}
+	} else {
+		return 1;
+	}
 }
 
 int main(int argc, const char** argv) {
@@ -195,9 +273,13 @@ int main(int argc, const char** argv) {
 
 	const smt::inifti<float_t, 4> input(args["<input>"].asString());
 
-	const smt::diffenc<float_t> dw = read_diffenc<float_t>(args);
+	// Spherical means from smtmean hold one measurement per shell.
+	const smt::shells<float_t> means = read_shells<float_t>(args);
+	const smt::diffenc<float_t> dw = means? smt::diffenc<float_t>(means.bvalues.begin(), nullptr, means.size()) : read_diffenc<float_t>(args);
 	if(input.size(3) != dw.mapping.size(0)) {
-		if(args["--bvals"] && args["--bvecs"] && !args["--grads"]) {
+		if(means) {
+			smt::error("‘" + args["<input>"].asString() + "’ and ‘" + args["--shells"].asString() + "’ do not match.");
+		} else if(args["--bvals"] && args["--bvecs"] && !args["--grads"]) {
 			smt::error("‘" + args["<input>"].asString() + "’ and ‘" + args["--bvals"].asString() + "’ and/or ‘" + args["--bvecs"].asString() + "’ do not match.");
 		} else if(!args["--bvals"] && !args["--bvecs"] && args["--grads"]) {
 			smt::error("‘" + args["<input>"].asString() + "’ and ‘" + args["--grads"].asString() + "’ do not match.");
@@ -209,6 +291,10 @@ int main(int argc, const char** argv) {
 
 	const smt::inifti<float_t, 4> graddev = read_graddev<float_t>(args);
 	if(graddev) {
+		if(means) {
+			smt::error("--graddev cannot be combined with --shells.");
+			return EXIT_FAILURE;
+		}
 		if(input.size(0) != graddev.size(0) || input.size(1) != graddev.size(1) || input.size(2) != graddev.size(2)) {
 			smt::error("‘" + args["<input>"].asString() + "’ and ‘" + args["--graddev"].asString() + "’ do not match.");
 			return EXIT_FAILURE;
@@ -243,6 +329,54 @@ int main(int argc, const char** argv) {
 		}
 	}
 
+	const smt::inifti<float_t, 3> costs = read_costs<float_t>(args);
+	if(costs) {
+		if(input.size(0) != costs.size(0) || input.size(1) != costs.size(1) || input.size(2) != costs.size(2)) {
+			smt::error("‘" + args["<input>"].asString() + "’ and ‘" + args["--costs"].asString() + "’ do not match.");
+			return EXIT_FAILURE;
+		}
+		if(input.pixsize(0) != costs.pixsize(0) || input.pixsize(1) != costs.pixsize(1) || input.pixsize(2) != costs.pixsize(2)) {
+			smt::error("The pixel sizes of ‘" + args["<input>"].asString() + "’ and ‘" + args["--costs"].asString() + "’ do not match.");
+			return EXIT_FAILURE;
+		}
+		if(! input.has_equal_spatial_coords(costs)) {
+			smt::error("The coordinate systems of ‘" + args["<input>"].asString() + "’ and ‘" + args["--costs"].asString() + "’ do not match.");
+			return EXIT_FAILURE;
+		}
+	}
+
+	const smt::inifti<float_t, 3> labels = read_labels<float_t>(args);
+	if(labels) {
+		if(input.size(0) != labels.size(0) || input.size(1) != labels.size(1) || input.size(2) != labels.size(2)) {
+			smt::error("‘" + args["<input>"].asString() + "’ and ‘" + args["--labels"].asString() + "’ do not match.");
+			return EXIT_FAILURE;
+		}
+		if(input.pixsize(0) != labels.pixsize(0) || input.pixsize(1) != labels.pixsize(1) || input.pixsize(2) != labels.pixsize(2)) {
+			smt::error("The pixel sizes of ‘" + args["<input>"].asString() + "’ and ‘" + args["--labels"].asString() + "’ do not match.");
+			return EXIT_FAILURE;
+		}
+		if(! input.has_equal_spatial_coords(labels)) {
+			smt::error("The coordinate systems of ‘" + args["<input>"].asString() + "’ and ‘" + args["--labels"].asString() + "’ do not match.");
+			return EXIT_FAILURE;
+		}
+	}
+
+	const smt::inifti<float_t, 3> tissue = read_tissue<float_t>(args);
+	if(tissue) {
+		if(input.size(0) != tissue.size(0) || input.size(1) != tissue.size(1) || input.size(2) != tissue.size(2)) {
+			smt::error("‘" + args["<input>"].asString() + "’ and ‘" + args["--tissue"].asString() + "’ do not match.");
+			return EXIT_FAILURE;
+		}
+		if(input.pixsize(0) != tissue.pixsize(0) || input.pixsize(1) != tissue.pixsize(1) || input.pixsize(2) != tissue.pixsize(2)) {
+			smt::error("The pixel sizes of ‘" + args["<input>"].asString() + "’ and ‘" + args["--tissue"].asString() + "’ do not match.");
+			return EXIT_FAILURE;
+		}
+		if(! input.has_equal_spatial_coords(tissue)) {
+			smt::error("The coordinate systems of ‘" + args["<input>"].asString() + "’ and ‘" + args["--tissue"].asString() + "’ do not match.");
+			return EXIT_FAILURE;
+		}
+	}
+
 	const std::tuple<float_t, smt::inifti<float_t, 3>> rician = read_rician<float_t>(args);
 	if(std::get<1>(rician)) {
 		if(input.size(0) != std::get<1>(rician).size(0) || input.size(1) != std::get<1>(rician).size(1) || input.size(2) != std::get<1>(rician).size(2)) {
@@ -261,23 +395,102 @@ int main(int argc, const char** argv) {
 
 	const float_t maxdiff = read_maxdiff<float_t>(args);
 
+	const float_t shelltol = read_shelltol<float_t>(args);
+	const smt::shells<float_t> shells = means? means : smt::shells<float_t>(dw, shelltol);
+
 	const bool b0 = args["--b0"].asBool();
 
-	const int split = smt::is_format_string(args["<output>"].asString());
+	const std::size_t preview = read_preview(args);
+	if(preview > 1 && labels) {
+		smt::error("--labels and --preview cannot be combined.");
+		return EXIT_FAILURE;
+	}
+
+	const bool multires = args["--multires"].asBool();
+	if(multires && labels) {
+		smt::error("--labels and --multires cannot be combined.");
+		return EXIT_FAILURE;
+	}
+
+	// With --labels, <output> receives the table of the region estimates, and
+	// the parameter maps, if any, are written to --paint. Otherwise, no maps
+	// are written if <output> is none, e.g. when only --stats is needed.
+	const smt::regions regions = labels? smt::regions(labels, mask) : smt::regions();
+	const std::string output_name = labels? args["--paint"].asString() : args["<output>"].asString();
+	const bool maps = output_name != "none";
+
+	const bool summary = args["--stats"] && args["--stats"].asString() != "none";
+	if(summary && labels) {
+		smt::error("--labels and --stats cannot be combined.");
+		return EXIT_FAILURE;
+	}
+	const smt::regions tissue_regions = (! summary)? smt::regions() : (tissue? smt::regions(tissue, mask) : smt::regions(input.size(0), input.size(1), input.size(2), mask));
+
+	const int split = maps? smt::is_format_string(output_name) : 0;
 	if(split < 0) {
-		smt::error("‘" + args["<output>"].asString() + "’ is malformed.");
+		smt::error("‘" + output_name + "’ is malformed.");
 		std::exit(EXIT_FAILURE);
 	}
 
 	// Processing
 
-	smt::onifti<float, 3> output_long = (split > 0)? smt::onifti<float, 3>(smt::format_string(args["<output>"].asString(), "long"), input, input.size(0), input.size(1), input.size(2)) : smt::onifti<float, 3>();
-	smt::onifti<float, 3> output_trans = (split > 0)? smt::onifti<float, 3>(smt::format_string(args["<output>"].asString(), "trans"), input, input.size(0), input.size(1), input.size(2)) : smt::onifti<float, 3>();
-	smt::onifti<float, 3> output_fa = (split > 0)? smt::onifti<float, 3>(smt::format_string(args["<output>"].asString(), "fa"), input, input.size(0), input.size(1), input.size(2)) : smt::onifti<float, 3>();
-	smt::onifti<float, 3> output_fapow3 = (split > 0)? smt::onifti<float, 3>(smt::format_string(args["<output>"].asString(), "fapow3"), input, input.size(0), input.size(1), input.size(2)) : smt::onifti<float, 3>();
-	smt::onifti<float, 3> output_md = (split > 0)? smt::onifti<float, 3>(smt::format_string(args["<output>"].asString(), "md"), input, input.size(0), input.size(1), input.size(2)) : smt::onifti<float, 3>();
-	smt::onifti<float, 3> output_b0 = (split > 0)? smt::onifti<float, 3>(smt::format_string(args["<output>"].asString(), "b0"), input, input.size(0), input.size(1), input.size(2)) : smt::onifti<float, 3>();
-	smt::onifti<float, 4> output = (split > 0)? smt::onifti<float, 4>() : smt::onifti<float, 4>(smt::format_string(args["<output>"].asString()), input, input.size(0), input.size(1), input.size(2), 6);
+	const unsigned int nthreads = smt::threads();
+	const std::size_t chunk = 1;
+
+	// Per-thread scratch space, such that the voxel loop does not allocate.
+	smt::darray<float_t, 2> input_buf(nthreads, input.size(3));
+	smt::darray<float_t, 2> graddev_buf(nthreads, 9*input.size(0));
+	smt::darray<float_t, 2> scales_buf(nthreads, dw.mapping.size()*input.size(0));
+	smt::darray<float_t, 2> scales_voxel_buf(nthreads, dw.mapping.size());
+
+	// The cached results are filed under a hash of the voxel signal, chained
+	// with a hash of the software version and of the fit settings. With
+	// --multires, the initial values of the voxel are hashed too, since they
+	// depend on the neighbours in the mask and the solver converges to
+	// slightly different estimates from other initial values.
+	smt::voxelcache<float_t, 3> cache = (args["--cache"] && args["--cache"].asString() != "none")? smt::voxelcache<float_t, 3>(args["--cache"].asString(), nthreads) : smt::voxelcache<float_t, 3>();
+	std::uint64_t cache_seed = smt::hash64(VERSION, sizeof(VERSION));
+	cache_seed = smt::hash64(dw.bvalues.begin(), dw.bvalues.size()*sizeof(float_t), cache_seed);
+	cache_seed = smt::hash64(dw.gradients.begin(), dw.gradients.size()*sizeof(smt::sarray<float_t, 3>), cache_seed);
+	cache_seed = smt::hash64(dw.mapping.begin(), dw.mapping.size()*sizeof(std::size_t), cache_seed);
+	cache_seed = smt::hash64(shells.counts.begin(), shells.counts.size()*sizeof(std::size_t), cache_seed);
+	const float_t cache_settings[4] = {shelltol, maxdiff, float_t(b0), std::get<0>(rician)};
+	cache_seed = smt::hash64(cache_settings, sizeof(cache_settings), cache_seed);
+
+	smt::regionstats stats = summary? smt::regionstats({"long", "trans", "fa", "fapow3", "md", "b0"}, tissue_regions) : smt::regionstats();
+
+	// Region-wise fit to the mean signal of each region.
+	smt::darray<smt::sarray<float_t, 3>, 1> regions_fit(regions.size());
+	if(regions) {
+		smt::fitregions(input, dw, graddev, rician, regions, nthreads, chunk, [&](const std::size_t rr, const smt::darray_view<float_t, 1>& y, const smt::darray_view<float_t, 1>& scales) {
+			regions_fit(rr) = scales? smt::fitmicrodt<float_t>(y, shells, scales, maxdiff, b0) : smt::fitmicrodt<float_t>(y, shells, maxdiff, b0);
+		});
+
+		std::ofstream fout(args["<output>"].asString().c_str());
+		if(! fout.good()) {
+			smt::error("Unable to write ‘" + args["<output>"].asString() + "’.");
+			return EXIT_FAILURE;
+		}
+		fout.precision(std::numeric_limits<float>::max_digits10);
+		fout << "label\tvoxels\tlong\ttrans\tfa\tfapow3\tmd\tb0" << std::endl;
+		for(std::size_t rr = 0; rr < regions.size(); ++rr) {
+			const smt::sarray<float_t, 3>& fit = regions_fit(rr);
+			fout << regions.label(rr) << "\t" << regions.count(rr) << "\t" << static_cast<float>(fit(0)) << "\t" << static_cast<float>(fit(1)) << "\t" << static_cast<float>(smt::microfa(fit(0), fit(1))) << "\t" << static_cast<float>(std::pow(smt::microfa(fit(0), fit(1)), 3)) << "\t" << static_cast<float>(smt::micromd(fit(0), fit(1))) << "\t" << static_cast<float>(fit(2)) << std::endl;
+		}
+
+		if(! maps) {
+			return EXIT_SUCCESS;
+		}
+	}
+
+	smt::onifti<float, 3> output_long = (split > 0)? smt::onifti<float, 3>(smt::format_string(output_name, "long"), input, input.size(0), input.size(1), input.size(2)) : smt::onifti<float, 3>();
+	smt::onifti<float, 3> output_trans = (split > 0)? smt::onifti<float, 3>(smt::format_string(output_name, "trans"), input, input.size(0), input.size(1), input.size(2)) : smt::onifti<float, 3>();
+	smt::onifti<float, 3> output_fa = (split > 0)? smt::onifti<float, 3>(smt::format_string(output_name, "fa"), input, input.size(0), input.size(1), input.size(2)) : smt::onifti<float, 3>();
+	smt::onifti<float, 3> output_fapow3 = (split > 0)? smt::onifti<float, 3>(smt::format_string(output_name, "fapow3"), input, input.size(0), input.size(1), input.size(2)) : smt::onifti<float, 3>();
+	smt::onifti<float, 3> output_md = (split > 0)? smt::onifti<float, 3>(smt::format_string(output_name, "md"), input, input.size(0), input.size(1), input.size(2)) : smt::onifti<float, 3>();
+	smt::onifti<float, 3> output_b0 = (split > 0)? smt::onifti<float, 3>(smt::format_string(output_name, "b0"), input, input.size(0), input.size(1), input.size(2)) : smt::onifti<float, 3>();
+	smt::onifti<float, 4> output = (split > 0 || ! maps)? smt::onifti<float, 4>() : smt::onifti<float, 4>(smt::format_string(output_name), input, input.size(0), input.size(1), input.size(2), 6);
+	smt::onifti<float, 3> output_cost = (args["--costmap"] && args["--costmap"].asString() != "none")? smt::onifti<float, 3>(args["--costmap"].asString(), input, input.size(0), input.size(1), input.size(2)) : smt::onifti<float, 3>();
 
 	if(split > 0) {
 		output_long.cal(0, maxdiff);
@@ -287,63 +500,214 @@ int main(int argc, const char** argv) {
 		output_md.cal(0, maxdiff);
 	}
 
-	const unsigned int nthreads = smt::threads();
-	const std::size_t chunk = 10;
+	// With --preview, only the voxels on a grid with a spacing of k voxels are
+	// fitted, and the other voxels are interpolated from them afterwards.
+	const smt::previewgrid grid = (preview > 1)? smt::previewgrid(input.size(0), input.size(1), input.size(2), preview) : smt::previewgrid();
+	smt::darray<smt::sarray<float_t, 3>, 3> grid_fit(grid.size(0), grid.size(1), grid.size(2));
+	smt::darray<unsigned char, 3> grid_valid(grid.size(0), grid.size(1), grid.size(2));
+	std::fill(std::begin(grid_valid), std::end(grid_valid), 0);
+	bool grid_fill = false;
+	if(grid) {
+		const std::string preview_descrip = "SMT preview (every " + std::to_string(preview) + " voxels) - https://ekaden.github.io";
+		output_long.descrip(preview_descrip);
+		output_trans.descrip(preview_descrip);
+		output_fa.descrip(preview_descrip);
+		output_fapow3.descrip(preview_descrip);
+		output_md.descrip(preview_descrip);
+		output_b0.descrip(preview_descrip);
+		output.descrip(preview_descrip);
+	}
+
+	// With --multires, the signals are first averaged over blocks of 2×2×2
+	// voxels within the mask, and the model is fitted on this coarse grid. The
+	// estimates of the block then serve as the initial values of the fit to
+	// each of its voxels, which saves some of the iterations at the full
+	// resolution. As for --labels, the mean signal is taken after the Rician
+	// bias correction, and the scale factors of the b-values are averaged
+	// likewise.
+	smt::darray<smt::sarray<float_t, 3>, 3> coarse_fit(multires? (input.size(0)+1)/2 : 0, (input.size(1)+1)/2, (input.size(2)+1)/2);
+	if(multires) {
+		// The coarse estimates are only the initial values of the fit, for which
+		// a loose tolerance suffices.
+		const float_t coarse_tol = 1e-2;
+		smt::fitblocks(input, dw, graddev, rician, mask, nthreads, chunk, [&](const std::size_t ci, const std::size_t cj, const std::size_t ck, const smt::darray_view<float_t, 1>& y, const smt::darray_view<float_t, 1>& scales) {
+			coarse_fit(ci, cj, ck) = scales? smt::fitmicrodt<float_t>(y, shells, scales, maxdiff, b0, coarse_tol) : smt::fitmicrodt<float_t>(y, shells, maxdiff, b0, coarse_tol);
+		});
+	}
+
+	// The rows are processed longest first, given the cost map of a previous
+	// run or, failing that, the number of foreground voxels per row. Costs
+	// that are negative or not finite count as one voxel, which keeps the
+	// order of the rows well-defined.
+	const smt::cartesianrange<2> rows(input.size(2), input.size(1));
+	smt::darray<double, 1> rows_cost(rows.size());
+	std::size_t nforeground = 0;
+	for(std::size_t rr = 0; rr < rows.size(); ++rr) {
+		std::size_t kk, jj;
+		std::tie(kk, jj) = rows.index(rr);
+		rows_cost(rr) = 0;
+		for(std::size_t ii = 0; ii < input.size(0); ++ii) {
+			if((! mask) || mask(ii, jj, kk) > 0) {
+				const float_t cost = costs? costs(ii, jj, kk) : 1;
+				rows_cost(rr) += (smt::isfinite(cost) && cost >= 0)? cost : 1;
+				++nforeground;
+			}
+		}
+	}
+	if(cache) {
+		cache.reserve(nforeground);
+	}
+
+	smt::profile_section profile_gather("gather", nthreads);
+	smt::profile_section profile_fit("fit", nthreads);
+	smt::profile_stage profile_process("process", input.size(0)*input.size(1)*input.size(2));
 
 	smt::progress p{input.size(0)*input.size(1)*input.size(2), nthreads, "fitmicrodt"};
-	smt::parfor(smt::cartesianrange<3>(input.size(2), input.size(1), input.size(0)), [&](const std::size_t kk, const std::size_t jj, const std::size_t ii, const unsigned int tt = 0) {
-		if((! mask) || mask(ii, jj, kk) > 0) {
-			smt::darray<float_t, 1> input_tmp = input(ii, jj, kk, smt::slice(0, input.size(3)));
-			if(std::get<1>(rician)) {
-				for(std::size_t ll = 0; ll < input.size(3); ++ll) {
-					input_tmp(ll) = smt::ricedebias(input_tmp(ll), std::get<1>(rician)(ii, jj, kk));
-				}
-			} else {
-				if(std::get<0>(rician) > float_t(0)) {
-					for(std::size_t ll = 0; ll < input.size(3); ++ll) {
-						input_tmp(ll) = smt::ricedebias(input_tmp(ll), std::get<0>(rician));
-					}
+	const auto process_row = [&](const std::size_t kk, const std::size_t jj, const unsigned int tt = 0) {
+		// The gradient deviation is evaluated in one batch for the voxels of
+		// the row.
+		const smt::darray_view<float_t, 2> scales_row(dw.mapping.size(), input.size(0), scales_buf.begin()+tt*dw.mapping.size()*input.size(0));
+		if(graddev && ! regions) {
+			const smt::darray_view<float_t, 2> graddev_row(9, input.size(0), graddev_buf.begin()+tt*9*input.size(0));
+			for(std::size_t ll = 0; ll < 9; ++ll) {
+				for(std::size_t ii = 0; ii < input.size(0); ++ii) {
+					graddev_row(ll, ii) = graddev(ii, jj, kk, ll);
 				}
 			}
+			dw.scales_graddev(graddev_row, scales_row);
+		}
 
-			const smt::diffenc<float_t> dw_tmp = (graddev)?
-					smt::diffenc<float_t>(dw, reshape_graddev(graddev(ii, jj, kk, smt::slice(0, 9)))) : dw;
-
-			const smt::sarray<float_t, 3> fit = smt::fitmicrodt(input_tmp, dw_tmp, maxdiff, b0);
-			if(split > 0) {
-				output_long(ii, jj, kk) = fit(0);
-				output_trans(ii, jj, kk) = fit(1);
-				output_fa(ii, jj, kk) = smt::microfa(fit(0), fit(1));
-				output_fapow3(ii, jj, kk) = std::pow(smt::microfa(fit(0), fit(1)), 3);
-				output_md(ii, jj, kk) = smt::micromd(fit(0), fit(1));
-				output_b0(ii, jj, kk) = fit(2);
-			} else {
-				output(ii, jj, kk, 0) = fit(0);
-				output(ii, jj, kk, 1) = fit(1);
-				output(ii, jj, kk, 2) = smt::microfa(fit(0), fit(1));
-				output(ii, jj, kk, 3) = std::pow(smt::microfa(fit(0), fit(1)), 3);
-				output(ii, jj, kk, 4) = smt::micromd(fit(0), fit(1));
-				output(ii, jj, kk, 5) = fit(2);
+		for(std::size_t ii = 0; ii < input.size(0); ++ii) {
+			if(grid && grid.is_node(ii, jj, kk) == grid_fill) {
+				continue;
 			}
-		} else {
-			if(split > 0) {
-				output_long(ii, jj, kk) = 0;
-				output_trans(ii, jj, kk) = 0;
-				output_fa(ii, jj, kk) = 0;
-				output_fapow3(ii, jj, kk) = 0;
-				output_md(ii, jj, kk) = 0;
-				output_b0(ii, jj, kk) = 0;
+			const std::size_t rr = regions? regions(ii, jj, kk) : 0;
+			if(regions? rr < regions.size() : (! mask) || mask(ii, jj, kk) > 0) {
+				const std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+				smt::sarray<float_t, 3> fit;
+				if(regions) {
+					fit = regions_fit(rr);
+				} else if(! grid_fill || ! grid.interpolate(ii, jj, kk, grid_fit, grid_valid, fit)) {
+					smt::profile_timer timer_gather(profile_gather, tt);
+					const smt::darray_view<float_t, 1> input_tmp(input.size(3), input_buf.begin()+tt*input.size(3));
+					input.gather(ii, jj, kk, smt::slice(0, input.size(3)), input_tmp);
+					std::uint64_t hash = 0;
+					if(cache) {
+						hash = smt::hash64(input_tmp.begin(), input.size(3)*sizeof(float_t), cache_seed);
+						if(graddev) {
+							smt::sarray<float_t, 9> graddev_tmp;
+							for(std::size_t ll = 0; ll < 9; ++ll) {
+								graddev_tmp(ll) = graddev(ii, jj, kk, ll);
+							}
+							hash = smt::hash64(graddev_tmp.begin(), 9*sizeof(float_t), hash);
+						}
+						if(std::get<1>(rician)) {
+							const float_t sigma = std::get<1>(rician)(ii, jj, kk);
+							hash = smt::hash64(&sigma, sizeof(float_t), hash);
+						}
+						if(multires) {
+							hash = smt::hash64(coarse_fit(ii/2, jj/2, kk/2).begin(), 3*sizeof(float_t), hash);
+						}
+					}
+					if(std::get<1>(rician)) {
+						for(std::size_t ll = 0; ll < input.size(3); ++ll) {
+							input_tmp(ll) = smt::ricedebias(input_tmp(ll), std::get<1>(rician)(ii, jj, kk));
+						}
+					} else {
+						if(std::get<0>(rician) > float_t(0)) {
+							for(std::size_t ll = 0; ll < input.size(3); ++ll) {
+								input_tmp(ll) = smt::ricedebias(input_tmp(ll), std::get<0>(rician));
+							}
+						}
+					}
+					timer_gather.stop();
+
+					smt::profile_timer timer_fit(profile_fit, tt);
+					if(! cache || ! cache.find(hash, fit)) {
+						if(graddev) {
+							const smt::darray_view<float_t, 1> scales_tmp(dw.mapping.size(), scales_voxel_buf.begin()+tt*dw.mapping.size());
+							for(std::size_t ll = 0; ll < dw.mapping.size(); ++ll) {
+								scales_tmp(ll) = scales_row(ll, ii);
+							}
+							fit = multires? smt::fitmicrodt<float_t>(coarse_fit(ii/2, jj/2, kk/2), input_tmp, shells, scales_tmp, maxdiff, b0) : smt::fitmicrodt<float_t>(input_tmp, shells, scales_tmp, maxdiff, b0);
+						} else {
+							fit = multires? smt::fitmicrodt<float_t>(coarse_fit(ii/2, jj/2, kk/2), input_tmp, shells, maxdiff, b0) : smt::fitmicrodt<float_t>(input_tmp, shells, maxdiff, b0);
+						}
+						if(cache) {
+							cache.insert(hash, fit, tt);
+						}
+					}
+					timer_fit.stop();
+				}
+				if(grid && ! grid_fill) {
+					grid_fit(grid.index(0, ii), grid.index(1, jj), grid.index(2, kk)) = fit;
+					grid_valid(grid.index(0, ii), grid.index(1, jj), grid.index(2, kk)) = 1;
+				}
+				if(output_cost) {
+					output_cost(ii, jj, kk) = std::chrono::duration<float, std::micro>(std::chrono::steady_clock::now()-begin).count();
+				}
+				if(split > 0) {
+					output_long(ii, jj, kk) = fit(0);
+					output_trans(ii, jj, kk) = fit(1);
+					output_fa(ii, jj, kk) = smt::microfa(fit(0), fit(1));
+					output_fapow3(ii, jj, kk) = std::pow(smt::microfa(fit(0), fit(1)), 3);
+					output_md(ii, jj, kk) = smt::micromd(fit(0), fit(1));
+					output_b0(ii, jj, kk) = fit(2);
+				} else if(maps) {
+					output(ii, jj, kk, 0) = fit(0);
+					output(ii, jj, kk, 1) = fit(1);
+					output(ii, jj, kk, 2) = smt::microfa(fit(0), fit(1));
+					output(ii, jj, kk, 3) = std::pow(smt::microfa(fit(0), fit(1)), 3);
+					output(ii, jj, kk, 4) = smt::micromd(fit(0), fit(1));
+					output(ii, jj, kk, 5) = fit(2);
+				}
+				if(stats) {
+					stats.insert(ii, jj, kk, 0, fit(0));
+					stats.insert(ii, jj, kk, 1, fit(1));
+					stats.insert(ii, jj, kk, 2, smt::microfa(fit(0), fit(1)));
+					stats.insert(ii, jj, kk, 3, std::pow(smt::microfa(fit(0), fit(1)), 3));
+					stats.insert(ii, jj, kk, 4, smt::micromd(fit(0), fit(1)));
+					stats.insert(ii, jj, kk, 5, fit(2));
+				}
 			} else {
-				output(ii, jj, kk, 0) = 0;
-				output(ii, jj, kk, 1) = 0;
-				output(ii, jj, kk, 2) = 0;
-				output(ii, jj, kk, 3) = 0;
-				output(ii, jj, kk, 4) = 0;
-				output(ii, jj, kk, 5) = 0;
+				if(split > 0) {
+					output_long(ii, jj, kk) = 0;
+					output_trans(ii, jj, kk) = 0;
+					output_fa(ii, jj, kk) = 0;
+					output_fapow3(ii, jj, kk) = 0;
+					output_md(ii, jj, kk) = 0;
+					output_b0(ii, jj, kk) = 0;
+				} else if(maps) {
+					output(ii, jj, kk, 0) = 0;
+					output(ii, jj, kk, 1) = 0;
+					output(ii, jj, kk, 2) = 0;
+					output(ii, jj, kk, 3) = 0;
+					output(ii, jj, kk, 4) = 0;
+					output(ii, jj, kk, 5) = 0;
+				}
+				if(output_cost) {
+					output_cost(ii, jj, kk) = 0;
+				}
 			}
+			p.increment(tt);
 		}
-		p.increment(tt);
-	}, nthreads, chunk);
+	};
+	if(grid) {
+		smt::parfor(smt::cartesianrange<2>(grid.size(2), grid.size(1)), [&](const std::size_t gk, const std::size_t gj, const unsigned int tt = 0) {
+			process_row(grid.node(2, gk), grid.node(1, gj), tt);
+		}, nthreads, chunk);
+		grid_fill = true;
+	}
+	smt::parfor(smt::lpt(rows, rows_cost), process_row, nthreads, chunk);
+	profile_process.stop();
+
+	if(stats && ! stats.write(args["--stats"].asString())) {
+		return EXIT_FAILURE;
+	}
+
+	if(cache && ! cache.write()) {
+		return EXIT_FAILURE;
+	}
 
 	return EXIT_SUCCESS;
 }
@@ -37,8 +37,10 @@
 #include "nifti.h"
 #include "opts.h"
 #include "parfor.h"
+#include "profile.h"
 #include "progress.h"
 #include "sarray.h"
+#include "svector.h"
 #include "version.h"
 
 static const char VERSION[] = R"(gaussianfit)" " " STR(SMT_VERSION_STRING);
@@ -145,12 +147,21 @@ int main(int argc, const char** argv) {
 	const unsigned int nthreads = smt::threads();
 	const std::size_t chunk = 10;
 
+	smt::profile_section profile_gather("gather", nthreads);
+	smt::profile_section profile_fit("fit", nthreads);
+	smt::profile_stage profile_process("process", input.size(0)*input.size(1)*input.size(2));
+
 	smt::progress p{input.size(0)*input.size(1)*input.size(2), nthreads, "gaussianfit"};
 	smt::parfor(smt::cartesianrange<3>(input.size(2), input.size(1), input.size(0)), [&](const std::size_t kk, const std::size_t jj, const std::size_t ii, const unsigned int tt = 0) {
 		if((! mask) || mask(ii, jj, kk) > 0) {
-			smt::darray<float_t, 1> input_tmp = input(ii, jj, kk, smt::slice(0, input.size(3)));
-
-			const smt::sarray<float_t, 2> fit = smt::gaussianfit(input_tmp);
+			smt::profile_timer timer_gather(profile_gather, tt);
+			smt::svector<float_t> input_tmp(input.size(3));
+			input.gather(ii, jj, kk, smt::slice(0, input.size(3)), input_tmp);
+			timer_gather.stop();
+
+			smt::profile_timer timer_fit(profile_fit, tt);
+			const smt::sarray<float_t, 2> fit = smt::gaussianfit<float_t>(input_tmp);
+			timer_fit.stop();
 			if(split > 0) {
 				output_mean(ii, jj, kk) = fit(0);
 				output_std(ii, jj, kk) = fit(1);
@@ -169,6 +180,7 @@ int main(int argc, const char** argv) {
 		}
 		p.increment(tt);
 	}, nthreads, chunk);
+	profile_process.stop();
 
 	return EXIT_SUCCESS;
 }
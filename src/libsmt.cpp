@@ -0,0 +1,362 @@
+//
+// Copyright (c) 2018 Enrico Kaden & University College London
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// * Redistributions of source code must retain the above copyright notice, this
+//   list of conditions and the following disclaimer.
+//
+// * Redistributions in binary form must reproduce the above copyright notice,
+//   this list of conditions and the following disclaimer in the documentation
+//   and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#include <cstddef>
+#include <new>
+
+#include "cartesianrange.h"
+#include "darray.h"
+#include "diffenc.h"
+#include "finite.h"
+#include "fitmcmicro.h"
+#include "fitmicrodt.h"
+#include "parfor.h"
+#include "ricedebias.h"
+#include "ricianfit.h"
+#include "sarray.h"
+#include "smt.h"
+
+namespace {
+
+typedef double float_t;
+
+// Element (ii, jj, kk, ll) of a strided array.
+template <typename Array>
+auto at(const Array& a, const std::size_t& ii, const std::size_t& jj, const std::size_t& kk, const std::size_t& ll = 0) -> decltype(a.data[0]) {
+	return a.data[static_cast<std::ptrdiff_t>(ii)*a.stride[0]+static_cast<std::ptrdiff_t>(jj)*a.stride[1]
+			+static_cast<std::ptrdiff_t>(kk)*a.stride[2]+static_cast<std::ptrdiff_t>(ll)*a.stride[3]];
+}
+
+// Whether the array has the spatial size of the input and nvolumes volumes.
+template <typename Array>
+bool matches(const Array& a, const smt_array& input, const std::size_t& nvolumes) {
+	return a.data != nullptr && a.size[0] == input.size[0] && a.size[1] == input.size[1] && a.size[2] == input.size[2] && a.size[3] == nvolumes;
+}
+
+int check(const smt_array* input, const smt_options* options, const smt_mutable_array* output, const std::size_t& nvolumes, const bool& protocol) {
+	if(input == nullptr || options == nullptr || output == nullptr || input->data == nullptr) {
+		return SMT_ERROR_ARGUMENT;
+	}
+	if(! matches(*output, *input, nvolumes)) {
+		return SMT_ERROR_SIZE;
+	}
+	if(options->mask != nullptr && ! matches(*options->mask, *input, 1)) {
+		return SMT_ERROR_SIZE;
+	}
+	if(options->rician_map != nullptr && ! matches(*options->rician_map, *input, 1)) {
+		return SMT_ERROR_SIZE;
+	}
+	// The tests of finiteness are on the bits, as libsmt is built with -Ofast.
+	if(! smt::isfinite(options->rician) || options->rician < 0) {
+		return SMT_ERROR_ARGUMENT;
+	}
+
+	if(protocol) {
+		if(options->bvals == nullptr || options->nmeas == 0 || options->nmeas != input->size[3]) {
+			return SMT_ERROR_PROTOCOL;
+		}
+		for(std::size_t ii = 0; ii < options->nmeas; ++ii) {
+			if(! smt::isfinite(options->bvals[ii]) || options->bvals[ii] < 0) {
+				return SMT_ERROR_PROTOCOL;
+			}
+		}
+		// The gradient directions are normalised by smt::diffenc, which
+		// requires them to be finite, as do the file constructors.
+		if(options->bvecs != nullptr) {
+			for(std::size_t ii = 0; ii < options->nmeas; ++ii) {
+				const double* const bvec = options->bvecs+3*ii;
+				if(! smt::isfinite(bvec[0]) || ! smt::isfinite(bvec[1]) || ! smt::isfinite(bvec[2])
+						|| ! smt::isfinite(bvec[0]*bvec[0]+bvec[1]*bvec[1]+bvec[2]*bvec[2])) {
+					return SMT_ERROR_PROTOCOL;
+				}
+			}
+		}
+		if(options->graddev != nullptr) {
+			if(options->bvecs == nullptr) {
+				return SMT_ERROR_PROTOCOL;
+			}
+			if(! matches(*options->graddev, *input, 9)) {
+				return SMT_ERROR_SIZE;
+			}
+		}
+		if(! smt::isfinite(options->maxdiff) || options->maxdiff <= 0 || ! smt::isfinite(options->shelltol) || options->shelltol < 0) {
+			return SMT_ERROR_ARGUMENT;
+		}
+	}
+
+	return SMT_SUCCESS;
+}
+
+unsigned int threads(const smt_options& options) {
+	return (options.nthreads > 0)? options.nthreads : smt::threads();
+}
+
+bool foreground(const smt_options& options, const std::size_t& ii, const std::size_t& jj, const std::size_t& kk) {
+	return options.mask == nullptr || at(*options.mask, ii, jj, kk) > 0;
+}
+
+// Signal of a voxel, corrected for the Rician bias as in the tools.
+void gather(const smt_array& input, const smt_options& options, const std::size_t& ii, const std::size_t& jj, const std::size_t& kk,
+		const smt::darray_view<float_t, 1>& y) {
+	for(std::size_t ll = 0; ll < input.size[3]; ++ll) {
+		y(ll) = at(input, ii, jj, kk, ll);
+	}
+	if(options.rician_map != nullptr) {
+		for(std::size_t ll = 0; ll < input.size[3]; ++ll) {
+			y(ll) = smt::ricedebias(y(ll), float_t(at(*options.rician_map, ii, jj, kk)));
+		}
+	} else if(options.rician > 0) {
+		for(std::size_t ll = 0; ll < input.size[3]; ++ll) {
+			y(ll) = smt::ricedebias(y(ll), float_t(options.rician));
+		}
+	}
+}
+
+struct microdt {
+	static const std::size_t nparams = 6;
+
+	template <typename... Args>
+	static smt::sarray<float_t, 3> fit(const Args&... args) {
+		return smt::fitmicrodt<float_t>(args...);
+	}
+
+	static void store(const smt_mutable_array& output, const std::size_t& ii, const std::size_t& jj, const std::size_t& kk, const smt::sarray<float_t, 3>& fit) {
+		at(output, ii, jj, kk, 0) = fit(0);
+		at(output, ii, jj, kk, 1) = fit(1);
+		at(output, ii, jj, kk, 2) = smt::microfa(fit(0), fit(1));
+		at(output, ii, jj, kk, 3) = std::pow(smt::microfa(fit(0), fit(1)), 3);
+		at(output, ii, jj, kk, 4) = smt::micromd(fit(0), fit(1));
+		at(output, ii, jj, kk, 5) = fit(2);
+	}
+};
+
+struct mcmicro {
+	static const std::size_t nparams = 5;
+
+	template <typename... Args>
+	static smt::sarray<float_t, 3> fit(const Args&... args) {
+		return smt::fitmcmicro<float_t>(args...);
+	}
+
+	static void store(const smt_mutable_array& output, const std::size_t& ii, const std::size_t& jj, const std::size_t& kk, const smt::sarray<float_t, 3>& fit) {
+		at(output, ii, jj, kk, 0) = fit(0);
+		at(output, ii, jj, kk, 1) = fit(1);
+		at(output, ii, jj, kk, 2) = (float_t(1)-fit(0))*fit(1);
+		at(output, ii, jj, kk, 3) = (float_t(1)-float_t(2)/float_t(3)*fit(0))*fit(1);
+		at(output, ii, jj, kk, 4) = fit(2);
+	}
+};
+
+// Voxel loop of the spherical mean models, which follows fitmicrodt and
+// fitmcmicro.
+template <typename Model>
+int fit(const smt_array* input, const smt_options* options, const smt_mutable_array* output) {
+	const std::size_t nparams = Model::nparams;
+	const int code = check(input, options, output, nparams, true);
+	if(code != SMT_SUCCESS) {
+		return code;
+	}
+
+	const std::size_t nx = input->size[0];
+	const std::size_t nmeas = input->size[3];
+	const smt::diffenc<float_t> dw(options->bvals, options->bvecs, nmeas);
+	const smt::shells<float_t> shells(dw, options->shelltol);
+	const float_t maxdiff = options->maxdiff;
+	const bool b0 = options->b0 != 0;
+
+	const unsigned int nthreads = threads(*options);
+	smt::darray<float_t, 2> input_buf(nthreads, nmeas);
+	smt::darray<float_t, 2> graddev_buf(nthreads, 9*nx);
+	smt::darray<float_t, 2> scales_buf(nthreads, nmeas*nx);
+	smt::darray<float_t, 2> scales_voxel_buf(nthreads, nmeas);
+
+	smt::parfor(smt::cartesianrange<2>(input->size[2], input->size[1]), [&](const std::size_t kk, const std::size_t jj, const unsigned int tt = 0) {
+		const smt::darray_view<float_t, 2> scales_row(nmeas, nx, scales_buf.begin()+tt*nmeas*nx);
+		if(options->graddev != nullptr) {
+			const smt::darray_view<float_t, 2> graddev_row(9, nx, graddev_buf.begin()+tt*9*nx);
+			for(std::size_t ll = 0; ll < 9; ++ll) {
+				for(std::size_t ii = 0; ii < nx; ++ii) {
+					graddev_row(ll, ii) = at(*options->graddev, ii, jj, kk, ll);
+				}
+			}
+			dw.scales_graddev(graddev_row, scales_row);
+		}
+
+		for(std::size_t ii = 0; ii < nx; ++ii) {
+			if(foreground(*options, ii, jj, kk)) {
+				const smt::darray_view<float_t, 1> input_tmp(nmeas, input_buf.begin()+tt*nmeas);
+				gather(*input, *options, ii, jj, kk, input_tmp);
+
+				smt::sarray<float_t, 3> fit;
+				if(options->graddev != nullptr) {
+					const smt::darray_view<float_t, 1> scales_tmp(nmeas, scales_voxel_buf.begin()+tt*nmeas);
+					for(std::size_t ll = 0; ll < nmeas; ++ll) {
+						scales_tmp(ll) = scales_row(ll, ii);
+					}
+					fit = Model::fit(input_tmp, shells, scales_tmp, maxdiff, b0);
+				} else {
+					fit = Model::fit(input_tmp, shells, maxdiff, b0);
+				}
+				Model::store(*output, ii, jj, kk, fit);
+			} else {
+				for(std::size_t ll = 0; ll < nparams; ++ll) {
+					at(*output, ii, jj, kk, ll) = 0;
+				}
+			}
+		}
+	}, nthreads, 1);
+
+	return SMT_SUCCESS;
+}
+
+} // (anonymous)
+
+extern "C" {
+
+void smt_default_options(smt_options* options) {
+	options->bvals = nullptr;
+	options->bvecs = nullptr;
+	options->nmeas = 0;
+	options->graddev = nullptr;
+	options->mask = nullptr;
+	options->rician_map = nullptr;
+	options->rician = 0;
+	options->maxdiff = 3.05e-3;
+	options->shelltol = 0;
+	options->b0 = 0;
+	options->nthreads = 0;
+}
+
+const char* smt_strerror(int code) {
+	if(code == SMT_SUCCESS) {
+		return "Success";
+	} else if(code == SMT_ERROR_ARGUMENT) {
+		return "Invalid argument";
+	} else if(code == SMT_ERROR_SIZE) {
+		return "Array sizes do not match";
+	} else if(code == SMT_ERROR_PROTOCOL) {
+		return "Invalid diffusion encoding";
+	} else if(code == SMT_ERROR_MEMORY) {
+		return "Out of memory";
+	} else if(code == SMT_ERROR_INTERNAL) {
+		return "Internal error";
+	} else {
+		return "Unknown error";
+	}
+}
+
+int smt_fitmicrodt(const smt_array* input, const smt_options* options, const smt_mutable_array* output) {
+	try {
+		return fit<microdt>(input, options, output);
+	} catch(const std::bad_alloc&) {
+		return SMT_ERROR_MEMORY;
+	} catch(...) {
+		return SMT_ERROR_INTERNAL;
+	}
+}
+
+int smt_fitmcmicro(const smt_array* input, const smt_options* options, const smt_mutable_array* output) {
+	try {
+		return fit<mcmicro>(input, options, output);
+	} catch(const std::bad_alloc&) {
+		return SMT_ERROR_MEMORY;
+	} catch(...) {
+		return SMT_ERROR_INTERNAL;
+	}
+}
+
+int smt_ricianfit(const smt_array* input, const smt_options* options, const smt_mutable_array* output) {
+	typedef double float_t;
+
+	const int code = check(input, options, output, 2, false);
+	if(code != SMT_SUCCESS) {
+		return code;
+	}
+
+	try {
+		const std::size_t nmeas = input->size[3];
+		const unsigned int nthreads = threads(*options);
+		smt::darray<float_t, 2> input_buf(nthreads, nmeas);
+
+		smt::parfor(smt::cartesianrange<3>(input->size[2], input->size[1], input->size[0]), [&](const std::size_t kk, const std::size_t jj, const std::size_t ii, const unsigned int tt = 0) {
+			if(foreground(*options, ii, jj, kk)) {
+				const smt::darray_view<float_t, 1> input_tmp(nmeas, input_buf.begin()+tt*nmeas);
+				for(std::size_t ll = 0; ll < nmeas; ++ll) {
+					input_tmp(ll) = at(*input, ii, jj, kk, ll);
+				}
+				const smt::sarray<float_t, 2> fit = smt::ricianfit<float_t>(input_tmp);
+				at(*output, ii, jj, kk, 0) = fit(0);
+				at(*output, ii, jj, kk, 1) = fit(1);
+			} else {
+				at(*output, ii, jj, kk, 0) = 0;
+				at(*output, ii, jj, kk, 1) = 0;
+			}
+		}, nthreads, 10);
+	} catch(const std::bad_alloc&) {
+		return SMT_ERROR_MEMORY;
+	} catch(...) {
+		return SMT_ERROR_INTERNAL;
+	}
+
+	return SMT_SUCCESS;
+}
+
+int smt_ricedebias(const smt_array* input, const smt_options* options, const smt_mutable_array* output) {
+	typedef double float_t;
+
+	const int code = check(input, options, output, (input != nullptr)? input->size[3] : 0, false);
+	if(code != SMT_SUCCESS) {
+		return code;
+	}
+
+	try {
+		const unsigned int nthreads = threads(*options);
+		smt::parfor(smt::cartesianrange<2>(input->size[2], input->size[1]), [&](const std::size_t kk, const std::size_t jj, const unsigned int = 0) {
+			for(std::size_t ii = 0; ii < input->size[0]; ++ii) {
+				const bool fg = foreground(*options, ii, jj, kk);
+				for(std::size_t ll = 0; ll < input->size[3]; ++ll) {
+					float_t y = at(*input, ii, jj, kk, ll);
+					if(! fg) {
+						y = 0;
+					} else if(options->rician_map != nullptr) {
+						y = smt::ricedebias(y, float_t(at(*options->rician_map, ii, jj, kk)));
+					} else if(options->rician > 0) {
+						y = smt::ricedebias(y, float_t(options->rician));
+					}
+					at(*output, ii, jj, kk, ll) = y;
+				}
+			}
+		}, nthreads, 1);
+	} catch(const std::bad_alloc&) {
+		return SMT_ERROR_MEMORY;
+	} catch(...) {
+		return SMT_ERROR_INTERNAL;
+	}
+
+	return SMT_SUCCESS;
+}
+
+} // extern "C"
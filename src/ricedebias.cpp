@@ -40,6 +40,7 @@
 #include "nifti.h"
 #include "opts.h"
 #include "parfor.h"
+#include "profile.h"
 #include "progress.h"
 #include "ricedebias.h"
 #include "sarray.h"
@@ -226,13 +227,15 @@ int main(int argc, const char **argv)
   const unsigned int nthreads = smt::threads();
   const std::size_t chunk = 10;
 
-  for (int zz = 0; zz < input.size(3); zz++)
+  smt::profile_stage profile_process("process", input.size(0) * input.size(1) * input.size(2));
+
+  for (std::size_t zz = 0; zz < input.size(3); zz++)
   {
-    for (int kk = 0; kk < input.size(2); kk++)
+    for (std::size_t kk = 0; kk < input.size(2); kk++)
     {
-      for (int jj = 0; jj < input.size(1); jj++)
+      for (std::size_t jj = 0; jj < input.size(1); jj++)
       {
-        for (int ii = 0; ii < input.size(0); ii++)
+        for (std::size_t ii = 0; ii < input.size(0); ii++)
         {
           if ((!mask) || mask(ii, jj, kk) > 0)
           {
@@ -258,5 +261,7 @@ int main(int argc, const char **argv)
       }
     }
   }
+  profile_process.stop();
+
   return EXIT_SUCCESS;
 }
@@ -0,0 +1,486 @@
+//
+// Copyright (c) 2018 Enrico Kaden & University College London
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// * Redistributions of source code must retain the above copyright notice, this
+//   list of conditions and the following disclaimer.
+//
+// * Redistributions in binary form must reproduce the above copyright notice,
+//   this list of conditions and the following disclaimer in the documentation
+//   and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <numeric>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "besseli0.h"
+#include "chebychev.h"
+#include "darray.h"
+#include "debug.h"
+#include "fitmcmicro.h"
+#include "fitmicrodt.h"
+#include "logit.h"
+#include "meansignal.h"
+#include "nifti.h"
+#include "opts.h"
+#include "ricedebias.h"
+#include "sarray.h"
+#include "version.h"
+
+static const char VERSION[] = R"(smt_bench)" " " STR(SMT_VERSION_STRING);
+
+static const char LICENSE[] = R"(
+Copyright (c) 2018 Enrico Kaden & University College London
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+)";
+
+static const char USAGE[] = R"(
+MICROBENCHMARKS OF THE NUMERICAL KERNELS
+
+Copyright (c) 2018 Enrico Kaden & University College London
+
+Usage:
+  smt_bench [options]
+  smt_bench (-h | --help)
+  smt_bench --license
+  smt_bench --version
+
+Options:
+  --nmeas <nmeas>          Numbers of measurements, separated by commas [default: 30,90,270]
+  --input <input>          Diffusion-weighted volume for the voxel gather [default: none]
+  --repeat <repeat>        Number of timed runs, of which the median is reported [default: 5]
+  --mintime <mintime>      Minimum duration (s) of a timed run [default: 0.05]
+  --baseline <baseline>    Output of an earlier run for comparison [default: none]
+  --threshold <threshold>  Tolerated slowdown relative to the baseline [default: 0.1]
+  --json                   Output in JSON format
+  -h, --help               Help screen
+  --license                License information
+  --version                Software version
+)";
+
+// Written by every benchmark, such that the timed computation cannot be
+// discarded by the compiler.
+static volatile double sink = 0;
+
+// The bandwidth is zero for benchmarks without a meaningful data volume, and
+// the baseline is zero for benchmarks without a baseline, as NaN does not
+// survive -Ofast.
+struct result {
+	std::string name;
+	std::size_t size;
+	double ns_per_op;
+	double gb_per_s;
+	double baseline;
+};
+
+std::vector<std::size_t> read_nmeas(std::map<std::string, docopt::value>& args) {
+	std::vector<std::size_t> nmeas;
+	std::istringstream sin(args["--nmeas"].asString());
+	std::string str;
+	while(std::getline(sin, str, ',')) {
+		std::istringstream sin_str(str);
+		long int tmp;
+		if(! (sin_str >> tmp) || tmp <= 0 || ! sin_str.eof()) {
+			smt::error("Unable to parse ‘" + args["--nmeas"].asString() + "’.");
+			std::exit(EXIT_FAILURE);
+		}
+		nmeas.push_back(tmp);
+	}
+	if(nmeas.empty()) {
+		smt::error("Unable to parse ‘" + args["--nmeas"].asString() + "’.");
+		std::exit(EXIT_FAILURE);
+	}
+
+	return nmeas;
+}
+
+template <typename float_t>
+smt::inifti<float_t, 4> read_input(std::map<std::string, docopt::value>& args) {
+	if(args["--input"] && args["--input"].asString() != "none") {
+		return smt::inifti<float_t, 4>(args["--input"].asString());
+	} else {
+		return smt::inifti<float_t, 4>();
+	}
+}
+
+unsigned int read_repeat(std::map<std::string, docopt::value>& args) {
+	std::istringstream sin(args["--repeat"].asString());
+	long int repeat;
+	if(! (sin >> repeat) || repeat <= 0) {
+		smt::error("Unable to parse ‘" + args["--repeat"].asString() + "’.");
+		std::exit(EXIT_FAILURE);
+	}
+
+	return repeat;
+}
+
+double read_mintime(std::map<std::string, docopt::value>& args) {
+	std::istringstream sin(args["--mintime"].asString());
+	double mintime;
+	if(! (sin >> mintime) || mintime < 0) {
+		smt::error("Unable to parse ‘" + args["--mintime"].asString() + "’.");
+		std::exit(EXIT_FAILURE);
+	}
+
+	return mintime;
+}
+
+double read_threshold(std::map<std::string, docopt::value>& args) {
+	std::istringstream sin(args["--threshold"].asString());
+	double threshold;
+	if(! (sin >> threshold) || threshold < 0) {
+		smt::error("Unable to parse ‘" + args["--threshold"].asString() + "’.");
+		std::exit(EXIT_FAILURE);
+	}
+
+	return threshold;
+}
+
+// Timings (ns/op) of an earlier run by name and size, which are read from its
+// output in either text or JSON format.
+std::map<std::pair<std::string, std::size_t>, double> read_baseline(std::map<std::string, docopt::value>& args) {
+	std::map<std::pair<std::string, std::size_t>, double> baseline;
+	if(args["--baseline"] && args["--baseline"].asString() != "none") {
+		std::ifstream fin(args["--baseline"].asString());
+		if(! fin.good()) {
+			smt::error("Unable to open ‘" + args["--baseline"].asString() + "’.");
+			std::exit(EXIT_FAILURE);
+		}
+
+		std::string line;
+		while(std::getline(fin, line)) {
+			std::string name;
+			std::size_t size;
+			double ns_per_op;
+			const std::string::size_type pos = line.find("\"name\": \"");
+			if(pos != std::string::npos) {
+				const std::string::size_type begin = pos+9;
+				const std::string::size_type end = line.find('"', begin);
+				const std::string::size_type pos_size = line.find("\"size\": ");
+				const std::string::size_type pos_ns = line.find("\"ns_per_op\": ");
+				if(end == std::string::npos || pos_size == std::string::npos || pos_ns == std::string::npos) {
+					continue;
+				}
+				name = line.substr(begin, end-begin);
+				std::istringstream sin_size(line.substr(pos_size+8));
+				std::istringstream sin_ns(line.substr(pos_ns+13));
+				if(! (sin_size >> size) || ! (sin_ns >> ns_per_op)) {
+					continue;
+				}
+			} else {
+				std::istringstream sin(line);
+				if(! (sin >> name >> size >> ns_per_op)) {
+					continue;
+				}
+			}
+			baseline[std::make_pair(name, size)] = ns_per_op;
+		}
+		if(baseline.empty()) {
+			smt::error("‘" + args["--baseline"].asString() + "’ does not contain any timings.");
+			std::exit(EXIT_FAILURE);
+		}
+	}
+
+	return baseline;
+}
+
+// Acquisition protocol of n measurements, in which every tenth measurement is
+// unweighted and the others cycle through b-values of 1000, 2000 and 3000
+// s/mm².
+template <typename float_t>
+smt::darray<float_t, 1> protocol(const std::size_t& n) {
+	smt::darray<float_t, 1> bvalues(n);
+	for(std::size_t ii = 0; ii < n; ++ii) {
+		bvalues(ii) = (ii%10 == 0)? float_t(0) : float_t(1000*(1+ii%3));
+	}
+
+	return bvalues;
+}
+
+// Times f, which performs nops operations on nbytes bytes of data per call.
+// The number of calls per run is doubled until a run takes at least mintime,
+// and the median over repeat runs is reported.
+template <typename Func>
+result bench(const std::string& name, const std::size_t& size, const std::size_t& nops, const std::size_t& nbytes,
+		const unsigned int& repeat, const double& mintime, Func f) {
+	typedef std::chrono::steady_clock clock;
+
+	std::size_t ncalls = 1;
+	for(;;) {
+		const clock::time_point start = clock::now();
+		for(std::size_t ii = 0; ii < ncalls; ++ii) {
+			sink = sink+f();
+		}
+		if(std::chrono::duration<double>(clock::now()-start).count() >= mintime) {
+			break;
+		}
+		ncalls *= 2;
+	}
+
+	std::vector<double> times(repeat);
+	for(unsigned int rr = 0; rr < repeat; ++rr) {
+		const clock::time_point start = clock::now();
+		for(std::size_t ii = 0; ii < ncalls; ++ii) {
+			sink = sink+f();
+		}
+		times[rr] = std::chrono::duration<double, std::nano>(clock::now()-start).count()/ncalls;
+	}
+	std::sort(times.begin(), times.end());
+	const double ns_per_call = times[repeat/2];
+
+	return result{name, size, ns_per_call/nops, (nbytes > 0)? nbytes/ns_per_call : 0.0, 0.0};
+}
+
+void print_text(const std::vector<result>& results, const bool& baseline) {
+	std::cout << std::left << std::setw(20) << "name" << std::right << std::setw(8) << "size" << std::setw(16) << "ns/op" << std::setw(12) << "GB/s";
+	if(baseline) {
+		std::cout << std::setw(12) << "change";
+	}
+	std::cout << std::endl;
+	for(const result& r : results) {
+		std::cout << std::left << std::setw(20) << r.name << std::right << std::setw(8) << r.size
+				<< std::fixed << std::setprecision(3) << std::setw(16) << r.ns_per_op;
+		if(r.gb_per_s == 0) {
+			std::cout << std::setw(12) << "-";
+		} else {
+			std::cout << std::setw(12) << r.gb_per_s;
+		}
+		if(baseline) {
+			if(r.baseline == 0) {
+				std::cout << std::setw(12) << "-";
+			} else {
+				std::ostringstream sout;
+				sout << std::showpos << std::fixed << std::setprecision(1) << 100*(r.ns_per_op/r.baseline-1) << "%";
+				std::cout << std::setw(12) << sout.str();
+			}
+		}
+		std::cout << std::endl;
+	}
+}
+
+// One benchmark per line, in a fixed order and with fixed keys, such that the
+// output of two releases can be compared line by line.
+void print_json(const std::vector<result>& results, const bool& baseline) {
+	std::cout << "{" << std::endl;
+	std::cout << "  \"benchmarks\": [" << std::endl;
+	for(std::size_t ii = 0; ii < results.size(); ++ii) {
+		const result& r = results[ii];
+		std::cout << "    {\"name\": \"" << r.name << "\", \"size\": " << r.size
+				<< ", \"ns_per_op\": " << std::fixed << std::setprecision(3) << r.ns_per_op << ", \"gb_per_s\": ";
+		if(r.gb_per_s == 0) {
+			std::cout << "null";
+		} else {
+			std::cout << r.gb_per_s;
+		}
+		if(baseline) {
+			std::cout << ", \"baseline_ns_per_op\": ";
+			if(r.baseline == 0) {
+				std::cout << "null";
+			} else {
+				std::cout << r.baseline;
+			}
+		}
+		std::cout << "}" << ((ii+1 < results.size())? "," : "") << std::endl;
+	}
+	std::cout << "  ]" << std::endl;
+	std::cout << "}" << std::endl;
+}
+
+int main(int argc, const char** argv) {
+
+	typedef double float_t;
+
+	// Input
+
+	std::map<std::string, docopt::value> args = smt::docopt(USAGE, {argv+1, argv+argc}, true, VERSION);
+	if(args["--license"].asBool()) {
+		std::cout << LICENSE << std::endl;
+		return EXIT_SUCCESS;
+	}
+
+	const std::vector<std::size_t> nmeas = read_nmeas(args);
+	const smt::inifti<float_t, 4> input = read_input<float_t>(args);
+	const unsigned int repeat = read_repeat(args);
+	const double mintime = read_mintime(args);
+	const std::map<std::pair<std::string, std::size_t>, double> baseline = read_baseline(args);
+	const double threshold = read_threshold(args);
+
+	// Processing
+
+	const float_t diffmax = 3.05e-3;
+	std::array<float_t, 30> coeff;
+	for(std::size_t ii = 0; ii < coeff.size(); ++ii) {
+		coeff[ii] = float_t(1)/(ii+1);
+	}
+
+	std::vector<result> results;
+	for(const std::size_t& n : nmeas) {
+		const smt::darray<float_t, 1> bvalues = protocol<float_t>(n);
+		smt::darray<std::size_t, 1> mapping(n);
+		std::iota(std::begin(mapping), std::end(mapping), 0);
+		smt::darray<float_t, 1> x(n);
+		smt::darray<float_t, 1> y(n);
+		smt::darray<float_t, 1> z(n);
+		for(std::size_t ii = 0; ii < n; ++ii) {
+			x(ii) = (ii+float_t(0.5))/n;
+			y(ii) = 100*smt::meansignal(bvalues(ii), float_t(2.5e-3), float_t(0.3e-3));
+			z(ii) = 100*(float_t(0.6)*smt::meansignal(bvalues(ii), float_t(2e-3), float_t(0))
+					+float_t(0.4)*smt::meansignal(bvalues(ii), float_t(2e-3), float_t(0.8e-3)));
+		}
+
+		results.push_back(bench("meansignal", n, n, n*sizeof(float_t), repeat, mintime, [&]() {
+			float_t tmp = 0;
+			for(std::size_t ii = 0; ii < n; ++ii) {
+				tmp += smt::meansignal(bvalues(ii), float_t(2.5e-3), float_t(0.3e-3));
+			}
+			return tmp;
+		}));
+
+		results.push_back(bench("ricedebias", n, n, n*sizeof(float_t), repeat, mintime, [&]() {
+			float_t tmp = 0;
+			for(std::size_t ii = 0; ii < n; ++ii) {
+				tmp += smt::ricedebias(y(ii), float_t(20));
+			}
+			return tmp;
+		}));
+
+		results.push_back(bench("besselei0", n, n, n*sizeof(float_t), repeat, mintime, [&]() {
+			float_t tmp = 0;
+			for(std::size_t ii = 0; ii < n; ++ii) {
+				tmp += smt::besselei0(16*x(ii));
+			}
+			return tmp;
+		}));
+
+		results.push_back(bench("chebeval", n, n, n*sizeof(float_t), repeat, mintime, [&]() {
+			float_t tmp = 0;
+			for(std::size_t ii = 0; ii < n; ++ii) {
+				tmp += smt::chebeval(2*x(ii)-1, coeff);
+			}
+			return tmp;
+		}));
+
+		results.push_back(bench("expit", n, n, n*sizeof(float_t), repeat, mintime, [&]() {
+			float_t tmp = 0;
+			for(std::size_t ii = 0; ii < n; ++ii) {
+				tmp += smt::expit(16*x(ii)-8, diffmax);
+			}
+			return tmp;
+		}));
+
+		results.push_back(bench("logit", n, n, n*sizeof(float_t), repeat, mintime, [&]() {
+			float_t tmp = 0;
+			for(std::size_t ii = 0; ii < n; ++ii) {
+				tmp += smt::logit(x(ii)*diffmax, diffmax);
+			}
+			return tmp;
+		}));
+
+		smt::darray<float_t, 1> w(n);
+		w = 0;
+		results.push_back(bench("darray_axpy", n, n, 3*n*sizeof(float_t), repeat, mintime, [&]() {
+			w += float_t(0.5)*x+y;
+			return w(0);
+		}));
+
+		results.push_back(bench("fitmicrodt", n, 1, 0, repeat, mintime, [&]() {
+			return smt::fitmicrodt<float_t>(y, bvalues, mapping, diffmax)(0);
+		}));
+
+		results.push_back(bench("fitmcmicro", n, 1, 0, repeat, mintime, [&]() {
+			return smt::fitmcmicro<float_t>(z, bvalues, mapping, diffmax)(0);
+		}));
+	}
+
+	if(input) {
+		const std::size_t nvoxels = input.size(0)*input.size(1)*input.size(2);
+		smt::darray<float_t, 1> out(input.size(3));
+		std::size_t vv = 0;
+		results.push_back(bench("gather", input.size(3), 1, input.size(3)*sizeof(float_t), repeat, mintime, [&]() {
+			const std::size_t ii = vv%input.size(0);
+			const std::size_t jj = (vv/input.size(0))%input.size(1);
+			const std::size_t kk = vv/(input.size(0)*input.size(1));
+			input.gather(ii, jj, kk, smt::slice(0, input.size(3)), out);
+			vv = (vv+1)%nvoxels;
+			return out(0);
+		}));
+	}
+
+	std::vector<std::string> regressions;
+	for(result& r : results) {
+		const auto it = baseline.find(std::make_pair(r.name, r.size));
+		if(it != baseline.end()) {
+			r.baseline = it->second;
+			if(r.ns_per_op > (1+threshold)*r.baseline) {
+				regressions.push_back(r.name + "/" + std::to_string(r.size));
+			}
+		}
+	}
+
+	// Output
+
+	if(args["--json"].asBool()) {
+		print_json(results, ! baseline.empty());
+	} else {
+		print_text(results, ! baseline.empty());
+	}
+
+	if(! regressions.empty()) {
+		std::string names;
+		for(const std::string& name : regressions) {
+			names += (names.empty()? "" : ", ") + name;
+		}
+		smt::error("Slower than the baseline by more than the threshold: " + names + ".");
+		return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
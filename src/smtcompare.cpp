@@ -0,0 +1,214 @@
+//
+// Copyright (c) 2018 Enrico Kaden & University College London
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// * Redistributions of source code must retain the above copyright notice, this
+//   list of conditions and the following disclaimer.
+//
+// * Redistributions in binary form must reproduce the above copyright notice,
+//   this list of conditions and the following disclaimer in the documentation
+//   and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "debug.h"
+#include "nifti.h"
+#include "opts.h"
+#include "version.h"
+
+static const char VERSION[] = R"(smtcompare)" " " STR(SMT_VERSION_STRING);
+
+static const char LICENSE[] = R"(
+Copyright (c) 2018 Enrico Kaden & University College London
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+)";
+
+static const char USAGE[] = R"(
+COMPARISON OF PARAMETER MAPS WITH A REFERENCE
+
+Copyright (c) 2018 Enrico Kaden & University College London
+
+Usage:
+  smtcompare [options] <input> <reference>
+  smtcompare (-h | --help)
+  smtcompare --license
+  smtcompare --version
+
+Options:
+  --mask <mask>      Foreground mask [default: none]
+  --abstol <abstol>  Absolute tolerances per volume, separated by commas [default: 0]
+  --reltol <reltol>  Relative tolerances per volume, separated by commas [default: 1e-5]
+  -h, --help         Help screen
+  --license          License information
+  --version          Software version
+)";
+
+// One tolerance per volume, or a single tolerance for all volumes.
+template <typename float_t>
+std::vector<float_t> read_tolerances(std::map<std::string, docopt::value>& args, const std::string& name, const std::size_t& nvolumes) {
+	std::vector<float_t> tolerances;
+	std::istringstream sin(args[name].asString());
+	std::string str;
+	while(std::getline(sin, str, ',')) {
+		std::istringstream sin_str(str);
+		float_t tmp;
+		if(! (sin_str >> tmp) || tmp < float_t(0) || ! sin_str.eof()) {
+			smt::error("Unable to parse ‘" + args[name].asString() + "’.");
+			std::exit(EXIT_FAILURE);
+		}
+		tolerances.push_back(tmp);
+	}
+	if(tolerances.size() == 1) {
+		tolerances.resize(nvolumes, tolerances[0]);
+	}
+	if(tolerances.size() != nvolumes) {
+		smt::error("‘" + args[name].asString() + "’ does not match the number of volumes.");
+		std::exit(EXIT_FAILURE);
+	}
+
+	return tolerances;
+}
+
+template <typename float_t>
+smt::inifti<float_t, 3> read_mask(std::map<std::string, docopt::value>& args) {
+	if(args["--mask"] && args["--mask"].asString() != "none") {
+		return smt::inifti<float_t, 3>(args["--mask"].asString());
+	} else {
+		return smt::inifti<float_t, 3>();
+	}
+}
+
+// Compares the input with the reference volume by volume. A voxel fails if
+// the absolute difference exceeds abstol+reltol*|reference|.
+template <typename float_t, unsigned int D>
+bool compare(std::map<std::string, docopt::value>& args) {
+	const smt::inifti<float_t, D> input(args["<input>"].asString());
+	const smt::inifti<float_t, D> reference(args["<reference>"].asString());
+	for(unsigned int dd = 0; dd < D; ++dd) {
+		if(input.size(dd) != reference.size(dd)) {
+			smt::error("‘" + args["<input>"].asString() + "’ and ‘" + args["<reference>"].asString() + "’ do not match.");
+			std::exit(EXIT_FAILURE);
+		}
+	}
+
+	const smt::inifti<float_t, 3> mask = read_mask<float_t>(args);
+	if(mask) {
+		if(input.size(0) != mask.size(0) || input.size(1) != mask.size(1) || input.size(2) != mask.size(2)) {
+			smt::error("‘" + args["<input>"].asString() + "’ and ‘" + args["--mask"].asString() + "’ do not match.");
+			std::exit(EXIT_FAILURE);
+		}
+	}
+
+	const std::size_t nvoxels = input.size(0)*input.size(1)*input.size(2);
+	const std::size_t nvolumes = (D == 4)? input.size(D-1) : 1;
+	const std::vector<float_t> abstol = read_tolerances<float_t>(args, "--abstol", nvolumes);
+	const std::vector<float_t> reltol = read_tolerances<float_t>(args, "--reltol", nvolumes);
+
+	bool success = true;
+	std::cout << std::left << std::setw(8) << "volume" << std::right << std::setw(16) << "max abs diff" << std::setw(16) << "max rel diff" << std::setw(12) << "failed" << std::endl;
+	for(std::size_t vv = 0; vv < nvolumes; ++vv) {
+		float_t maxabs = 0;
+		float_t maxrel = 0;
+		std::size_t nfailed = 0;
+		for(std::size_t ii = 0; ii < nvoxels; ++ii) {
+			if((! mask) || mask[ii] > 0) {
+				const float_t a = input[ii+nvoxels*vv];
+				const float_t b = reference[ii+nvoxels*vv];
+				const float_t diff = std::abs(a-b);
+				maxabs = std::max(maxabs, diff);
+				if(b != float_t(0)) {
+					maxrel = std::max(maxrel, diff/std::abs(b));
+				}
+				if(diff > abstol[vv]+reltol[vv]*std::abs(b)) {
+					++nfailed;
+				}
+			}
+		}
+		std::cout << std::left << std::setw(8) << vv << std::right << std::scientific << std::setprecision(3)
+				<< std::setw(16) << maxabs << std::setw(16) << maxrel << std::setw(12) << nfailed << std::endl;
+		if(nfailed > 0) {
+			success = false;
+		}
+	}
+
+	return success;
+}
+
+int main(int argc, const char** argv) {
+
+	typedef double float_t;
+
+	// Input
+
+	std::map<std::string, docopt::value> args = smt::docopt(USAGE, {argv+1, argv+argc}, true, VERSION);
+	if(args["--license"].asBool()) {
+		std::cout << LICENSE << std::endl;
+		return EXIT_SUCCESS;
+	}
+
+	// Processing
+
+	const int ndims = smt::ndims(args["<input>"].asString());
+	bool success;
+	if(ndims == 3) {
+		success = compare<float_t, 3>(args);
+	} else if(ndims == 4) {
+		success = compare<float_t, 4>(args);
+	} else {
+		smt::error("Number of dimensions in ‘" + args["<input>"].asString() + "’ not supported.");
+		return EXIT_FAILURE;
+	}
+
+	// Output
+
+	if(! success) {
+		smt::error("‘" + args["<input>"].asString() + "’ and ‘" + args["<reference>"].asString() + "’ differ beyond the tolerances.");
+		return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,816 @@
+//
+// Copyright (c) 2018 Enrico Kaden & University College London
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// * Redistributions of source code must retain the above copyright notice, this
+//   list of conditions and the following disclaimer.
+//
+// * Redistributions in binary form must reproduce the above copyright notice,
+//   this list of conditions and the following disclaimer in the documentation
+//   and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cmath>
+#include <csignal>
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <iterator>
+#include <limits>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <tuple>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "cartesianrange.h"
+#include "darray.h"
+#include "debug.h"
+#include "diffenc.h"
+#include "finite.h"
+#include "fitmcmicro.h"
+#include "fitmicrodt.h"
+#include "nifti.h"
+#include "opts.h"
+#include "parfor.h"
+#include "ricedebias.h"
+#include "sarray.h"
+#include "threadpool.h"
+#include "version.h"
+
+static const char VERSION[] = R"(smtd)" " " STR(SMT_VERSION_STRING);
+
+static const char LICENSE[] = R"(
+Copyright (c) 2018 Enrico Kaden & University College London
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+)";
+
+static const char USAGE[] = R"(
+FIT SERVER FOR THE SPHERICAL MEAN TECHNIQUE
+
+Copyright (c) 2018 Enrico Kaden & University College London
+
+Usage:
+  smtd [options] <socket>
+  smtd (-h | --help)
+  smtd --license
+  smtd --version
+
+Options:
+  --cache <cache>      Number of images and of diffusion encodings kept in memory [default: 8]
+  --timeout <timeout>  Seconds a client may keep the server waiting [default: 10]
+  -h, --help           Help screen
+  --license            License information
+  --version            Software version
+)";
+
+// Grammar of a request, which is a line of whitespace-separated words sent to
+// the socket.
+static const char REQUEST[] = R"(
+Usage:
+  smtd fitmicrodt [options] <input>
+  smtd fitmcmicro [options] <input>
+  smtd stats
+  smtd shutdown
+
+Options:
+  --bvals <bvals>        Diffusion weighting factors (s/mm²) in FSL format
+  --bvecs <bvecs>        Diffusion gradient directions in FSL format
+  --grads <grads>        Diffusion gradients (s/mm²) in MRtrix format
+  --graddev <graddev>    Diffusion gradient deviation [default: none]
+  --mask <mask>          Foreground mask [default: none]
+  --roi <roi>            Bounding box x0,x1,y0,y1,z0,z1 (voxels, inclusive) [default: none]
+  --rician <rician>      Rician noise [default: none]
+  --maxdiff <maxdiff>    Maximum diffusivity (mm²/s) [default: 3.05e-3]
+  --shelltol <shelltol>  Tolerance (s/mm²) for grouping b-values into shells [default: 0]
+  --b0                   Model-based estimation of zero b-value signal
+)";
+
+namespace {
+
+volatile std::sig_atomic_t stop = 0;
+
+void handle_signal(int) {
+	stop = 1;
+}
+
+// Failure of a single request, which is reported to the client while the
+// server carries on.
+struct request_error : public std::runtime_error {
+	explicit request_error(const std::string& what): std::runtime_error(what) {}
+};
+
+// Least recently used values, which are shared with the requests holding them.
+template <typename Value>
+class cache {
+public:
+	explicit cache(const std::size_t& capacity):
+		_capacity(capacity),
+		_entries(),
+		_index(),
+		_hits(0),
+		_misses(0) {
+	}
+
+	template <typename Load>
+	std::shared_ptr<const Value> get(const std::string& key, Load load) {
+		const typename std::unordered_map<std::string, typename entries::iterator>::iterator it = _index.find(key);
+		if(it != _index.end()) {
+			_entries.splice(_entries.begin(), _entries, it->second);
+			++_hits;
+			return it->second->second;
+		}
+
+		++_misses;
+		const std::shared_ptr<const Value> value = load();
+		_entries.emplace_front(key, value);
+		_index[key] = _entries.begin();
+		if(_entries.size() > _capacity) {
+			_index.erase(_entries.back().first);
+			_entries.pop_back();
+		}
+		return value;
+	}
+
+	std::size_t size() const {
+		return _entries.size();
+	}
+
+	std::size_t hits() const {
+		return _hits;
+	}
+
+	std::size_t misses() const {
+		return _misses;
+	}
+
+	~cache() {
+	}
+private:
+	typedef std::list<std::pair<std::string, std::shared_ptr<const Value>>> entries;
+
+	const std::size_t _capacity;
+	entries _entries;
+	std::unordered_map<std::string, typename entries::iterator> _index;
+	std::size_t _hits;
+	std::size_t _misses;
+};
+
+// Cache key of a file, which changes whenever the file is replaced or
+// rewritten.
+std::string stamp(const std::string& filename) {
+	struct stat st;
+	if(::stat(filename.c_str(), &st) != 0) {
+		throw request_error("Unable to open ‘" + filename + "’.");
+	}
+	std::ostringstream sout;
+	sout << filename << '\n' << st.st_dev << ':' << st.st_ino << ':' << st.st_size << ':' << st.st_mtim.tv_sec << '.' << st.st_mtim.tv_nsec;
+	return sout.str();
+}
+
+// The image reader terminates the process on malformed input, hence the
+// header and the file size are checked beforehand. The length of gzipped data
+// is only known after decompression, which is left to inflate().
+std::string probe(const std::string& filename, const int& ndims, std::size_t& length) {
+#ifndef ZLIB_FOUND
+	if(smt::has_nifti_extension(filename, ".gz")) {
+		throw request_error("Built without support for gzip format.");
+	}
+#endif // ZLIB_FOUND
+	const std::tuple<bool, bool, std::string, std::string> name = smt::niftiname(filename);
+	const std::string& hdrname = std::get<2>(name);
+	const std::string& imgname = std::get<3>(name);
+	const std::string key = std::get<1>(name)? stamp(hdrname) + '\n' + stamp(imgname) : stamp(hdrname);
+
+	nifti_1_header header;
+#ifdef ZLIB_FOUND
+	gzFile zin;
+	if((zin = gzopen(hdrname.c_str(), "rb")) == nullptr) {
+		throw request_error("Unable to open ‘" + hdrname + "’.");
+	}
+	const bool success = smt::gzfread(&header, sizeof(nifti_1_header), 1, zin) == 1;
+	gzclose(zin);
+#else
+	std::FILE* fin;
+	if((fin = std::fopen(hdrname.c_str(), "rb")) == nullptr) {
+		throw request_error("Unable to open ‘" + hdrname + "’.");
+	}
+	const bool success = std::fread(&header, sizeof(nifti_1_header), 1, fin) == 1;
+	std::fclose(fin);
+#endif // ZLIB_FOUND
+	if(! success) {
+		throw request_error("Unable to read ‘" + hdrname + "’.");
+	}
+	if(std::string(header.magic, sizeof(header.magic)) != std::string(std::get<1>(name)? "ni1" : "n+1", sizeof(header.magic))) {
+		throw request_error("‘" + hdrname + "’ not in NIfTI-1 format.");
+	}
+	if(header.dim[0] != ndims) {
+		throw request_error("Number of dimensions in ‘" + hdrname + "’ not supported.");
+	}
+
+	std::size_t bytesize;
+	if(header.datatype == NIFTI_TYPE_INT8 || header.datatype == NIFTI_TYPE_UINT8) {
+		bytesize = 1;
+	} else if(header.datatype == NIFTI_TYPE_INT16 || header.datatype == NIFTI_TYPE_UINT16) {
+		bytesize = 2;
+	} else if(header.datatype == NIFTI_TYPE_INT32 || header.datatype == NIFTI_TYPE_UINT32 || header.datatype == NIFTI_TYPE_FLOAT32) {
+		bytesize = 4;
+	} else if(header.datatype == NIFTI_TYPE_INT64 || header.datatype == NIFTI_TYPE_UINT64 || header.datatype == NIFTI_TYPE_FLOAT64 || header.datatype == NIFTI_TYPE_COMPLEX64) {
+		bytesize = 8;
+	} else if(header.datatype == NIFTI_TYPE_FLOAT128 || header.datatype == NIFTI_TYPE_COMPLEX128) {
+		bytesize = 16;
+	} else if(header.datatype == NIFTI_TYPE_COMPLEX256) {
+		bytesize = 32;
+	} else {
+		throw request_error("Unable to read the data type of ‘" + hdrname + "’.");
+	}
+
+	std::size_t size = bytesize;
+	for(int ii = 1; ii <= ndims; ++ii) {
+		if(header.dim[ii] < 0) {
+			throw request_error("Dimensions in ‘" + hdrname + "’ not non-negative.");
+		}
+		if(header.dim[ii] > 0 && size > std::numeric_limits<std::size_t>::max()/header.dim[ii]) {
+			throw request_error("Dimensions in ‘" + hdrname + "’ not supported.");
+		}
+		size *= header.dim[ii];
+	}
+	// The data follow the header unless stored separately.
+	length = size+static_cast<std::size_t>(std::max(std::get<1>(name)? 0.0f : 352.0f, header.vox_offset));
+	if(! std::get<0>(name)) {
+		struct stat st;
+		if(::stat(imgname.c_str(), &st) != 0 || static_cast<std::size_t>(st.st_size) < length) {
+			throw request_error("Unable to read ‘" + imgname + "’.");
+		}
+	}
+
+	return key;
+}
+
+// Whether the gzipped data of the image hold the given number of bytes once
+// decompressed, which probe() has determined.
+void inflate(const std::string& filename, const std::size_t& length) {
+	const std::tuple<bool, bool, std::string, std::string> name = smt::niftiname(filename);
+	if(! std::get<0>(name)) {
+		return;
+	}
+#ifdef ZLIB_FOUND
+	const std::string& imgname = std::get<3>(name);
+	gzFile zin;
+	if((zin = gzopen(imgname.c_str(), "rb")) == nullptr) {
+		throw request_error("Unable to open ‘" + imgname + "’.");
+	}
+	char buffer[65536];
+	std::size_t total = 0;
+	int nn;
+	while(total < length && (nn = gzread(zin, buffer, sizeof(buffer))) > 0) {
+		total += nn;
+	}
+	gzclose(zin);
+	if(total < length) {
+		throw request_error("Unable to read ‘" + imgname + "’.");
+	}
+#endif // ZLIB_FOUND
+}
+
+template <typename float_t, unsigned int D>
+std::shared_ptr<const smt::inifti<float_t, D>> read_image(cache<smt::inifti<float_t, D>>& images, const std::string& filename) {
+	std::size_t length;
+	return images.get(probe(filename, D, length), [&]() {
+		inflate(filename, length);
+		return std::make_shared<const smt::inifti<float_t, D>>(filename);
+	});
+}
+
+// Lines of whitespace-separated numbers, parsed as by the protocol readers of
+// diffenc, which terminate the process on malformed input.
+template <typename float_t>
+std::vector<std::vector<float_t>> read_lines(const std::string& filename, const std::size_t& nlines) {
+	std::ifstream fin(filename.c_str());
+	if(! fin.good()) {
+		throw request_error("Unable to read ‘" + filename + "’.");
+	}
+	std::vector<std::vector<float_t>> lines;
+	std::string str;
+	while(lines.size() < nlines && std::getline(fin, str)) {
+		std::istringstream sin(str);
+		lines.emplace_back(std::istream_iterator<float_t>(sin), std::istream_iterator<float_t>());
+	}
+	return lines;
+}
+
+// Diffusion encoding of the request, which is read and checked as in libsmt
+// before it is constructed from the buffers, such that a malformed protocol
+// fails the request only.
+template <typename float_t>
+std::shared_ptr<const smt::diffenc<float_t>> load_diffenc(std::map<std::string, docopt::value>& args) {
+	std::vector<float_t> bvals;
+	std::vector<float_t> bvecs;
+	if(args["--grads"]) {
+		const std::string filename = args["--grads"].asString();
+		std::ifstream fin(filename.c_str());
+		if(! fin.good()) {
+			throw request_error("Unable to read ‘" + filename + "’.");
+		}
+		std::string str;
+		while(std::getline(fin, str)) {
+			std::istringstream sin(str);
+			smt::sarray<float_t, 4> tmp;
+			if(sin >> tmp[0]
+					&& sin.ignore(std::numeric_limits<std::streamsize>::max(), ',')
+					&& sin >> tmp[1]
+					&& sin.ignore(std::numeric_limits<std::streamsize>::max(), ',')
+					&& sin >> tmp[2]
+					&& sin.ignore(std::numeric_limits<std::streamsize>::max(), ',')
+					&& sin >> tmp[3]) {
+				bvals.push_back(tmp[3]);
+				bvecs.insert(bvecs.end(), {tmp[0], tmp[1], tmp[2]});
+			}
+		}
+	} else {
+		const std::vector<std::vector<float_t>> lines_bvals = read_lines<float_t>(args["--bvals"].asString(), 1);
+		const std::vector<std::vector<float_t>> lines_bvecs = read_lines<float_t>(args["--bvecs"].asString(), 3);
+		if(lines_bvals.size() != 1 || lines_bvecs.size() != 3
+				|| std::min(lines_bvecs[0].size(), std::min(lines_bvecs[1].size(), lines_bvecs[2].size())) != lines_bvals[0].size()) {
+			throw request_error("‘" + args["--bvals"].asString() + "’ and ‘" + args["--bvecs"].asString() + "’ do not match.");
+		}
+		bvals = lines_bvals[0];
+		for(std::size_t ii = 0; ii < bvals.size(); ++ii) {
+			bvecs.insert(bvecs.end(), {lines_bvecs[0][ii], lines_bvecs[1][ii], lines_bvecs[2][ii]});
+		}
+	}
+
+	const std::string filename = args["--grads"]? args["--grads"].asString() : args["--bvals"].asString();
+	if(bvals.empty()) {
+		throw request_error("‘" + filename + "’ is malformed.");
+	}
+	for(std::size_t ii = 0; ii < bvals.size(); ++ii) {
+		if(! (bvals[ii] >= float_t(0)) || ! smt::isfinite(bvals[ii])) {
+			throw request_error("‘" + filename + "’ has diffusion weighting factors which are not non-negative.");
+		}
+		if(! smt::isfinite(bvecs[3*ii]) || ! smt::isfinite(bvecs[3*ii+1]) || ! smt::isfinite(bvecs[3*ii+2])) {
+			throw request_error("‘" + (args["--grads"]? filename : args["--bvecs"].asString()) + "’ has diffusion gradient directions which are not normalised.");
+		}
+	}
+
+	return std::make_shared<const smt::diffenc<float_t>>(bvals.data(), bvecs.data(), bvals.size());
+}
+
+template <typename float_t>
+std::shared_ptr<const smt::diffenc<float_t>> read_diffenc(cache<smt::diffenc<float_t>>& diffencs, std::map<std::string, docopt::value>& args) {
+	if(args["--bvals"] && args["--bvecs"] && !args["--grads"]) {
+		return diffencs.get(stamp(args["--bvals"].asString()) + '\n' + stamp(args["--bvecs"].asString()), [&]() {
+			return load_diffenc<float_t>(args);
+		});
+	} else if(!args["--bvals"] && !args["--bvecs"] && args["--grads"]) {
+		return diffencs.get(stamp(args["--grads"].asString()), [&]() {
+			return load_diffenc<float_t>(args);
+		});
+	} else {
+		throw request_error("Either --bvals <bvals>, --bvecs <bvecs> or --grads <grads> are required.");
+	}
+}
+
+// Whether the image has the spatial size, pixel size and coordinate system of
+// the input.
+template <typename float_t, unsigned int D>
+void check_like(const smt::inifti<float_t, 4>& input, const smt::inifti<float_t, D>& image, const std::string& input_name, const std::string& image_name) {
+	if(input.size(0) != image.size(0) || input.size(1) != image.size(1) || input.size(2) != image.size(2)) {
+		throw request_error("‘" + input_name + "’ and ‘" + image_name + "’ do not match.");
+	}
+	if(input.pixsize(0) != image.pixsize(0) || input.pixsize(1) != image.pixsize(1) || input.pixsize(2) != image.pixsize(2)) {
+		throw request_error("The pixel sizes of ‘" + input_name + "’ and ‘" + image_name + "’ do not match.");
+	}
+	if(! input.has_equal_spatial_coords(image)) {
+		throw request_error("The coordinate systems of ‘" + input_name + "’ and ‘" + image_name + "’ do not match.");
+	}
+}
+
+template <typename float_t>
+float_t read_scalar(std::map<std::string, docopt::value>& args, const std::string& name, const float_t& lower) {
+	std::istringstream sin(args[name].asString());
+	float_t val;
+	if(! (sin >> val) || ! sin.eof() || val < lower) {
+		throw request_error("Unable to parse ‘" + args[name].asString() + "’.");
+	}
+	return val;
+}
+
+// Inclusive voxel bounds of the region of interest, which defaults to the
+// whole image.
+template <typename float_t>
+smt::sarray<std::size_t, 6> read_roi(std::map<std::string, docopt::value>& args, const smt::inifti<float_t, 4>& input) {
+	smt::sarray<std::size_t, 6> roi;
+	if(args["--roi"].asString() == "none") {
+		for(std::size_t dd = 0; dd < 3; ++dd) {
+			if(input.size(dd) == 0) {
+				throw request_error("‘" + args["<input>"].asString() + "’ is empty.");
+			}
+			roi(2*dd) = 0;
+			roi(2*dd+1) = input.size(dd)-1;
+		}
+		return roi;
+	}
+
+	std::istringstream sin(args["--roi"].asString());
+	std::string str;
+	std::size_t nn = 0;
+	while(std::getline(sin, str, ',')) {
+		std::istringstream sin_str(str);
+		long int tmp;
+		if(nn == 6 || ! (sin_str >> tmp) || ! sin_str.eof() || tmp < 0) {
+			throw request_error("Unable to parse ‘" + args["--roi"].asString() + "’.");
+		}
+		roi(nn++) = tmp;
+	}
+	if(nn != 6) {
+		throw request_error("Unable to parse ‘" + args["--roi"].asString() + "’.");
+	}
+	for(std::size_t dd = 0; dd < 3; ++dd) {
+		if(roi(2*dd) > roi(2*dd+1) || roi(2*dd+1) >= input.size(dd)) {
+			throw request_error("‘" + args["--roi"].asString() + "’ exceeds ‘" + args["<input>"].asString() + "’.");
+		}
+	}
+	return roi;
+}
+
+// Whole message, unless the client has gone away.
+bool send_all(const int& fd, const std::string& msg) {
+	std::size_t sent = 0;
+	while(sent < msg.size()) {
+		const ssize_t nn = ::send(fd, msg.data()+sent, msg.size()-sent, MSG_NOSIGNAL);
+		if(nn < 0) {
+			if(errno == EINTR) {
+				continue;
+			}
+			return false;
+		}
+		sent += nn;
+	}
+	return true;
+}
+
+// Fit of the voxels in the region of interest and the mask, where each row of
+// voxels is sent to the client once it has been fitted, one line per voxel
+// holding its indices and the volumes written by fitmicrodt or fitmcmicro.
+template <typename float_t>
+void fit(const int& fd, std::map<std::string, docopt::value>& args, smt::threadpool& pool,
+		cache<smt::inifti<float_t, 4>>& images, cache<smt::inifti<float_t, 3>>& maps, cache<smt::diffenc<float_t>>& diffencs) {
+
+	const bool mcmicro = args["fitmcmicro"].asBool();
+
+	const std::shared_ptr<const smt::inifti<float_t, 4>> input = read_image<float_t, 4>(images, args["<input>"].asString());
+
+	const std::shared_ptr<const smt::diffenc<float_t>> dw = read_diffenc<float_t>(diffencs, args);
+	if(input->size(3) != dw->mapping.size(0)) {
+		throw request_error("‘" + args["<input>"].asString() + "’ and the diffusion encoding do not match.");
+	}
+
+	std::shared_ptr<const smt::inifti<float_t, 4>> graddev;
+	if(args["--graddev"].asString() != "none") {
+		graddev = read_image<float_t, 4>(images, args["--graddev"].asString());
+		check_like(*input, *graddev, args["<input>"].asString(), args["--graddev"].asString());
+		if(graddev->size(3) != 9) {
+			throw request_error("‘" + args["--graddev"].asString() + "’ does not contain nine volumes.");
+		}
+	}
+
+	std::shared_ptr<const smt::inifti<float_t, 3>> mask;
+	if(args["--mask"].asString() != "none") {
+		mask = read_image<float_t, 3>(maps, args["--mask"].asString());
+		check_like(*input, *mask, args["<input>"].asString(), args["--mask"].asString());
+	}
+
+	float_t rician = 0;
+	std::shared_ptr<const smt::inifti<float_t, 3>> rician_map;
+	if(args["--rician"].asString() != "none") {
+		std::istringstream sin(args["--rician"].asString());
+		if(! (sin >> rician)) {
+			rician = 0;
+			rician_map = read_image<float_t, 3>(maps, args["--rician"].asString());
+			check_like(*input, *rician_map, args["<input>"].asString(), args["--rician"].asString());
+		}
+	}
+
+	const float_t maxdiff = read_scalar<float_t>(args, "--maxdiff", -std::numeric_limits<float_t>::max());
+	const float_t shelltol = read_scalar<float_t>(args, "--shelltol", 0);
+	const smt::shells<float_t> shells(*dw, shelltol);
+	const bool b0 = args["--b0"].asBool();
+
+	const smt::sarray<std::size_t, 6> roi = read_roi(args, *input);
+
+	if(! send_all(fd, mcmicro? "fields ii jj kk intra diff extratrans extramd b0\n" : "fields ii jj kk long trans fa fapow3 md b0\n")) {
+		return;
+	}
+
+	const unsigned int nthreads = pool.size();
+	const std::size_t nmeas = input->size(3);
+	const std::size_t nx = input->size(0);
+	smt::darray<float_t, 2> input_buf(nthreads, nmeas);
+	smt::darray<float_t, 2> graddev_buf(nthreads, 9*nx);
+	smt::darray<float_t, 2> scales_buf(nthreads, nmeas*nx);
+	smt::darray<float_t, 2> scales_voxel_buf(nthreads, nmeas);
+
+	std::mutex mutex;
+	std::atomic<bool> connected{true};
+	std::atomic<std::size_t> nvoxels{0};
+
+	const smt::cartesianrange<2> rows(roi(5)-roi(4)+1, roi(3)-roi(2)+1);
+	pool.run(rows.size(), [&](const std::size_t rr, const unsigned int tt) {
+		if(! connected.load(std::memory_order_relaxed)) {
+			return;
+		}
+		std::size_t kk, jj;
+		std::tie(kk, jj) = rows.index(rr);
+		kk += roi(4);
+		jj += roi(2);
+
+		const smt::darray_view<float_t, 2> scales_row(nmeas, nx, scales_buf.begin()+tt*nmeas*nx);
+		if(graddev) {
+			const smt::darray_view<float_t, 2> graddev_row(9, nx, graddev_buf.begin()+tt*9*nx);
+			for(std::size_t ll = 0; ll < 9; ++ll) {
+				for(std::size_t ii = 0; ii < nx; ++ii) {
+					graddev_row(ll, ii) = (*graddev)(ii, jj, kk, ll);
+				}
+			}
+			dw->scales_graddev(graddev_row, scales_row);
+		}
+
+		std::ostringstream sout;
+		sout.precision(std::numeric_limits<float>::max_digits10);
+		std::size_t count = 0;
+		for(std::size_t ii = roi(0); ii <= roi(1); ++ii) {
+			if(mask && ! ((*mask)(ii, jj, kk) > 0)) {
+				continue;
+			}
+
+			const smt::darray_view<float_t, 1> input_tmp(nmeas, input_buf.begin()+tt*nmeas);
+			input->gather(ii, jj, kk, smt::slice(0, nmeas), input_tmp);
+			if(rician_map) {
+				for(std::size_t ll = 0; ll < nmeas; ++ll) {
+					input_tmp(ll) = smt::ricedebias(input_tmp(ll), (*rician_map)(ii, jj, kk));
+				}
+			} else if(rician > float_t(0)) {
+				for(std::size_t ll = 0; ll < nmeas; ++ll) {
+					input_tmp(ll) = smt::ricedebias(input_tmp(ll), rician);
+				}
+			}
+
+			smt::sarray<float_t, 3> fit;
+			if(graddev) {
+				const smt::darray_view<float_t, 1> scales_tmp(nmeas, scales_voxel_buf.begin()+tt*nmeas);
+				for(std::size_t ll = 0; ll < nmeas; ++ll) {
+					scales_tmp(ll) = scales_row(ll, ii);
+				}
+				fit = mcmicro? smt::fitmcmicro<float_t>(input_tmp, shells, scales_tmp, maxdiff, b0) : smt::fitmicrodt<float_t>(input_tmp, shells, scales_tmp, maxdiff, b0);
+			} else {
+				fit = mcmicro? smt::fitmcmicro<float_t>(input_tmp, shells, maxdiff, b0) : smt::fitmicrodt<float_t>(input_tmp, shells, maxdiff, b0);
+			}
+
+			// The volumes are rounded to single precision as in the images
+			// written by the tools.
+			sout << ii << ' ' << jj << ' ' << kk;
+			if(mcmicro) {
+				sout << ' ' << float(fit(0))
+						<< ' ' << float(fit(1))
+						<< ' ' << float((float_t(1)-fit(0))*fit(1))
+						<< ' ' << float((float_t(1)-float_t(2)/float_t(3)*fit(0))*fit(1))
+						<< ' ' << float(fit(2)) << '\n';
+			} else {
+				sout << ' ' << float(fit(0))
+						<< ' ' << float(fit(1))
+						<< ' ' << float(smt::microfa(fit(0), fit(1)))
+						<< ' ' << float(std::pow(smt::microfa(fit(0), fit(1)), 3))
+						<< ' ' << float(smt::micromd(fit(0), fit(1)))
+						<< ' ' << float(fit(2)) << '\n';
+			}
+			++count;
+		}
+
+		if(count > 0) {
+			std::lock_guard<std::mutex> lock(mutex);
+			if(connected && ! send_all(fd, sout.str())) {
+				connected = false;
+			}
+			nvoxels += count;
+		}
+	}, 1);
+
+	if(connected) {
+		send_all(fd, "done " + std::to_string(nvoxels) + "\n");
+	}
+}
+
+// Requests of a client, one per line, until the client closes the connection
+// or asks the server to shut down.
+template <typename float_t>
+void serve(const int& fd, smt::threadpool& pool,
+		cache<smt::inifti<float_t, 4>>& images, cache<smt::inifti<float_t, 3>>& maps, cache<smt::diffenc<float_t>>& diffencs) {
+
+	std::string buffer;
+	char chunk[4096];
+	while(! stop) {
+		std::string::size_type eol;
+		while((eol = buffer.find('\n')) == std::string::npos) {
+			const ssize_t nn = ::recv(fd, chunk, sizeof(chunk), 0);
+			if(nn < 0 && errno == EINTR && ! stop) {
+				continue;
+			}
+			if(nn <= 0) {
+				return;
+			}
+			buffer.append(chunk, nn);
+		}
+		const std::string line = buffer.substr(0, eol);
+		buffer.erase(0, eol+1);
+
+		std::istringstream sin(line);
+		const std::vector<std::string> words{std::istream_iterator<std::string>(sin), std::istream_iterator<std::string>()};
+		if(words.empty()) {
+			continue;
+		}
+
+		try {
+			std::map<std::string, docopt::value> args;
+			try {
+				args = docopt::docopt_parse(REQUEST, words, false, false, false);
+			} catch(const docopt::DocoptArgumentError& error) {
+				throw request_error(std::string{"Unable to parse the request. "} + error.what() + ".");
+			}
+
+			if(args["fitmicrodt"].asBool() || args["fitmcmicro"].asBool()) {
+				fit<float_t>(fd, args, pool, images, maps, diffencs);
+			} else if(args["stats"].asBool()) {
+				std::ostringstream sout;
+				sout << "stats threads " << pool.size() << " images " << images.size()+maps.size() << " diffencs " << diffencs.size()
+						<< " hits " << images.hits()+maps.hits()+diffencs.hits() << " misses " << images.misses()+maps.misses()+diffencs.misses() << "\n"
+						<< "done 0\n";
+				send_all(fd, sout.str());
+			} else if(args["shutdown"].asBool()) {
+				send_all(fd, "done 0\n");
+				stop = 1;
+			}
+		} catch(const request_error& error) {
+			send_all(fd, std::string{"error "} + error.what() + "\n");
+		} catch(const std::exception& error) {
+			send_all(fd, std::string{"error Unable to serve the request. "} + error.what() + "\n");
+		}
+	}
+}
+
+} // (anonymous)
+
+int main(int argc, const char** argv) {
+
+	typedef double float_t;
+
+	// Input
+
+	std::map<std::string, docopt::value> args = smt::docopt(USAGE, {argv+1, argv+argc}, true, VERSION);
+	if(args["--license"].asBool()) {
+		std::cout << LICENSE << std::endl;
+		return EXIT_SUCCESS;
+	}
+
+	std::istringstream sin(args["--cache"].asString());
+	long int capacity;
+	if(! (sin >> capacity) || ! sin.eof() || capacity < 0) {
+		smt::error("Unable to parse ‘" + args["--cache"].asString() + "’.");
+		return EXIT_FAILURE;
+	}
+
+	std::istringstream sin_timeout(args["--timeout"].asString());
+	long int timeout;
+	if(! (sin_timeout >> timeout) || ! sin_timeout.eof() || timeout <= 0) {
+		smt::error("Unable to parse ‘" + args["--timeout"].asString() + "’.");
+		return EXIT_FAILURE;
+	}
+
+	const std::string path = args["<socket>"].asString();
+	sockaddr_un addr;
+	addr.sun_family = AF_UNIX;
+	if(path.size() >= sizeof(addr.sun_path)) {
+		smt::error("‘" + path + "’ is too long for a socket name.");
+		return EXIT_FAILURE;
+	}
+	std::copy(path.begin(), path.end(), addr.sun_path);
+	addr.sun_path[path.size()] = '\0';
+
+	// A socket left behind by a server which has terminated is replaced, one
+	// which accepts connections is not.
+	struct stat st;
+	if(::lstat(path.c_str(), &st) == 0) {
+		const int probe_fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+		const bool in_use = S_ISSOCK(st.st_mode) && probe_fd >= 0 && ::connect(probe_fd, reinterpret_cast<const sockaddr*>(&addr), sizeof(addr)) == 0;
+		if(probe_fd >= 0) {
+			::close(probe_fd);
+		}
+		if(! S_ISSOCK(st.st_mode) || in_use) {
+			smt::error("‘" + path + "’ is in use.");
+			return EXIT_FAILURE;
+		}
+		::unlink(path.c_str());
+	}
+
+	const int listen_fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+	if(listen_fd < 0 || ::bind(listen_fd, reinterpret_cast<const sockaddr*>(&addr), sizeof(addr)) != 0 || ::listen(listen_fd, 16) != 0) {
+		smt::error("Unable to listen on ‘" + path + "’.");
+		return EXIT_FAILURE;
+	}
+
+	struct sigaction action;
+	action.sa_handler = handle_signal;
+	sigemptyset(&action.sa_mask);
+	action.sa_flags = 0;
+	sigaction(SIGINT, &action, nullptr);
+	sigaction(SIGTERM, &action, nullptr);
+	std::signal(SIGPIPE, SIG_IGN);
+
+	// Processing
+
+	smt::threadpool pool(smt::threads());
+	cache<smt::inifti<float_t, 4>> images(capacity);
+	cache<smt::inifti<float_t, 3>> maps(capacity);
+	cache<smt::diffenc<float_t>> diffencs(capacity);
+
+	// The clients are served one after the other, each with all threads. A
+	// client which neither sends nor receives for the timeout is disconnected,
+	// such that it cannot hold up the clients queued behind it.
+	timeval tv;
+	tv.tv_sec = timeout;
+	tv.tv_usec = 0;
+	while(! stop) {
+		const int fd = ::accept(listen_fd, nullptr, nullptr);
+		if(fd < 0) {
+			if(errno == EINTR || errno == ECONNABORTED) {
+				continue;
+			}
+			smt::error("Unable to accept connections on ‘" + path + "’.");
+			break;
+		}
+		if(::setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)) != 0 || ::setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv)) != 0) {
+			::close(fd);
+			continue;
+		}
+		serve<float_t>(fd, pool, images, maps, diffencs);
+		::close(fd);
+	}
+
+	::close(listen_fd);
+	::unlink(path.c_str());
+
+	return EXIT_SUCCESS;
+}
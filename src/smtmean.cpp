@@ -0,0 +1,276 @@
+//
+// Copyright (c) 2018 Enrico Kaden & University College London
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// * Redistributions of source code must retain the above copyright notice, this
+//   list of conditions and the following disclaimer.
+//
+// * Redistributions in binary form must reproduce the above copyright notice,
+//   this list of conditions and the following disclaimer in the documentation
+//   and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#include <cstdlib>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <tuple>
+
+#include "cartesianrange.h"
+#include "darray.h"
+#include "debug.h"
+#include "diffenc.h"
+#include "nifti.h"
+#include "opts.h"
+#include "parfor.h"
+#include "pow.h"
+#include "profile.h"
+#include "progress.h"
+#include "ricedebias.h"
+#include "version.h"
+
+static const char VERSION[] = R"(smtmean)" " " STR(SMT_VERSION_STRING);
+
+static const char LICENSE[] = R"(
+Copyright (c) 2018 Enrico Kaden & University College London
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+)";
+
+static const char USAGE[] = R"(
+SPHERICAL MEANS OF DIFFUSION DATA PER SHELL
+
+Copyright (c) 2018 Enrico Kaden & University College London
+
+Usage:
+  smtmean [options] <input> <output> <shells>
+  smtmean (-h | --help)
+  smtmean --license
+  smtmean --version
+
+Options:
+  --bvals <bvals>        Diffusion weighting factors (s/mm²) in FSL format
+  --bvecs <bvecs>        Diffusion gradient directions in FSL format
+  --grads <grads>        Diffusion gradients (s/mm²) in MRtrix format
+  --mask <mask>          Foreground mask [default: none]
+  --rician <rician>      Rician noise [default: none]
+  --shelltol <shelltol>  Tolerance (s/mm²) for grouping b-values into shells [default: 0]
+  --var <var>            Variance per shell [default: none]
+  -h, --help             Help screen
+  --license              License information
+  --version              Software version
+)";
+
+template <typename float_t>
+smt::diffenc<float_t> read_diffenc(std::map<std::string, docopt::value>& args) {
+	if(args["--bvals"] && args["--bvecs"] && !args["--grads"]) {
+		return smt::diffenc<float_t>(args["--bvals"].asString(), args["--bvecs"].asString());
+	} else if(!args["--bvals"] && !args["--bvecs"] && args["--grads"]) {
+		return smt::diffenc<float_t>(args["--grads"].asString());
+	} else {
+		smt::error("Either --bvals <bvals>, --bvecs <bvecs> or --grads <grads> are required.");
+		std::exit(EXIT_FAILURE);
+	}
+}
+
+template <typename float_t>
+smt::inifti<float_t, 3> read_mask(std::map<std::string, docopt::value>& args) {
+	if(args["--mask"] && args["--mask"].asString() != "none") {
+		return smt::inifti<float_t, 3>(args["--mask"].asString());
+	} else {
+		return smt::inifti<float_t, 3>();
+	}
+}
+
+template <typename float_t>
+std::tuple<float_t, smt::inifti<float_t, 3>> read_rician(std::map<std::string, docopt::value>& args) {
+	if(args["--rician"] && args["--rician"].asString() != "none") {
+		std::istringstream sin(args["--rician"].asString());
+		float_t scalar;
+		if(! (sin >> scalar)) {
+			return std::make_tuple(float_t(0), smt::inifti<float_t, 3>(args["--rician"].asString()));
+		} else {
+			return std::make_tuple(scalar, smt::inifti<float_t, 3>());
+		}
+	} else {
+		return std::make_tuple(float_t(0), smt::inifti<float_t, 3>());
+	}
+}
+
+template <typename float_t>
+float_t read_shelltol(std::map<std::string, docopt::value>& args) {
+	if(args["--shelltol"]) {
+		std::istringstream sin(args["--shelltol"].asString());
+		float_t shelltol;
+		if(! (sin >> shelltol) || shelltol < float_t(0)) {
+			smt::error("Unable to parse ‘" + args["--shelltol"].asString() + "’.");
+			std::exit(EXIT_FAILURE);
+		} else {
+			return shelltol;
+		}
+	} else {
+		return float_t(0);
+	}
+}
+
+int main(int argc, const char** argv) {
+
+	typedef double float_t;
+
+	// Input
+
+	std::map<std::string, docopt::value> args = smt::docopt(USAGE, {argv+1, argv+argc}, true, VERSION);
+	if(args["--license"].asBool()) {
+		std::cout << LICENSE << std::endl;
+		return EXIT_SUCCESS;
+	}
+
+	const smt::inifti<float_t, 4> input(args["<input>"].asString());
+
+	const smt::diffenc<float_t> dw = read_diffenc<float_t>(args);
+	if(input.size(3) != dw.mapping.size(0)) {
+		if(args["--bvals"] && args["--bvecs"] && !args["--grads"]) {
+			smt::error("‘" + args["<input>"].asString() + "’ and ‘" + args["--bvals"].asString() + "’ and/or ‘" + args["--bvecs"].asString() + "’ do not match.");
+		} else {
+			smt::error("‘" + args["<input>"].asString() + "’ and ‘" + args["--grads"].asString() + "’ do not match.");
+		}
+		return EXIT_FAILURE;
+	}
+
+	const smt::inifti<float_t, 3> mask = read_mask<float_t>(args);
+	if(mask) {
+		if(input.size(0) != mask.size(0) || input.size(1) != mask.size(1) || input.size(2) != mask.size(2)) {
+			smt::error("‘" + args["<input>"].asString() + "’ and ‘" + args["--mask"].asString() + "’ do not match.");
+			return EXIT_FAILURE;
+		}
+		if(input.pixsize(0) != mask.pixsize(0) || input.pixsize(1) != mask.pixsize(1) || input.pixsize(2) != mask.pixsize(2)) {
+			smt::error("The pixel sizes of ‘" + args["<input>"].asString() + "’ and ‘" + args["--mask"].asString() + "’ do not match.");
+			return EXIT_FAILURE;
+		}
+		if(! input.has_equal_spatial_coords(mask)) {
+			smt::error("The coordinate systems of ‘" + args["<input>"].asString() + "’ and ‘" + args["--mask"].asString() + "’ do not match.");
+			return EXIT_FAILURE;
+		}
+	}
+
+	const std::tuple<float_t, smt::inifti<float_t, 3>> rician = read_rician<float_t>(args);
+	if(std::get<1>(rician)) {
+		if(input.size(0) != std::get<1>(rician).size(0) || input.size(1) != std::get<1>(rician).size(1) || input.size(2) != std::get<1>(rician).size(2)) {
+			smt::error("‘" + args["<input>"].asString() + "’ and ‘" + args["--rician"].asString() + "’ do not match.");
+			return EXIT_FAILURE;
+		}
+		if(input.pixsize(0) != std::get<1>(rician).pixsize(0) || input.pixsize(1) != std::get<1>(rician).pixsize(1) || input.pixsize(2) != std::get<1>(rician).pixsize(2)) {
+			smt::error("The pixel sizes of ‘" + args["<input>"].asString() + "’ and ‘" + args["--rician"].asString() + "’ do not match.");
+			return EXIT_FAILURE;
+		}
+		if(! input.has_equal_spatial_coords(std::get<1>(rician))) {
+			smt::error("The coordinate systems of ‘" + args["<input>"].asString() + "’ and ‘" + args["--rician"].asString() + "’ do not match.");
+			return EXIT_FAILURE;
+		}
+	}
+
+	const float_t shelltol = read_shelltol<float_t>(args);
+	const smt::shells<float_t> shells(dw, shelltol);
+
+	// Processing
+
+	if(! shells.write(args["<shells>"].asString())) {
+		return EXIT_FAILURE;
+	}
+
+	smt::onifti<float, 4> output(args["<output>"].asString(), input, input.size(0), input.size(1), input.size(2), shells.size());
+	smt::onifti<float, 4> output_var = (args["--var"] && args["--var"].asString() != "none")? smt::onifti<float, 4>(args["--var"].asString(), input, input.size(0), input.size(1), input.size(2), shells.size()) : smt::onifti<float, 4>();
+
+	const unsigned int nthreads = smt::threads();
+	const std::size_t chunk = 1;
+
+	// Per-thread scratch space, such that the voxel loop does not allocate.
+	smt::darray<float_t, 2> input_buf(nthreads, input.size(3));
+
+	smt::profile_stage profile_process("process", input.size(0)*input.size(1)*input.size(2));
+
+	smt::progress p{input.size(0)*input.size(1)*input.size(2), nthreads, "smtmean"};
+	smt::parfor(smt::cartesianrange<2>(input.size(2), input.size(1)), [&](const std::size_t kk, const std::size_t jj, const unsigned int tt = 0) {
+		for(std::size_t ii = 0; ii < input.size(0); ++ii) {
+			if((! mask) || mask(ii, jj, kk) > 0) {
+				const smt::darray_view<float_t, 1> input_tmp(input.size(3), input_buf.begin()+tt*input.size(3));
+				input.gather(ii, jj, kk, smt::slice(0, input.size(3)), input_tmp);
+				if(std::get<1>(rician)) {
+					for(std::size_t ll = 0; ll < input.size(3); ++ll) {
+						input_tmp(ll) = smt::ricedebias(input_tmp(ll), std::get<1>(rician)(ii, jj, kk));
+					}
+				} else {
+					if(std::get<0>(rician) > float_t(0)) {
+						for(std::size_t ll = 0; ll < input.size(3); ++ll) {
+							input_tmp(ll) = smt::ricedebias(input_tmp(ll), std::get<0>(rician));
+						}
+					}
+				}
+
+				for(std::size_t ss = 0; ss < shells.size(); ++ss) {
+					float_t mean = 0;
+					for(std::size_t mm = shells.offsets(ss); mm < shells.offsets(ss+1); ++mm) {
+						mean += input_tmp(shells.members(mm));
+					}
+					mean /= shells.counts(ss);
+					output(ii, jj, kk, ss) = mean;
+
+					// Sample variance about the shell mean
+					if(output_var) {
+						float_t var = 0;
+						for(std::size_t mm = shells.offsets(ss); mm < shells.offsets(ss+1); ++mm) {
+							var += smt::pow2(input_tmp(shells.members(mm))-mean);
+						}
+						output_var(ii, jj, kk, ss) = (shells.counts(ss) > 1)? var/(shells.counts(ss)-1) : 0;
+					}
+				}
+			} else {
+				for(std::size_t ss = 0; ss < shells.size(); ++ss) {
+					output(ii, jj, kk, ss) = 0;
+					if(output_var) {
+						output_var(ii, jj, kk, ss) = 0;
+					}
+				}
+			}
+			p.increment(tt);
+		}
+	}, nthreads, chunk);
+	profile_process.stop();
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,384 @@
+//
+// Copyright (c) 2018 Enrico Kaden & University College London
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// * Redistributions of source code must retain the above copyright notice, this
+//   list of conditions and the following disclaimer.
+//
+// * Redistributions in binary form must reproduce the above copyright notice,
+//   this list of conditions and the following disclaimer in the documentation
+//   and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <map>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "darray.h"
+#include "debug.h"
+#include "fmt.h"
+#include "meansignal.h"
+#include "nifti.h"
+#include "opts.h"
+#include "pow.h"
+#include "sarray.h"
+#include "version.h"
+
+static const char VERSION[] = R"(smtphantom)" " " STR(SMT_VERSION_STRING);
+
+static const char LICENSE[] = R"(
+Copyright (c) 2018 Enrico Kaden & University College London
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+)";
+
+static const char USAGE[] = R"(
+SYNTHETIC DIFFUSION MRI PHANTOM
+
+Copyright (c) 2018 Enrico Kaden & University College London
+
+Usage:
+  smtphantom [options] <output> <bvals> <bvecs>
+  smtphantom (-h | --help)
+  smtphantom --license
+  smtphantom --version
+
+Options:
+  --size <size>          Image size, separated by commas [default: 32,32,16]
+  --model <model>        Tissue model, microdt or mcmicro [default: microdt]
+  --shells <shells>      Nonzero b-values (s/mm²), separated by commas [default: 1000,2000,3000]
+  --ndirs <ndirs>        Gradient directions per shell [default: 30]
+  --nb0 <nb0>            Measurements with zero b-value [default: 5]
+  --snr <snr>            Signal-to-noise ratio of the zero b-value signal [default: 50]
+  --noise <noise>        Noise model, gaussian, rician or none [default: rician]
+  --graddev <graddev>    Magnitude of the gradient deviation [default: 0]
+  --seed <seed>          Seed of the random number generator [default: 0]
+  -h, --help             Help screen
+  --license              License information
+  --version              Software version
+)";
+
+// Zero b-value signal of the phantom, to which the noise level refers.
+static const double S0 = 1000;
+
+std::vector<std::size_t> read_size(std::map<std::string, docopt::value>& args) {
+	std::vector<std::size_t> size;
+	std::istringstream sin(args["--size"].asString());
+	std::string str;
+	while(std::getline(sin, str, ',')) {
+		std::istringstream sin_str(str);
+		long int tmp;
+		if(! (sin_str >> tmp) || tmp <= 0 || ! sin_str.eof()) {
+			smt::error("Unable to parse ‘" + args["--size"].asString() + "’.");
+			std::exit(EXIT_FAILURE);
+		}
+		size.push_back(tmp);
+	}
+	if(size.size() != 3) {
+		smt::error("Unable to parse ‘" + args["--size"].asString() + "’.");
+		std::exit(EXIT_FAILURE);
+	}
+
+	return size;
+}
+
+template <typename float_t>
+std::vector<float_t> read_shells(std::map<std::string, docopt::value>& args) {
+	std::vector<float_t> shells;
+	std::istringstream sin(args["--shells"].asString());
+	std::string str;
+	while(std::getline(sin, str, ',')) {
+		std::istringstream sin_str(str);
+		float_t tmp;
+		if(! (sin_str >> tmp) || tmp <= float_t(0) || ! sin_str.eof()) {
+			smt::error("Unable to parse ‘" + args["--shells"].asString() + "’.");
+			std::exit(EXIT_FAILURE);
+		}
+		shells.push_back(tmp);
+	}
+	if(shells.empty()) {
+		smt::error("Unable to parse ‘" + args["--shells"].asString() + "’.");
+		std::exit(EXIT_FAILURE);
+	}
+
+	return shells;
+}
+
+std::size_t read_count(std::map<std::string, docopt::value>& args, const std::string& name, const long int& min) {
+	std::istringstream sin(args[name].asString());
+	long int count;
+	if(! (sin >> count) || count < min) {
+		smt::error("Unable to parse ‘" + args[name].asString() + "’.");
+		std::exit(EXIT_FAILURE);
+	}
+
+	return count;
+}
+
+template <typename float_t>
+float_t read_nonnegative(std::map<std::string, docopt::value>& args, const std::string& name) {
+	std::istringstream sin(args[name].asString());
+	float_t val;
+	if(! (sin >> val) || val < float_t(0)) {
+		smt::error("Unable to parse ‘" + args[name].asString() + "’.");
+		std::exit(EXIT_FAILURE);
+	}
+
+	return val;
+}
+
+std::string read_choice(std::map<std::string, docopt::value>& args, const std::string& name, const std::vector<std::string>& choices) {
+	const std::string val = args[name].asString();
+	for(const std::string& choice : choices) {
+		if(val == choice) {
+			return val;
+		}
+	}
+	smt::error("Unable to parse ‘" + val + "’.");
+	std::exit(EXIT_FAILURE);
+
+	return {}; // unreachable
+}
+
+// Approximately uniform gradient directions on the hemisphere, following a
+// spherical Fibonacci lattice, which is rotated about the z-axis by offset.
+template <typename float_t>
+smt::sarray<float_t, 3> direction(const std::size_t& ii, const std::size_t& n, const float_t& offset) {
+	const float_t golden = float_t(M_PI)*(float_t(3)-std::sqrt(float_t(5)));
+	const float_t z = float_t(1)-(ii+float_t(0.5))/n;
+	const float_t r = std::sqrt(float_t(1)-z*z);
+	const float_t phi = golden*ii+offset;
+	smt::sarray<float_t, 3> g;
+	g(0) = r*std::cos(phi);
+	g(1) = r*std::sin(phi);
+	g(2) = z;
+
+	return g;
+}
+
+// Random variates computed from the raw output of std::mt19937, which the
+// standard specifies exactly, unlike the distributions of <random>, such that
+// a seed gives the same phantom with every standard library.
+template <typename float_t>
+class variates {
+public:
+	explicit variates(const std::size_t& seed):
+		_rng(seed),
+		_cached(false),
+		_normal(0) {}
+
+	// Uniform on the open interval (0, 1)
+	float_t uniform() {
+		return (float_t(_rng())+float_t(0.5))/float_t(4294967296.0);
+	}
+
+	// Standard normal by the Box–Muller transform, of which the second
+	// variate is kept for the next call
+	float_t normal() {
+		if(_cached) {
+			_cached = false;
+			return _normal;
+		}
+		const float_t r = std::sqrt(-2*std::log(uniform()));
+		const float_t phi = 2*float_t(M_PI)*uniform();
+		_normal = r*std::sin(phi);
+		_cached = true;
+		return r*std::cos(phi);
+	}
+
+private:
+	std::mt19937 _rng;
+	bool _cached;
+	float_t _normal;
+};
+
+int main(int argc, const char** argv) {
+
+	typedef double float_t;
+
+	// Input
+
+	std::map<std::string, docopt::value> args = smt::docopt(USAGE, {argv+1, argv+argc}, true, VERSION);
+	if(args["--license"].asBool()) {
+		std::cout << LICENSE << std::endl;
+		return EXIT_SUCCESS;
+	}
+
+	const std::vector<std::size_t> size = read_size(args);
+	const std::string model = read_choice(args, "--model", {"microdt", "mcmicro"});
+	const std::vector<float_t> shells = read_shells<float_t>(args);
+	const std::size_t ndirs = read_count(args, "--ndirs", 1);
+	const std::size_t nb0 = read_count(args, "--nb0", 0);
+	const float_t snr = read_nonnegative<float_t>(args, "--snr");
+	const std::string noise = read_choice(args, "--noise", {"gaussian", "rician", "none"});
+	const float_t graddev_mag = read_nonnegative<float_t>(args, "--graddev");
+	const std::size_t seed = read_count(args, "--seed", 0);
+
+	if(noise != "none" && snr == float_t(0)) {
+		smt::error("The signal-to-noise ratio must be positive.");
+		return EXIT_FAILURE;
+	}
+
+	const int split = smt::is_format_string(args["<output>"].asString());
+	if(split <= 0) {
+		smt::error("‘" + args["<output>"].asString() + "’ does not contain the placeholder {}.");
+		return EXIT_FAILURE;
+	}
+
+	// Processing
+
+	const std::size_t nmeas = nb0+shells.size()*ndirs;
+	smt::darray<float_t, 1> bvalues(nmeas);
+	smt::darray<smt::sarray<float_t, 3>, 1> gradients(nmeas);
+	for(std::size_t ll = 0; ll < nb0; ++ll) {
+		bvalues(ll) = 0;
+		gradients(ll) = float_t(0);
+	}
+	for(std::size_t ss = 0; ss < shells.size(); ++ss) {
+		for(std::size_t ll = 0; ll < ndirs; ++ll) {
+			bvalues(nb0+ss*ndirs+ll) = shells[ss];
+			gradients(nb0+ss*ndirs+ll) = direction<float_t>(ll, ndirs, ss*float_t(M_PI)/shells.size());
+		}
+	}
+
+	const smt::sarray<float, 3> pixsize(2.0f);
+	const std::string& output = args["<output>"].asString();
+	smt::onifti<float, 4> output_dwi(smt::format_string(output, "dwi"), pixsize, size[0], size[1], size[2], nmeas);
+	smt::onifti<float, 3> output_mask(smt::format_string(output, "mask"), pixsize, size[0], size[1], size[2]);
+	smt::onifti<float, 4> output_graddev(smt::format_string(output, "graddev"), pixsize, size[0], size[1], size[2], 9);
+	smt::onifti<float, 3> output_param0(smt::format_string(output, (model == "microdt")? "long" : "intra"), pixsize, size[0], size[1], size[2]);
+	smt::onifti<float, 3> output_param1(smt::format_string(output, (model == "microdt")? "trans" : "diff"), pixsize, size[0], size[1], size[2]);
+	smt::onifti<float, 3> output_b0(smt::format_string(output, "b0"), pixsize, size[0], size[1], size[2]);
+
+	// The parameters vary linearly along the x- and y-axes, whereas the zero
+	// b-value signal varies along the z-axis. The foreground is the ellipsoid
+	// inscribed in the image volume.
+	variates<float_t> rng(seed);
+	const float_t sigma = (noise == "none")? float_t(0) : S0/snr;
+	for(std::size_t kk = 0; kk < size[2]; ++kk) {
+		for(std::size_t jj = 0; jj < size[1]; ++jj) {
+			for(std::size_t ii = 0; ii < size[0]; ++ii) {
+				const float_t u0 = (size[0] > 1)? float_t(ii)/(size[0]-1) : float_t(0.5);
+				const float_t u1 = (size[1] > 1)? float_t(jj)/(size[1]-1) : float_t(0.5);
+				const float_t u2 = (size[2] > 1)? float_t(kk)/(size[2]-1) : float_t(0.5);
+				const bool fg = smt::pow2(2*u0-1)+smt::pow2(2*u1-1)+smt::pow2(2*u2-1) <= float_t(1);
+
+				smt::sarray<float_t, 3, 3> G;
+				for(std::size_t ll = 0; ll < 9; ++ll) {
+					G(ll%3, ll/3) = graddev_mag*(2*rng.uniform()-1);
+					output_graddev(ii, jj, kk, ll) = G(ll%3, ll/3);
+				}
+
+				float_t param0 = 0;
+				float_t param1 = 0;
+				float_t b0 = 0;
+				if(fg) {
+					if(model == "microdt") {
+						param0 = float_t(1.5e-3)+float_t(1.5e-3)*u0;
+						param1 = param0*(float_t(0.05)+float_t(0.5)*u1);
+					} else {
+						param0 = float_t(0.1)+float_t(0.8)*u0;
+						param1 = float_t(1.5e-3)+float_t(1.5e-3)*u1;
+					}
+					b0 = S0*(float_t(0.8)+float_t(0.4)*u2);
+				}
+				output_mask(ii, jj, kk) = fg;
+				output_param0(ii, jj, kk) = param0;
+				output_param1(ii, jj, kk) = param1;
+				output_b0(ii, jj, kk) = b0;
+
+				for(std::size_t ll = 0; ll < nmeas; ++ll) {
+					float_t signal = 0;
+					if(fg) {
+						const smt::sarray<float_t, 3> tmp = gradients(ll)+smt::gemv(G, gradients(ll));
+						const float_t bvalue = (bvalues(ll) == float_t(0))? float_t(0) : bvalues(ll)*smt::dot(tmp, tmp);
+						if(model == "microdt") {
+							signal = b0*smt::meansignal(bvalue, param0, param1);
+						} else {
+							signal = b0*(param0*smt::meansignal(bvalue, param1, float_t(0))
+									+(float_t(1)-param0)*smt::meansignal(bvalue, param1, (float_t(1)-param0)*param1));
+						}
+					}
+					if(noise == "gaussian") {
+						signal += sigma*rng.normal();
+					} else if(noise == "rician") {
+						const float_t re = signal+sigma*rng.normal();
+						const float_t im = sigma*rng.normal();
+						signal = std::sqrt(re*re+im*im);
+					}
+					output_dwi(ii, jj, kk, ll) = signal;
+				}
+			}
+		}
+	}
+
+	// Output
+
+	std::ofstream fout_bvals(args["<bvals>"].asString().c_str());
+	for(std::size_t ll = 0; ll < nmeas; ++ll) {
+		fout_bvals << ((ll > 0)? " " : "") << bvalues(ll);
+	}
+	fout_bvals << std::endl;
+	if(! fout_bvals.good()) {
+		smt::error("Unable to write ‘" + args["<bvals>"].asString() + "’.");
+		return EXIT_FAILURE;
+	}
+
+	std::ofstream fout_bvecs(args["<bvecs>"].asString().c_str());
+	fout_bvecs << std::setprecision(std::numeric_limits<float_t>::max_digits10);
+	for(std::size_t cc = 0; cc < 3; ++cc) {
+		for(std::size_t ll = 0; ll < nmeas; ++ll) {
+			fout_bvecs << ((ll > 0)? " " : "") << gradients(ll)(cc);
+		}
+		fout_bvecs << std::endl;
+	}
+	if(! fout_bvecs.good()) {
+		smt::error("Unable to write ‘" + args["<bvecs>"].asString() + "’.");
+		return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
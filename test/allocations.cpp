@@ -0,0 +1,271 @@
+//
+// Copyright (c) 2018 Enrico Kaden & University College London
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// * Redistributions of source code must retain the above copyright notice, this
+//   list of conditions and the following disclaimer.
+//
+// * Redistributions in binary form must reproduce the above copyright notice,
+//   this list of conditions and the following disclaimer in the documentation
+//   and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+// Counts the heap allocations of the per-voxel fit path, which must not
+// depend on the number of voxels fitted. Global operator new is replaced with
+// a counting version, and so is malloc on glibc, through which the darray
+// storage is allocated.
+
+#include <atomic>
+#include <cmath>
+#include <cstddef>
+#include <cstdlib>
+#include <functional>
+#include <limits>
+#include <new>
+#include <string>
+
+#include "darray.h"
+#include "debug.h"
+#include "diffenc.h"
+#include "fitmcmicro.h"
+#include "fitmicrodt.h"
+#include "meansignal.h"
+#include "nifti.h"
+#include "regions.h"
+#include "stats.h"
+#include "voxelcache.h"
+
+namespace {
+
+std::atomic<std::size_t> allocations(0);
+
+} // (anonymous)
+
+void* operator new(std::size_t n) {
+	++allocations;
+	void* const ptr = std::malloc(n > 0? n : 1);
+	if(ptr == nullptr) {
+		throw std::bad_alloc();
+	}
+
+	return ptr;
+}
+
+void* operator new[](std::size_t n) {
+	return operator new(n);
+}
+
+void* operator new(std::size_t n, const std::nothrow_t&) noexcept {
+	++allocations;
+	return std::malloc(n > 0? n : 1);
+}
+
+void* operator new[](std::size_t n, const std::nothrow_t&) noexcept {
+	return operator new(n, std::nothrow);
+}
+
+// Once the replacements are inlined, gcc pairs the std::free below with the
+// operator new of the caller and warns of a mismatch, although both sides are
+// replaced by this file and allocate with std::malloc.
+#if defined(__GNUC__) && !defined(__clang__) && __GNUC__ >= 11
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+
+void operator delete(void* ptr) noexcept {
+	std::free(ptr);
+}
+
+void operator delete[](void* ptr) noexcept {
+	std::free(ptr);
+}
+
+void operator delete(void* ptr, std::size_t) noexcept {
+	std::free(ptr);
+}
+
+void operator delete[](void* ptr, std::size_t) noexcept {
+	std::free(ptr);
+}
+
+void operator delete(void* ptr, const std::nothrow_t&) noexcept {
+	std::free(ptr);
+}
+
+void operator delete[](void* ptr, const std::nothrow_t&) noexcept {
+	std::free(ptr);
+}
+
+#if defined(__GNUC__) && !defined(__clang__) && __GNUC__ >= 11
+#pragma GCC diagnostic pop
+#endif
+
+#ifdef __GLIBC__
+extern "C" {
+
+void* __libc_malloc(std::size_t n);
+
+void* malloc(std::size_t n) {
+	++allocations;
+	return __libc_malloc(n);
+}
+
+} // extern "C"
+#endif // __GLIBC__
+
+typedef float float_t;
+
+namespace {
+
+const std::size_t nvoxels = 64;
+
+// Measurements of two shells and a zero b-value, with the gradient directions
+// spread over the sphere.
+smt::diffenc<float_t> encoding() {
+	const std::size_t n = 31;
+	float_t bvals[n];
+	float_t bvecs[3*n];
+	for(std::size_t ii = 0; ii < n; ++ii) {
+		bvals[ii] = (ii == 0)? 0 : ((ii%2 == 0)? 1000 : 2500);
+		const float_t z = float_t(1)-float_t(2*ii+1)/n;
+		const float_t phi = float_t(2.399963)*ii;
+		bvecs[3*ii+0] = std::sqrt(float_t(1)-z*z)*std::cos(phi);
+		bvecs[3*ii+1] = std::sqrt(float_t(1)-z*z)*std::sin(phi);
+		bvecs[3*ii+2] = z;
+	}
+
+	return smt::diffenc<float_t>(bvals, bvecs, n);
+}
+
+// Allocations of fit(vv) for vv = 0, ..., nn-1.
+std::size_t count(const std::function<void(std::size_t)>& fit, const std::size_t& nn) {
+	const std::size_t before = allocations.load();
+	for(std::size_t vv = 0; vv < nn; ++vv) {
+		fit(vv);
+	}
+
+	return allocations.load()-before;
+}
+
+// Fits nvoxels and 2*nvoxels voxels, after one voxel to warm up, and checks
+// that both take the same number of allocations.
+bool check(const std::string& name, const std::function<void(std::size_t)>& fit) {
+	fit(0);
+	const std::size_t n1 = count(fit, nvoxels);
+	const std::size_t n2 = count(fit, 2*nvoxels);
+	if(n1 != n2) {
+		smt::error(name + ": " + std::to_string(n1) + " allocations for " + std::to_string(nvoxels) + " voxels, but " + std::to_string(n2) + " for " + std::to_string(2*nvoxels) + " voxels.");
+		return false;
+	}
+
+	return true;
+}
+
+} // (anonymous)
+
+int main() {
+	const float_t maxdiff = 3.05e-3;
+	const smt::diffenc<float_t> dw = encoding();
+	const smt::shells<float_t> shells(dw);
+
+	// Signals of 2*nvoxels voxels with varying diffusivities and gradient
+	// deviations.
+	smt::darray<float_t, 2> input(2*nvoxels, dw.mapping.size());
+	smt::darray<float_t, 2> graddev(9, 2*nvoxels);
+	for(std::size_t vv = 0; vv < 2*nvoxels; ++vv) {
+		const float_t diff1 = (1+vv%7)*float_t(0.3e-3);
+		const float_t diff2 = (1+vv%3)*float_t(0.1e-3);
+		for(std::size_t ll = 0; ll < dw.mapping.size(); ++ll) {
+			input(vv, ll) = float_t(1000)*smt::meansignal(dw.bvalues(dw.mapping(ll)), diff1, diff2)*(float_t(1)+float_t(0.01)*std::sin(float_t(vv+ll)));
+		}
+		for(std::size_t ll = 0; ll < 9; ++ll) {
+			graddev(ll, vv) = (ll%4 == 0)? float_t(0.01)*(vv%5) : float_t(0.002)*(vv%3);
+		}
+	}
+	smt::darray<float_t, 2> scales(dw.mapping.size(), 2*nvoxels);
+	dw.scales_graddev(graddev, scales);
+	smt::darray<float_t, 1> scales_voxel(dw.mapping.size());
+
+	const auto signal = [&](const std::size_t& vv) {
+		return smt::darray_view<const float_t, 1>(dw.mapping.size(), input.begin()+vv*dw.mapping.size());
+	};
+	const auto scales_of = [&](const std::size_t& vv) {
+		for(std::size_t ll = 0; ll < dw.mapping.size(); ++ll) {
+			scales_voxel(ll) = scales(ll, vv);
+		}
+		return smt::darray_view<const float_t, 1>(scales_voxel);
+	};
+	const smt::sarray<float_t, 3> x0{float_t(2e-3), float_t(0.5e-3), float_t(1000)};
+	const smt::sarray<float_t, 3> y0{float_t(0.5), float_t(2e-3), float_t(1000)};
+
+	smt::sarray<float_t, 3> fit;
+	bool ok = true;
+	for(const bool b0: {false, true}) {
+		const std::string suffix = b0? " (b0)" : "";
+		ok = check("fitmicrodt" + suffix, [&](const std::size_t& vv) {
+			fit = smt::fitmicrodt<float_t>(signal(vv), dw.bvalues, dw.mapping, maxdiff, b0);
+		}) && ok;
+		ok = check("fitmicrodt shells" + suffix, [&](const std::size_t& vv) {
+			fit = smt::fitmicrodt<float_t>(signal(vv), shells, maxdiff, b0);
+		}) && ok;
+		ok = check("fitmicrodt graddev" + suffix, [&](const std::size_t& vv) {
+			fit = smt::fitmicrodt<float_t>(signal(vv), shells, scales_of(vv), maxdiff, b0);
+		}) && ok;
+		ok = check("fitmicrodt start" + suffix, [&](const std::size_t& vv) {
+			fit = smt::fitmicrodt<float_t>(x0, signal(vv), shells, scales_of(vv), maxdiff, b0);
+		}) && ok;
+		ok = check("fitmcmicro" + suffix, [&](const std::size_t& vv) {
+			fit = smt::fitmcmicro<float_t>(signal(vv), dw.bvalues, dw.mapping, maxdiff, b0);
+		}) && ok;
+		ok = check("fitmcmicro shells" + suffix, [&](const std::size_t& vv) {
+			fit = smt::fitmcmicro<float_t>(signal(vv), shells, maxdiff, b0);
+		}) && ok;
+		ok = check("fitmcmicro graddev" + suffix, [&](const std::size_t& vv) {
+			fit = smt::fitmcmicro<float_t>(signal(vv), shells, scales_of(vv), maxdiff, b0);
+		}) && ok;
+		ok = check("fitmcmicro start" + suffix, [&](const std::size_t& vv) {
+			fit = smt::fitmcmicro<float_t>(y0, signal(vv), shells, scales_of(vv), maxdiff, b0);
+		}) && ok;
+	}
+	smt::darray<float_t, 1> graddev_voxel(9);
+	ok = check("scales_graddev", [&](const std::size_t& vv) {
+		for(std::size_t ll = 0; ll < 9; ++ll) {
+			graddev_voxel(ll) = graddev(ll, vv);
+		}
+		const smt::darray_view<const float_t, 2> graddev_row(9, 1, graddev_voxel.begin());
+		const smt::darray_view<float_t, 2> scales_row(dw.mapping.size(), 1, scales_voxel.begin());
+		dw.scales_graddev(graddev_row, scales_row);
+	}) && ok;
+
+	const smt::regions regions(2*nvoxels, 1, 1, smt::inifti<float_t, 3>());
+	smt::regionstats stats({"long", "trans", "b0"}, regions);
+	ok = check("regionstats", [&](const std::size_t& vv) {
+		stats.insert(vv, 0, 0, 0, input(vv, 0));
+		stats.insert(vv, 0, 0, 1, std::numeric_limits<double>::quiet_NaN());
+		stats.insert(vv, 0, 0, 2, std::numeric_limits<double>::infinity());
+	}) && ok;
+
+	// The staging list is reserved for all the insertions of check, and the
+	// table is neither read nor written.
+	smt::voxelcache<float_t, 3> cache("allocations.vxc", 1);
+	cache.reserve(4*nvoxels);
+	ok = check("voxelcache", [&](const std::size_t& vv) {
+		cache.insert(vv, fit, 0);
+	}) && ok;
+
+	return ok? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,63 @@
+//
+// Copyright (c) 2018 Enrico Kaden & University College London
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// * Redistributions of source code must retain the above copyright notice, this
+//   list of conditions and the following disclaimer.
+//
+// * Redistributions in binary form must reproduce the above copyright notice,
+//   this list of conditions and the following disclaimer in the documentation
+//   and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+// Writes a map on the grid of a given image, whose voxels cycle through the
+// given values, e.g. nan, inf or -1, such that the tests can feed the tools
+// with maps that no tool writes.
+//
+// Usage: fillmap <like> <output> <value>...
+
+#include <cstddef>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include "debug.h"
+#include "nifti.h"
+
+int main(int argc, char* argv[]) {
+	if(argc < 4) {
+		smt::error("Usage: fillmap <like> <output> <value>...");
+		return EXIT_FAILURE;
+	}
+	std::vector<float> values;
+	for(int ii = 3; ii < argc; ++ii) {
+		values.push_back(std::strtof(argv[ii], nullptr));
+	}
+
+	const smt::inifti<float, 3> like(argv[1]);
+	smt::onifti<float, 3> output(argv[2], like, like.size(0), like.size(1), like.size(2));
+	std::size_t nn = 0;
+	for(std::size_t kk = 0; kk < like.size(2); ++kk) {
+		for(std::size_t jj = 0; jj < like.size(1); ++jj) {
+			for(std::size_t ii = 0; ii < like.size(0); ++ii) {
+				output(ii, jj, kk) = values[nn++%values.size()];
+			}
+		}
+	}
+
+	return EXIT_SUCCESS;
+}
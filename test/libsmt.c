@@ -0,0 +1,208 @@
+//
+// Copyright (c) 2018 Enrico Kaden & University College London
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// * Redistributions of source code must retain the above copyright notice, this
+//   list of conditions and the following disclaimer.
+//
+// * Redistributions in binary form must reproduce the above copyright notice,
+//   this list of conditions and the following disclaimer in the documentation
+//   and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "nifti1.h"
+#include "smt.h"
+
+/*
+ * Client of the C interface of libsmt, which fits the microscopic diffusion
+ * tensor to the phantom and writes the maps, such that the test compares them
+ * with the output of fitmicrodt. The input is passed volume-major and the
+ * output voxel-major. Protocols with non-finite values must be rejected. The
+ * images are uncompressed single-file NIfTI-1 of float32, as smtphantom
+ * writes them.
+ *
+ * Usage: test_libsmt <dwi> <mask> <bvals> <bvecs> <output>
+ */
+
+static float* read_nifti(const char* filename, nifti_1_header* header) {
+	FILE* fin = fopen(filename, "rb");
+	float* data = NULL;
+	size_t n = 1;
+	int ii;
+	if(fin == NULL || fread(header, sizeof(nifti_1_header), 1, fin) != 1 || header->datatype != NIFTI_TYPE_FLOAT32
+			|| (header->scl_slope != 0 && (header->scl_slope != 1 || header->scl_inter != 0))) {
+		fprintf(stderr, "Unable to read '%s'.\n", filename);
+		exit(EXIT_FAILURE);
+	}
+	for(ii = 1; ii <= header->dim[0]; ++ii) {
+		n *= header->dim[ii];
+	}
+	data = (float*)malloc(n*sizeof(float));
+	if(data == NULL || fseek(fin, (long)header->vox_offset, SEEK_SET) != 0 || fread(data, sizeof(float), n, fin) != n) {
+		fprintf(stderr, "Unable to read '%s'.\n", filename);
+		exit(EXIT_FAILURE);
+	}
+	fclose(fin);
+
+	return data;
+}
+
+/* Values of a text file in row-major order */
+static size_t read_values(const char* filename, double* values, size_t n) {
+	FILE* fin = fopen(filename, "r");
+	size_t ii = 0;
+	if(fin == NULL) {
+		fprintf(stderr, "Unable to read '%s'.\n", filename);
+		exit(EXIT_FAILURE);
+	}
+	while(ii < n && fscanf(fin, "%lf", &values[ii]) == 1) {
+		++ii;
+	}
+	fclose(fin);
+
+	return ii;
+}
+
+int main(int argc, char* argv[]) {
+	nifti_1_header header, mask_header;
+	float *input_buf, *mask_buf, *output_buf;
+	double *bvals, *bvecs, *bad;
+	size_t nx, ny, nz, nmeas, ii, jj, kk, ll;
+	const size_t nparams = 6;
+	smt_array input, mask;
+	smt_mutable_array output;
+	smt_options options;
+	FILE* fout;
+	int code, ok = 1;
+	const double values[2] = {NAN, INFINITY};
+
+	if(argc != 6) {
+		fprintf(stderr, "Usage: test_libsmt <dwi> <mask> <bvals> <bvecs> <output>\n");
+		return EXIT_FAILURE;
+	}
+	input_buf = read_nifti(argv[1], &header);
+	mask_buf = read_nifti(argv[2], &mask_header);
+	nx = header.dim[1];
+	ny = header.dim[2];
+	nz = header.dim[3];
+	nmeas = header.dim[4];
+
+	/* FSL protocol: one row of b-values and three rows of gradient components */
+	bvals = (double*)malloc(nmeas*sizeof(double));
+	bvecs = (double*)malloc(3*nmeas*sizeof(double));
+	bad = (double*)malloc(3*nmeas*sizeof(double));
+	if(read_values(argv[3], bvals, nmeas) != nmeas || read_values(argv[4], bad, 3*nmeas) != 3*nmeas) {
+		fprintf(stderr, "The protocol does not match '%s'.\n", argv[1]);
+		return EXIT_FAILURE;
+	}
+	for(ll = 0; ll < nmeas; ++ll) {
+		for(ii = 0; ii < 3; ++ii) {
+			bvecs[3*ll+ii] = bad[ii*nmeas+ll];
+		}
+	}
+
+	input.data = input_buf;
+	mask.data = mask_buf;
+	input.size[0] = mask.size[0] = nx;
+	input.size[1] = mask.size[1] = ny;
+	input.size[2] = mask.size[2] = nz;
+	input.size[3] = nmeas;
+	mask.size[3] = 1;
+	input.stride[0] = mask.stride[0] = 1;
+	input.stride[1] = mask.stride[1] = (ptrdiff_t)nx;
+	input.stride[2] = mask.stride[2] = (ptrdiff_t)(nx*ny);
+	input.stride[3] = mask.stride[3] = (ptrdiff_t)(nx*ny*nz);
+
+	output_buf = (float*)malloc(nx*ny*nz*nparams*sizeof(float));
+	output.data = output_buf;
+	output.size[0] = nx;
+	output.size[1] = ny;
+	output.size[2] = nz;
+	output.size[3] = nparams;
+	output.stride[0] = (ptrdiff_t)nparams;
+	output.stride[1] = (ptrdiff_t)(nparams*nx);
+	output.stride[2] = (ptrdiff_t)(nparams*nx*ny);
+	output.stride[3] = 1;
+
+	smt_default_options(&options);
+	options.bvals = bvals;
+	options.bvecs = bvecs;
+	options.nmeas = nmeas;
+	options.mask = &mask;
+	options.nthreads = 2;
+
+	for(ii = 0; ii < 2; ++ii) {
+		memcpy(bad, bvals, nmeas*sizeof(double));
+		bad[nmeas/2] = values[ii];
+		options.bvals = bad;
+		if(smt_fitmicrodt(&input, &options, &output) != SMT_ERROR_PROTOCOL) {
+			fprintf(stderr, "A b-value of %g is not rejected.\n", values[ii]);
+			ok = 0;
+		}
+		options.bvals = bvals;
+
+		memcpy(bad, bvecs, 3*nmeas*sizeof(double));
+		bad[3*(nmeas/2)+1] = values[ii];
+		options.bvecs = bad;
+		if(smt_fitmicrodt(&input, &options, &output) != SMT_ERROR_PROTOCOL) {
+			fprintf(stderr, "A gradient component of %g is not rejected.\n", values[ii]);
+			ok = 0;
+		}
+		options.bvecs = bvecs;
+	}
+
+	code = smt_fitmicrodt(&input, &options, &output);
+	if(code != SMT_SUCCESS) {
+		fprintf(stderr, "smt_fitmicrodt: %s\n", smt_strerror(code));
+		return EXIT_FAILURE;
+	}
+
+	/* The maps are written volume-major, with the header of the input */
+	for(kk = 0; kk < nz; ++kk) {
+		for(jj = 0; jj < ny; ++jj) {
+			for(ii = 0; ii < nx; ++ii) {
+				for(ll = 0; ll < nparams; ++ll) {
+					input_buf[ii+nx*(jj+ny*(kk+nz*ll))] = output_buf[ll+nparams*(ii+nx*(jj+ny*kk))];
+				}
+			}
+		}
+	}
+	header.dim[4] = (short)nparams;
+	header.vox_offset = 352;
+	header.scl_slope = 1;
+	header.scl_inter = 0;
+	fout = fopen(argv[5], "wb");
+	if(fout == NULL || fwrite(&header, sizeof(nifti_1_header), 1, fout) != 1 || fwrite("\0\0\0\0", 1, 4, fout) != 4
+			|| fwrite(input_buf, sizeof(float), nx*ny*nz*nparams, fout) != nx*ny*nz*nparams || fclose(fout) != 0) {
+		fprintf(stderr, "Unable to write '%s'.\n", argv[5]);
+		return EXIT_FAILURE;
+	}
+
+	free(output_buf);
+	free(bad);
+	free(bvecs);
+	free(bvals);
+	free(mask_buf);
+	free(input_buf);
+
+	return ok? EXIT_SUCCESS : EXIT_FAILURE;
+}
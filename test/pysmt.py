@@ -0,0 +1,116 @@
+#
+# Copyright (c) 2018 Enrico Kaden & University College London
+# All rights reserved.
+#
+# Redistribution and use in source and binary forms, with or without
+# modification, are permitted provided that the following conditions are met:
+#
+# * Redistributions of source code must retain the above copyright notice, this
+#   list of conditions and the following disclaimer.
+#
+# * Redistributions in binary form must reproduce the above copyright notice,
+#   this list of conditions and the following disclaimer in the documentation
+#   and/or other materials provided with the distribution.
+#
+# THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+# AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+# IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+# DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+# FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+# DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+# SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+# CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+# OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+# OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+# Fits the phantom through the Python module and writes the maps, which the
+# test compares with the output of fitmicrodt. The images are uncompressed
+# single-file NIfTI-1 of float32, as smtphantom writes them, and are passed as
+# voxel-major memoryviews, such that NumPy is not required. Protocols with
+# non-finite values must raise ValueError.
+#
+# Usage: pysmt.py <dwi> <mask> <bvals> <bvecs> <output>
+
+import array
+import struct
+import sys
+
+import smt
+
+
+def read_nifti(filename):
+    with open(filename, "rb") as fin:
+        data = fin.read()
+    dims = struct.unpack_from("<8h", data, 40)
+    offset = int(struct.unpack_from("<f", data, 108)[0])
+    shape = [dims[ii] if ii <= dims[0] else 1 for ii in range(1, 5)]
+    values = array.array("f")
+    values.frombytes(data[offset:offset+4*shape[0]*shape[1]*shape[2]*shape[3]])
+    if sys.byteorder != "little":
+        values.byteswap()
+    return data[:offset], shape, values
+
+
+# Voxel-major layout with the axes x, y, z and volumes, of an image whose
+# x-axis varies fastest
+def voxel_major(values, shape):
+    nx, ny, nz, nv = shape
+    out = array.array("f", bytes(4*len(values)))
+    for ll in range(nv):
+        for kk in range(nz):
+            for jj in range(ny):
+                for ii in range(nx):
+                    out[((ii*ny+jj)*nz+kk)*nv+ll] = values[ii+nx*(jj+ny*(kk+nz*ll))]
+    return memoryview(out).cast("B").cast("f", shape)
+
+
+def read_rows(filename):
+    with open(filename) as fin:
+        return [[float(value) for value in line.split()] for line in fin if line.strip()]
+
+
+def main(dwi_name, mask_name, bvals_name, bvecs_name, output_name):
+    header, shape, values = read_nifti(dwi_name)
+    dwi = voxel_major(values, shape)
+    _, mask_shape, mask_values = read_nifti(mask_name)
+    mask = voxel_major(mask_values, mask_shape[:3]+[1]).cast("B").cast("f", mask_shape[:3])
+    bvals = read_rows(bvals_name)[0]
+    bvecs = read_rows(bvecs_name)
+    bvecs = [[bvecs[dd][ll] for dd in range(3)] for ll in range(len(bvals))]
+
+    ok = True
+    for value in (float("nan"), float("inf")):
+        bad = list(bvals)
+        bad[len(bad)//2] = value
+        try:
+            smt.fitmicrodt(dwi, bad, bvecs, mask=mask)
+            print("A b-value of %g is not rejected." % value, file=sys.stderr)
+            ok = False
+        except ValueError:
+            pass
+
+    nx, ny, nz, _ = shape
+    nparams = 6
+    out = memoryview(array.array("f", bytes(4*nx*ny*nz*nparams))).cast("B").cast("f", [nx, ny, nz, nparams])
+    maps = smt.fitmicrodt(dwi, bvals, bvecs, mask=mask, nthreads=2, out=out)
+
+    # The maps are written volume-major, with the header of the input
+    output = array.array("f", bytes(4*nx*ny*nz*nparams))
+    for ll in range(nparams):
+        for kk in range(nz):
+            for jj in range(ny):
+                for ii in range(nx):
+                    output[ii+nx*(jj+ny*(kk+nz*ll))] = maps[ii, jj, kk, ll]
+    if sys.byteorder != "little":
+        output.byteswap()
+    header = bytearray(header)
+    struct.pack_into("<h", header, 48, nparams)
+    with open(output_name, "wb") as fout:
+        fout.write(header)
+        fout.write(output.tobytes())
+
+    return 0 if ok else 1
+
+
+if __name__ == "__main__":
+    sys.exit(main(*sys.argv[1:]))
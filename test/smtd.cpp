@@ -0,0 +1,287 @@
+//
+// Copyright (c) 2018 Enrico Kaden & University College London
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// * Redistributions of source code must retain the above copyright notice, this
+//   list of conditions and the following disclaimer.
+//
+// * Redistributions in binary form must reproduce the above copyright notice,
+//   this list of conditions and the following disclaimer in the documentation
+//   and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+// Starts smtd and drives it with a scripted client: a client which connects
+// and sends nothing must not hold up the next one, malformed and non-finite
+// protocols must be answered with an error, a fit of the phantom must match
+// the fitmicrodt reference, and the server must shut down on request.
+//
+// Usage: test_smtd <smtd> <socket> <data> <reference>
+
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <csignal>
+#include <cstddef>
+#include <cstdlib>
+#include <fstream>
+#include <iterator>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "debug.h"
+#include "nifti.h"
+
+namespace {
+
+pid_t server = -1;
+
+bool fail(const std::string& msg) {
+	smt::error(msg);
+	return false;
+}
+
+// Connection to the server, whose replies time out after 30 s, such that the
+// test fails rather than hangs.
+int connect_to(const std::string& path) {
+	sockaddr_un addr;
+	addr.sun_family = AF_UNIX;
+	std::copy(path.begin(), path.end(), addr.sun_path);
+	addr.sun_path[path.size()] = '\0';
+	const int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+	if(fd < 0 || ::connect(fd, reinterpret_cast<const sockaddr*>(&addr), sizeof(addr)) != 0) {
+		if(fd >= 0) {
+			::close(fd);
+		}
+		return -1;
+	}
+	timeval tv;
+	tv.tv_sec = 30;
+	tv.tv_usec = 0;
+	::setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+	return fd;
+}
+
+class client {
+public:
+	explicit client(const int& fd): _fd(fd) {}
+
+	bool send(const std::string& line) {
+		const std::string msg = line + "\n";
+		return ::send(_fd, msg.data(), msg.size(), MSG_NOSIGNAL) == ssize_t(msg.size());
+	}
+
+	// Next line of the reply, or false if the server has gone away.
+	bool receive(std::string& line) {
+		std::string::size_type eol;
+		char chunk[4096];
+		while((eol = _buffer.find('\n')) == std::string::npos) {
+			const ssize_t nn = ::recv(_fd, chunk, sizeof(chunk), 0);
+			if(nn < 0 && errno == EINTR) {
+				continue;
+			}
+			if(nn <= 0) {
+				return false;
+			}
+			_buffer.append(chunk, nn);
+		}
+		line = _buffer.substr(0, eol);
+		_buffer.erase(0, eol+1);
+		return true;
+	}
+
+	// Lines of the reply up to and including done or error.
+	bool request(const std::string& line, std::vector<std::string>& reply) {
+		reply.clear();
+		if(! send(line)) {
+			return false;
+		}
+		std::string tmp;
+		while(receive(tmp)) {
+			reply.push_back(tmp);
+			if(tmp.compare(0, 5, "done ") == 0 || tmp.compare(0, 6, "error ") == 0) {
+				return true;
+			}
+		}
+		return false;
+	}
+
+	~client() {
+		::close(_fd);
+	}
+
+private:
+	const int _fd;
+	std::string _buffer;
+};
+
+bool expect_error(client& cl, const std::string& line) {
+	std::vector<std::string> reply;
+	if(! cl.request(line, reply)) {
+		return fail("No reply to ‘" + line + "’.");
+	}
+	if(reply.size() != 1 || reply[0].compare(0, 6, "error ") != 0) {
+		return fail("‘" + line + "’ is not answered by an error.");
+	}
+	return true;
+}
+
+bool run(const std::string& path, const std::string& data, const std::string& reference) {
+	// The first client is accepted first and idles, the second one has to
+	// wait for the server to time out the first.
+	const int idle_fd = connect_to(path);
+	const int fd = connect_to(path);
+	if(idle_fd < 0 || fd < 0) {
+		return fail("Unable to connect to ‘" + path + "’.");
+	}
+	client idle(idle_fd);
+	client cl(fd);
+
+	std::vector<std::string> reply;
+	if(! cl.request("stats", reply) || reply.size() != 2 || reply[0].compare(0, 6, "stats ") != 0 || reply[1] != "done 0") {
+		return fail("The stats request behind an idle client is not served.");
+	}
+
+	// Protocols which are malformed or hold non-finite b-values, and a missing
+	// image
+	const std::string bvals = data + "/bvals";
+	const std::string bvecs = data + "/bvecs";
+	const std::string input = data + "/ph_dwi.nii";
+	const std::string mask = data + "/ph_mask.nii";
+	std::string line;
+	{
+		std::ifstream fin(bvals);
+		std::getline(fin, line);
+	}
+	std::istringstream sin(line);
+	std::vector<std::string> values{std::istream_iterator<std::string>(sin), std::istream_iterator<std::string>()};
+	std::ofstream(data + "/smtd_malformed_bvals") << "0 1000 abc\n";
+	values[values.size()/2] = "nan";
+	{
+		std::ofstream fout(data + "/smtd_nan_bvals");
+		for(const std::string& value: values) {
+			fout << value << ' ';
+		}
+		fout << '\n';
+	}
+	bool ok = expect_error(cl, "fitmicrodt --bvals " + data + "/smtd_malformed_bvals --bvecs " + bvecs + " " + input);
+	ok = expect_error(cl, "fitmicrodt --bvals " + data + "/smtd_nan_bvals --bvecs " + bvecs + " " + input) && ok;
+	ok = expect_error(cl, "fitmicrodt --bvals " + bvals + " --bvecs " + bvecs + " " + data + "/smtd_missing.nii") && ok;
+	ok = expect_error(cl, "fitmicrodt --bogus " + input) && ok;
+
+	// Fit of the phantom, voxel by voxel against the reference with the
+	// tolerances of the fitmicrodt test
+	if(! cl.request("fitmicrodt --bvals " + bvals + " --bvecs " + bvecs + " --mask " + mask + " " + input, reply)) {
+		return fail("No reply to the fit of the phantom.");
+	}
+	if(reply.front() != "fields ii jj kk long trans fa fapow3 md b0" || reply.back().compare(0, 5, "done ") != 0) {
+		return fail("The fit of the phantom is answered by ‘" + reply.back() + "’.");
+	}
+	const smt::inifti<float, 3> mask_image(mask);
+	const smt::inifti<float, 4> ref(reference);
+	const float abstol[6] = {1e-5, 1e-5, 1e-3, 1e-3, 1e-5, 0};
+	const float reltol[6] = {1e-3, 1e-3, 1e-3, 1e-3, 1e-3, 1e-4};
+	std::size_t nforeground = 0;
+	for(std::size_t ii = 0; ii < mask_image.size(); ++ii) {
+		nforeground += (mask_image[ii] > 0)? 1 : 0;
+	}
+	if(reply.size() != nforeground+2 || reply.back() != "done " + std::to_string(nforeground)) {
+		ok = fail("The fit of the phantom returns " + std::to_string(reply.size()-2) + " voxels instead of " + std::to_string(nforeground) + ".");
+	}
+	for(std::size_t vv = 1; vv+1 < reply.size(); ++vv) {
+		std::istringstream sin_voxel(reply[vv]);
+		std::size_t ii, jj, kk;
+		float x[6];
+		if(! (sin_voxel >> ii >> jj >> kk >> x[0] >> x[1] >> x[2] >> x[3] >> x[4] >> x[5]) || ii >= ref.size(0) || jj >= ref.size(1) || kk >= ref.size(2)) {
+			ok = fail("‘" + reply[vv] + "’ is malformed.");
+			continue;
+		}
+		for(std::size_t ll = 0; ll < 6; ++ll) {
+			const float b = ref(ii, jj, kk, ll);
+			if(std::abs(x[ll]-b) > abstol[ll]+reltol[ll]*std::abs(b)) {
+				ok = fail("‘" + reply[vv] + "’ does not match the reference.");
+				break;
+			}
+		}
+	}
+
+	if(! cl.request("shutdown", reply) || reply.size() != 1 || reply[0] != "done 0") {
+		return fail("The shutdown request is not acknowledged.");
+	}
+
+	return ok;
+}
+
+} // (anonymous)
+
+int main(int argc, char* argv[]) {
+	if(argc != 5) {
+		smt::error("Usage: test_smtd <smtd> <socket> <data> <reference>");
+		return EXIT_FAILURE;
+	}
+	const std::string path = argv[2];
+	::unlink(path.c_str());
+
+	server = ::fork();
+	if(server == 0) {
+		::execl(argv[1], argv[1], "--timeout", "1", path.c_str(), static_cast<char*>(nullptr));
+		std::_Exit(127);
+	}
+	if(server < 0) {
+		smt::error("Unable to start ‘" + std::string(argv[1]) + "’.");
+		return EXIT_FAILURE;
+	}
+
+	// The server is up once it accepts connections.
+	bool up = false;
+	for(int tries = 0; tries < 100 && ! up; ++tries) {
+		const int fd = connect_to(path);
+		if(fd >= 0) {
+			::close(fd);
+			up = true;
+		} else {
+			::usleep(100000);
+		}
+	}
+
+	bool ok = up? run(path, argv[3], argv[4]) : fail("‘" + path + "’ does not accept connections.");
+
+	// The server exits by itself after the shutdown request, otherwise it is
+	// terminated.
+	int status = 0;
+	pid_t done = 0;
+	for(int tries = 0; tries < 100 && done == 0; ++tries) {
+		done = ::waitpid(server, &status, WNOHANG);
+		if(done == 0) {
+			::usleep(100000);
+		}
+	}
+	if(done == 0) {
+		::kill(server, SIGKILL);
+		::waitpid(server, &status, 0);
+		ok = fail("The server does not shut down.");
+	} else if(! WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS) {
+		ok = fail("The server exits with an error.");
+	}
+
+	return ok? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,111 @@
+//
+// Copyright (c) 2018 Enrico Kaden & University College London
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// * Redistributions of source code must retain the above copyright notice, this
+//   list of conditions and the following disclaimer.
+//
+// * Redistributions in binary form must reproduce the above copyright notice,
+//   this list of conditions and the following disclaimer in the documentation
+//   and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+// Compares a text output, e.g. a region table or JSON statistics, with a
+// reference: the numbers have to agree within abstol+reltol*|reference| and
+// everything else exactly, such that the last digits may differ between
+// platforms.
+//
+// Usage: textcompare <input> <reference> <abstol> <reltol>
+
+#include <cctype>
+#include <cmath>
+#include <cstddef>
+#include <cstdlib>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+#include "debug.h"
+
+namespace {
+
+struct token {
+	bool number;
+	std::string text;
+};
+
+// Alternating runs of numbers and of other characters
+std::vector<token> tokens(const std::string& filename) {
+	std::ifstream fin(filename);
+	if(! fin) {
+		smt::error("Unable to read ‘" + filename + "’.");
+		std::exit(EXIT_FAILURE);
+	}
+	const std::string text{std::istreambuf_iterator<char>(fin), std::istreambuf_iterator<char>()};
+	std::vector<token> ret;
+	std::size_t pos = 0;
+	while(pos < text.size()) {
+		const char* const begin = text.c_str()+pos;
+		char* end;
+		std::strtod(begin, &end);
+		if(end != begin && (std::isdigit(static_cast<unsigned char>(*begin)) || *begin == '-' || *begin == '+' || *begin == '.')) {
+			ret.push_back(token{true, std::string(begin, static_cast<const char*>(end))});
+			pos += end-begin;
+		} else {
+			if(ret.empty() || ret.back().number) {
+				ret.push_back(token{false, std::string()});
+			}
+			ret.back().text += text[pos++];
+		}
+	}
+	return ret;
+}
+
+} // (anonymous)
+
+int main(int argc, char* argv[]) {
+	if(argc != 5) {
+		smt::error("Usage: textcompare <input> <reference> <abstol> <reltol>");
+		return EXIT_FAILURE;
+	}
+	const std::vector<token> input = tokens(argv[1]);
+	const std::vector<token> reference = tokens(argv[2]);
+	const double abstol = std::strtod(argv[3], nullptr);
+	const double reltol = std::strtod(argv[4], nullptr);
+
+	if(input.size() != reference.size()) {
+		smt::error("‘" + std::string(argv[1]) + "’ and ‘" + std::string(argv[2]) + "’ differ in structure.");
+		return EXIT_FAILURE;
+	}
+	std::size_t nexceeded = 0;
+	for(std::size_t ii = 0; ii < input.size(); ++ii) {
+		if(input[ii].number && reference[ii].number) {
+			const double a = std::strtod(input[ii].text.c_str(), nullptr);
+			const double b = std::strtod(reference[ii].text.c_str(), nullptr);
+			if(std::abs(a-b) > abstol+reltol*std::abs(b)) {
+				smt::error("‘" + input[ii].text + "’ differs from ‘" + reference[ii].text + "’.");
+				++nexceeded;
+			}
+		} else if(input[ii].number != reference[ii].number || input[ii].text != reference[ii].text) {
+			smt::error("‘" + input[ii].text + "’ differs from ‘" + reference[ii].text + "’.");
+			++nexceeded;
+		}
+	}
+
+	return (nexceeded == 0)? EXIT_SUCCESS : EXIT_FAILURE;
+}